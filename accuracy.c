@@ -0,0 +1,129 @@
+/*
+ * Accuracy versus speed of the streaming mode.
+ *
+ * The same generated values are summarized exactly and with t-digests built
+ * with a range of compression parameters delta and K. For each pair, the
+ * error on the quantiles from p1 to p99.9 is reported next to the insertion
+ * throughput and the number of centroids, so that the parameters can be tuned
+ * for a given workload. The default parameters, DEFAULT_DELTA and DEFAULT_K,
+ * are always part of the sweep. Results are written to stdout as JSON.
+ *
+ * Two errors are given for each quantile: the rank error, which is the
+ * difference between the requested quantile and the fraction of the data
+ * smaller than the estimate, and the value error relative to the
+ * interquartile range, which does not blow up for quantiles close to 0.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "dbg.h"
+#include "stats.h"
+
+#define DEFAULT_N 50000
+
+static double quantiles[] = {0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99, 0.999};
+#define NQUANTILES (sizeof(quantiles) / sizeof(quantiles[0]))
+
+static double deltas[] = {0.005, DEFAULT_DELTA, 0.02, 0.05};
+#define NDELTAS (sizeof(deltas) / sizeof(deltas[0]))
+
+static unsigned int Ks[] = {25, 50, DEFAULT_K};
+#define NKS (sizeof(Ks) / sizeof(Ks[0]))
+
+static char *measured[] = {"uniform", "normal", "lognormal", "sorted"};
+#define NMEASURED (sizeof(measured) / sizeof(measured[0]))
+
+void usage()
+{
+    fprintf(stderr, "usage: accuracy [N]\n"
+                    "  Measure the error of the streaming mode on N generated\n"
+                    "  values (default %d) for several digest parameters and print\n"
+                    "  the results as JSON.\n", DEFAULT_N);
+}
+
+void measure(distribution *dist, size_t n, int *first)
+{
+    double *values = NULL, *sorted_values = NULL;
+    double exact[NQUANTILES], estimate, t0, elapsed, iqr;
+    dataset *ds = NULL;
+    TDigest *digest;
+    size_t i, d, k;
+
+    values = malloc(n * sizeof(double));
+    check_mem(values);
+    srand(42);
+    for (i = 0; i < n; i++)
+        values[i] = dist->generate(i, n);
+
+    // Exact quantiles, computed as in the exact mode of desc.
+    ds = create_dataset(values, n);
+    check(ds, "Could not create dataset.");
+    for (i = 0; i < NQUANTILES; i++)
+        exact[i] = percentile(ds, 100 * quantiles[i]);
+    iqr = interquartile_range(ds);
+    sorted_values = malloc(n * sizeof(double));
+    check_mem(sorted_values);
+    memcpy(sorted_values, values, n * sizeof(double));
+    qsort(sorted_values, n, sizeof(double), doublecmp);
+
+    for (d = 0; d < NDELTAS; d++) {
+        for (k = 0; k < NKS; k++) {
+            digest = TDigest_create(deltas[d], Ks[k]);
+            check_mem(digest);
+            t0 = now();
+            for (i = 0; i < n; i++)
+                TDigest_add(&digest, values[i], 1);
+            elapsed = now() - t0;
+
+            printf("%s\n    {\"distribution\": \"%s\", \"n\": %zu, "
+                   "\"delta\": %g, \"K\": %u,\n"
+                   "     \"adds_per_s\": %.6g, \"ncentroids\": %zu, "
+                   "\"ncompressions\": %zu,\n     \"quantiles\": [",
+                   *first ? "" : ",", dist->name, n, deltas[d], Ks[k],
+                   n / elapsed, TDigest_get_ncentroids(digest),
+                   TDigest_get_ncompressions(digest));
+            for (i = 0; i < NQUANTILES; i++) {
+                estimate = TDigest_percentile(digest, quantiles[i]);
+                printf("%s\n       {\"q\": %g, \"exact\": %.17g, \"estimate\": %.17g, "
+                       "\"rank_error\": %.3e, \"iqr_error\": %.3e}",
+                       i ? "," : "", quantiles[i], exact[i], estimate,
+                       fabs(rank_of(sorted_values, n, estimate) - quantiles[i]),
+                       iqr > 0 ? fabs(estimate - exact[i]) / iqr : 0.0);
+            }
+            printf("]}");
+            fflush(stdout);
+            *first = 0;
+            TDigest_destroy(digest);
+        }
+    }
+
+error:
+    if (ds) delete_dataset(ds);
+    free(sorted_values);
+    free(values);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t i, n = DEFAULT_N;
+    int first = 1;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+        if (n < 2) {
+            usage();
+            return 1;
+        }
+    }
+
+    printf("{\n  \"default_delta\": %g, \"default_K\": %d,\n  \"runs\": [",
+           DEFAULT_DELTA, DEFAULT_K);
+    for (i = 0; i < NMEASURED; i++)
+        measure(find_distribution(measured[i]), n, &first);
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
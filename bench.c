@@ -0,0 +1,219 @@
+/*
+ * Benchmark harness for desc.
+ *
+ * Synthetic data files are generated for several distributions and sizes.
+ * For each of them, the following are measured with a monotonic clock:
+ *
+ *   - ingest: read_data_file in exact mode, reported in MB/s of input,
+ *   - selection: Q1, median and Q3 in exact mode,
+ *   - streaming: TDigest_add rate and the cost of one TDigest_compress,
+ *   - peak resident memory.
+ *
+ * Every case runs in its own child process so that the peak resident memory
+ * is that of the case alone. Results are written to stdout as JSON so that
+ * they can be compared between runs to catch regressions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bench_util.h"
+#include "dbg.h"
+#include "stats.h"
+
+#define DEFAULT_MAX_N 1000000
+#define MIN_N 10000
+// The t-digest is much slower than the exact mode, cap the number of values
+// added to it so that the whole suite runs in a reasonable time.
+#define TDIGEST_MAX_N 100000
+
+typedef struct results {
+    size_t file_bytes;
+    double parse_seconds;
+    double select_seconds;
+    size_t tdigest_n;
+    double tdigest_seconds;
+    double compress_seconds;
+    size_t ncentroids;
+    int ok;
+} results;
+
+void usage()
+{
+    fprintf(stderr, "usage: bench [MAX_N]\n"
+                    "  Run the benchmarks on generated data sets of %d up to MAX_N\n"
+                    "  (default %d) values and print the results as JSON.\n",
+                    MIN_N, DEFAULT_MAX_N);
+}
+
+// Distributions benchmarked, see bench_util.c.
+static char *benchmarked[] = {
+    "uniform", "normal", "sorted", "all_equal", "heavy_tailed", "few_distinct"
+};
+#define NBENCHMARKED (sizeof(benchmarked) / sizeof(benchmarked[0]))
+
+int write_data(char *filename, generator generate, size_t n)
+{
+    // Write n generated values to filename, one per line, with enough digits
+    // to read them back exactly.
+    FILE *fp = fopen(filename, "w");
+    size_t i;
+
+    check(fp, "Could not create %s.", filename);
+    for (i = 0; i < n; i++)
+        fprintf(fp, "%.17g\n", generate(i, n));
+    check(fclose(fp) == 0, "Could not write %s.", filename);
+    return 1;
+
+error:
+    return 0;
+}
+
+void run_case(char *filename, size_t n, results *res)
+{
+    // Run the measurements on filename, which holds n values.
+    struct stat st;
+    dataset *ds = NULL;
+    TDigest *digest = NULL;
+    double t0;
+    size_t i;
+
+    memset(res, 0, sizeof(results));
+    check(stat(filename, &st) == 0, "Could not stat %s.", filename);
+    res->file_bytes = st.st_size;
+
+    t0 = now();
+    ds = read_data_file(filename, false);
+    res->parse_seconds = now() - t0;
+    check(ds, "Could not read %s.", filename);
+
+    res->tdigest_n = n < TDIGEST_MAX_N ? n : TDIGEST_MAX_N;
+    digest = TDigest_create(DEFAULT_DELTA, DEFAULT_K);
+    check_mem(digest);
+    t0 = now();
+    for (i = 0; i < res->tdigest_n; i++)
+        TDigest_add(&digest, ds->data[i], 1);
+    res->tdigest_seconds = now() - t0;
+    res->ncentroids = TDigest_get_ncentroids(digest);
+
+    t0 = now();
+    TDigest_compress(&digest);
+    res->compress_seconds = now() - t0;
+
+    // Selection reorders the data, so it comes after the t-digest has seen
+    // the values in file order.
+    t0 = now();
+    first_quartile(ds);
+    median(ds);
+    third_quartile(ds);
+    res->select_seconds = now() - t0;
+
+    res->ok = 1;
+
+error:
+    if (digest) TDigest_destroy(digest);
+    if (ds) delete_dataset(ds);
+}
+
+int run_isolated(char *filename, size_t n, results *res, long *peak_rss_kb)
+{
+    // Run a case in a child process and collect its results and peak memory.
+    int fds[2];
+    pid_t pid;
+    int status;
+    struct rusage usage;
+
+    check(pipe(fds) == 0, "Could not create pipe.");
+    pid = fork();
+    check(pid >= 0, "Could not fork.");
+    if (pid == 0) {
+        close(fds[0]);
+        run_case(filename, n, res);
+        if (write(fds[1], res, sizeof(results)) != sizeof(results))
+            _exit(1);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    memset(res, 0, sizeof(results));
+    if (read(fds[0], res, sizeof(results)) != sizeof(results))
+        res->ok = 0;
+    close(fds[0]);
+    check(wait4(pid, &status, 0, &usage) == pid, "Could not wait for child.");
+
+#ifdef __APPLE__
+    *peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+    *peak_rss_kb = usage.ru_maxrss;
+#endif
+    return res->ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+error:
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char filename[] = "/tmp/desc-bench-XXXXXX";
+    size_t d, n, max_n = DEFAULT_MAX_N;
+    distribution *dist;
+    int fd, first = 1;
+    long peak_rss_kb;
+    results res;
+
+    if (argc > 1) {
+        max_n = strtoul(argv[1], NULL, 10);
+        if (max_n < MIN_N) {
+            usage();
+            return 1;
+        }
+    }
+
+    fd = mkstemp(filename);
+    check(fd >= 0, "Could not create temporary file.");
+    close(fd);
+
+    printf("{\n  \"benchmarks\": [");
+    for (d = 0; d < NBENCHMARKED; d++) {
+        dist = find_distribution(benchmarked[d]);
+        for (n = MIN_N; n <= max_n; n *= 10) {
+            srand(42);
+            check(write_data(filename, dist->generate, n),
+                  "Could not generate data.");
+            if (!run_isolated(filename, n, &res, &peak_rss_kb)) {
+                log_warn("Benchmark %s with %zu values failed.",
+                         dist->name, n);
+                continue;
+            }
+
+            printf("%s\n    {\"distribution\": \"%s\", \"n\": %zu, "
+                   "\"file_bytes\": %zu,\n"
+                   "     \"parse_seconds\": %.6g, \"parse_mb_per_s\": %.6g,\n"
+                   "     \"select_seconds\": %.6g,\n"
+                   "     \"tdigest_n\": %zu, \"tdigest_adds_per_s\": %.6g, "
+                   "\"ncentroids\": %zu, \"compress_seconds\": %.6g,\n"
+                   "     \"peak_rss_kb\": %ld}",
+                   first ? "" : ",", dist->name, n, res.file_bytes,
+                   res.parse_seconds, res.file_bytes / res.parse_seconds / 1e6,
+                   res.select_seconds,
+                   res.tdigest_n, res.tdigest_n / res.tdigest_seconds,
+                   res.ncentroids, res.compress_seconds,
+                   peak_rss_kb);
+            fflush(stdout);
+            first = 0;
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    unlink(filename);
+    return 0;
+
+error:
+    unlink(filename);
+    return 1;
+}
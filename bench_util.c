@@ -0,0 +1,99 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench_util.h"
+
+double now()
+{
+    // Monotonic wall clock time in seconds.
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int doublecmp(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+double rank_of(double *values, size_t n, double x)
+{
+    // Fraction of the sorted values that are smaller than x, counting ties as
+    // half.
+    size_t lo = 0, hi = n, mid, below;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (values[mid] < x) lo = mid + 1; else hi = mid;
+    }
+    below = lo;
+    hi = n;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (values[mid] <= x) lo = mid + 1; else hi = mid;
+    }
+    return (below + lo) / 2.0 / n;
+}
+
+double uniform(size_t i, size_t n)
+{
+    (void)i; (void)n;
+    return (rand() + 1.0) / (RAND_MAX + 2.0);
+}
+
+double normal(size_t i, size_t n)
+{
+    // Box-Muller transform.
+    return sqrt(-2 * log(uniform(i, n))) * cos(2 * M_PI * uniform(i, n));
+}
+
+double lognormal(size_t i, size_t n)
+{
+    return exp(2 * normal(i, n));
+}
+
+double sorted(size_t i, size_t n)
+{
+    return (double)i / n;
+}
+
+double all_equal(size_t i, size_t n)
+{
+    (void)i; (void)n;
+    return 42.0;
+}
+
+double heavy_tailed(size_t i, size_t n)
+{
+    // Pareto distribution with shape 1.1, which has an infinite variance.
+    return pow(uniform(i, n), -1 / 1.1);
+}
+
+double few_distinct(size_t i, size_t n)
+{
+    (void)i; (void)n;
+    return rand() % 10;
+}
+
+distribution distributions[] = {
+    { "uniform", uniform },
+    { "normal", normal },
+    { "lognormal", lognormal },
+    { "sorted", sorted },
+    { "all_equal", all_equal },
+    { "heavy_tailed", heavy_tailed },
+    { "few_distinct", few_distinct },
+};
+size_t ndistributions = sizeof(distributions) / sizeof(distributions[0]);
+
+distribution *find_distribution(char *name)
+{
+    size_t i;
+
+    for (i = 0; i < ndistributions; i++)
+        if (strcmp(distributions[i].name, name) == 0)
+            return &distributions[i];
+    return NULL;
+}
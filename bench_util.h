@@ -0,0 +1,34 @@
+/*
+ * Helpers shared by the benchmark programs: a monotonic clock, generators
+ * for synthetic data sets and the rank of a value among sorted values.
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stddef.h>
+
+// Generate the ith of n values.
+typedef double (*generator)(size_t i, size_t n);
+
+typedef struct distribution {
+    char *name;
+    generator generate;
+} distribution;
+
+extern distribution distributions[];
+extern size_t ndistributions;
+
+double now();
+int doublecmp(const void *a, const void *b);
+double rank_of(double *values, size_t n, double x);
+distribution *find_distribution(char *name);
+double uniform(size_t i, size_t n);
+double normal(size_t i, size_t n);
+double lognormal(size_t i, size_t n);
+double sorted(size_t i, size_t n);
+double all_equal(size_t i, size_t n);
+double heavy_tailed(size_t i, size_t n);
+double few_distinct(size_t i, size_t n);
+
+#endif
@@ -0,0 +1,236 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "collector.h"
+#include "dbg.h"
+
+// Largest number of values the aggregation thread takes out of the ring
+// before adding them to the summary.
+#define COLLECTOR_BATCH 1024
+#define COLLECTOR_IDLE_NS 50000
+#define CACHE_LINE_SIZE 64
+
+typedef struct Slot {
+    // Sequence number of the slot. It is equal to the position of the slot
+    // when it is free for that position, and to the position plus one once
+    // the value has been written.
+    size_t seq;
+    double value;
+} Slot;
+
+struct Collector {
+    Slot *ring;
+    size_t mask;
+    collector_policy policy;
+
+    // Written by the producers. Each group is on its own cache line so that
+    // producers and the aggregation thread don't invalidate each other's
+    // lines more than necessary.
+    _Alignas(CACHE_LINE_SIZE) size_t tail;
+    size_t sample_counter;
+    size_t dropped;
+    size_t sampled_out;
+
+    // Written by the aggregation thread.
+    _Alignas(CACHE_LINE_SIZE) size_t head;
+    size_t aggregated;
+    bool stop;
+    pthread_t thread;
+
+    // Protects s, which is only updated by the aggregation thread.
+    pthread_mutex_t lock;
+    Summarizer *s;
+};
+
+static void Collector_sleep(long ns)
+{
+    struct timespec ts = { 0, ns };
+    nanosleep(&ts, NULL);
+}
+
+static bool Collector_enqueue(Collector *c, double x)
+{
+    // Claim the slot at the tail of the ring with a compare and swap, then
+    // write the value and publish it. Returns false if the ring is full.
+    size_t pos = __atomic_load_n(&(c->tail), __ATOMIC_RELAXED);
+    Slot *slot;
+    intptr_t dif;
+
+    while (true) {
+        slot = &(c->ring[pos & c->mask]);
+        dif = (intptr_t)__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) -
+              (intptr_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&(c->tail), &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&(c->tail), __ATOMIC_RELAXED);
+        }
+    }
+    slot->value = x;
+    __atomic_store_n(&(slot->seq), pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool Collector_dequeue(Collector *c, double *x)
+{
+    // Take the value at the head of the ring, if it has been published. Only
+    // called by the aggregation thread.
+    Slot *slot = &(c->ring[c->head & c->mask]);
+
+    if (__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != c->head + 1)
+        return false;
+    *x = slot->value;
+    // Free the slot for the next round of the ring.
+    __atomic_store_n(&(slot->seq), c->head + c->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&(c->head), c->head + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static void *Collector_run(void *arg)
+{
+    // Aggregation thread: drain the ring in batches until the collector is
+    // destroyed, then drain what is left.
+    Collector *c = (Collector*)arg;
+    double batch[COLLECTOR_BATCH];
+    size_t n;
+    bool stopping;
+
+    while (true) {
+        stopping = __atomic_load_n(&(c->stop), __ATOMIC_ACQUIRE);
+        for (n = 0; n < COLLECTOR_BATCH && Collector_dequeue(c, &batch[n]); n++)
+            ;
+        if (n > 0) {
+            pthread_mutex_lock(&(c->lock));
+            Summarizer_add_batch(c->s, batch, n);
+            pthread_mutex_unlock(&(c->lock));
+            __atomic_fetch_add(&(c->aggregated), n, __ATOMIC_RELEASE);
+        } else if (stopping) {
+            break;
+        } else {
+            Collector_sleep(COLLECTOR_IDLE_NS);
+        }
+    }
+    return NULL;
+}
+
+Collector *Collector_create(summarizer_mode mode, size_t capacity,
+                            collector_policy policy)
+{
+    // Create a collector whose ring holds capacity values, rounded up to a
+    // power of two, and start its aggregation thread.
+    Collector *c = NULL;
+    size_t i, size = 2;
+
+    while (size < capacity)
+        size *= 2;
+    check(posix_memalign((void**)&c, CACHE_LINE_SIZE, sizeof(Collector)) == 0,
+          "Out of memory.");
+    memset(c, 0, sizeof(Collector));
+    c->policy = policy;
+    c->mask = size - 1;
+    c->ring = malloc(size * sizeof(Slot));
+    check_mem(c->ring);
+    for (i = 0; i < size; i++)
+        c->ring[i].seq = i;
+    c->s = Summarizer_create(mode);
+    check(c->s, "Could not create summarizer.");
+    pthread_mutex_init(&(c->lock), NULL);
+    if (pthread_create(&(c->thread), NULL, Collector_run, c) != 0) {
+        pthread_mutex_destroy(&(c->lock));
+        sentinel("Could not start aggregation thread.");
+    }
+    return c;
+
+error:
+    if (c) {
+        Summarizer_destroy(c->s);
+        free(c->ring);
+        free(c);
+    }
+    return NULL;
+}
+
+void Collector_destroy(Collector *c)
+{
+    // Stop the aggregation thread once the ring is drained. No producer may
+    // use the collector anymore.
+    if (!c)
+        return;
+    __atomic_store_n(&(c->stop), true, __ATOMIC_RELEASE);
+    pthread_join(c->thread, NULL);
+    pthread_mutex_destroy(&(c->lock));
+    Summarizer_destroy(c->s);
+    free(c->ring);
+    free(c);
+}
+
+int Collector_add(Collector *c, double x)
+{
+    // Enqueue x. Returns 1 if it was enqueued and 0 if it was dropped or
+    // sampled out.
+    size_t head, size;
+
+    if (c->policy == COLLECTOR_SAMPLE) {
+        // Read the head first, so that it can't be past the tail.
+        head = __atomic_load_n(&(c->head), __ATOMIC_ACQUIRE);
+        size = __atomic_load_n(&(c->tail), __ATOMIC_ACQUIRE) - head;
+        if (size > (c->mask + 1) * 3 / 4 &&
+                __atomic_fetch_add(&(c->sample_counter), 1, __ATOMIC_RELAXED) %
+                COLLECTOR_SAMPLE_RATE != 0) {
+            __atomic_fetch_add(&(c->sampled_out), 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    while (!Collector_enqueue(c, x)) {
+        if (c->policy != COLLECTOR_BLOCK) {
+            __atomic_fetch_add(&(c->dropped), 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        sched_yield();
+    }
+    return 1;
+}
+
+void Collector_flush(Collector *c)
+{
+    // Wait until every value enqueued before the call has been aggregated.
+    size_t target = __atomic_load_n(&(c->tail), __ATOMIC_ACQUIRE);
+
+    while (__atomic_load_n(&(c->aggregated), __ATOMIC_ACQUIRE) < target)
+        Collector_sleep(COLLECTOR_IDLE_NS);
+}
+
+Summarizer *Collector_snapshot(Collector *c)
+{
+    // Copy of the values aggregated so far, which the caller must destroy.
+    // Call Collector_flush first to include the values still in the ring.
+    Summarizer *snapshot = Summarizer_create(Summarizer_get_mode(c->s));
+    int ok;
+
+    check(snapshot, "Could not create snapshot.");
+    pthread_mutex_lock(&(c->lock));
+    ok = Summarizer_merge(snapshot, c->s);
+    pthread_mutex_unlock(&(c->lock));
+    check(ok, "Could not copy summary.");
+    return snapshot;
+
+error:
+    Summarizer_destroy(snapshot);
+    return NULL;
+}
+
+void Collector_get_stats(Collector *c, collector_stats *stats)
+{
+    stats->enqueued = __atomic_load_n(&(c->tail), __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&(c->dropped), __ATOMIC_RELAXED);
+    stats->sampled_out = __atomic_load_n(&(c->sampled_out), __ATOMIC_RELAXED);
+    stats->aggregated = __atomic_load_n(&(c->aggregated), __ATOMIC_RELAXED);
+}
@@ -0,0 +1,50 @@
+/*
+ * Summarizer fed through a queue by a dedicated aggregation thread.
+ *
+ * Producers enqueue values into a bounded lock-free multi-producer ring
+ * (Dmitry Vyukov's bounded queue, with a single consumer), and an aggregation
+ * thread drains it in batches into a Summarizer. Recording threads only pay
+ * for the enqueue, whatever the cost of maintaining the summary.
+ *
+ * What happens when the ring is full depends on the policy:
+ *
+ *   COLLECTOR_DROP    the value is dropped and counted,
+ *   COLLECTOR_BLOCK   the producer waits for room,
+ *   COLLECTOR_SAMPLE  once the ring is three quarters full, only one value in
+ *                     COLLECTOR_SAMPLE_RATE is enqueued and the others are
+ *                     counted as sampled out, which keeps a uniform sample of
+ *                     the data under overload. Values are dropped if the ring
+ *                     is full all the same.
+ */
+
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include "summarizer.h"
+
+#define COLLECTOR_SAMPLE_RATE 8
+
+typedef enum collector_policy {
+    COLLECTOR_DROP,
+    COLLECTOR_BLOCK,
+    COLLECTOR_SAMPLE
+} collector_policy;
+
+typedef struct collector_stats {
+    size_t enqueued;
+    size_t dropped;
+    size_t sampled_out;
+    size_t aggregated;
+} collector_stats;
+
+typedef struct Collector Collector;
+
+DESC_API Collector *Collector_create(summarizer_mode mode, size_t capacity,
+                                     collector_policy policy);
+DESC_API void Collector_destroy(Collector *c);
+DESC_API int Collector_add(Collector *c, double x);
+DESC_API void Collector_flush(Collector *c);
+DESC_API Summarizer *Collector_snapshot(Collector *c);
+DESC_API void Collector_get_stats(Collector *c, collector_stats *stats);
+
+#endif
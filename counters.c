@@ -0,0 +1,69 @@
+#include <time.h>
+#include "counters.h"
+
+counters desc_counters;
+
+void Counters_max(size_t *counter, size_t x)
+{
+    // Raise counter to x if it is smaller.
+    size_t old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+    while (old < x && !__atomic_compare_exchange_n(counter, &old, x, true,
+                                                   __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED))
+        ;
+}
+
+double Counters_now(void)
+{
+    // Monotonic time in seconds, for the phase timings.
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void Counters_print(FILE *fp)
+{
+    counters *c = &desc_counters;
+
+    fprintf(fp, "Phases (seconds)\n");
+    fprintf(fp, "  read                  %.6f\n", c->read_seconds);
+    fprintf(fp, "  merge                 %.6f\n", c->merge_seconds);
+    fprintf(fp, "  summary               %.6f\n", c->summary_seconds);
+    if (c->distinct_bytes > 0 || c->topk_bytes > 0) {
+        fprintf(fp, "\nValue sketches (bytes)\n");
+        fprintf(fp, "  distinct              %zu\n", c->distinct_bytes);
+        fprintf(fp, "  top values            %zu\n", c->topk_bytes);
+    }
+
+    if (!COUNTERS_ENABLED) {
+        fprintf(fp, "\nOther counters are not available, rebuild desc with "
+                    "COUNTERS=1.\n");
+        return;
+    }
+
+    fprintf(fp, "\nInput\n");
+    fprintf(fp, "  bytes read            %zu\n", c->bytes_read);
+    fprintf(fp, "  bytes decompressed    %zu\n", c->bytes_decompressed);
+    fprintf(fp, "  lines parsed          %zu\n", c->lines_parsed);
+    fprintf(fp, "  lines rejected        %zu\n", c->lines_rejected);
+    fprintf(fp, "  values rejected       %zu\n", c->values_rejected);
+    fprintf(fp, "\nData array\n");
+    fprintf(fp, "  reallocs              %zu\n", c->reallocs);
+    fprintf(fp, "  bytes copied (total)  %zu\n", c->realloc_bytes);
+    fprintf(fp, "\nSelection\n");
+    fprintf(fp, "  calls                 %zu\n", c->select_calls);
+    fprintf(fp, "  partition passes      %zu\n", c->select_passes);
+    fprintf(fp, "  elements touched      %zu\n", c->select_touched);
+    fprintf(fp, "  sorts                 %zu\n", c->sorts);
+    fprintf(fp, "\nSketch\n");
+    fprintf(fp, "  adds                  %zu\n", c->sketch_adds);
+    fprintf(fp, "  digest compressions   %zu\n", c->digest_compressions);
+    fprintf(fp, "  peak centroids        %zu\n", c->peak_centroids);
+    fprintf(fp, "\nSpill\n");
+    fprintf(fp, "  runs                  %zu\n", c->spill_runs);
+    fprintf(fp, "  bytes written         %zu\n", c->spill_bytes_written);
+    fprintf(fp, "  passes                %zu\n", c->spill_passes);
+    fprintf(fp, "  bytes read            %zu\n", c->spill_bytes_read);
+}
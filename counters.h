@@ -0,0 +1,63 @@
+/*
+ * Instrumentation counters for the hot paths of desc.
+ *
+ * The counters are compiled out unless desc is built with COUNTERS=1, which
+ * defines DESC_COUNTERS. COUNTER_ADD and COUNTER_MAX then update a single
+ * global set of counters with relaxed atomic operations, so they can be used
+ * from the reader threads. They are meant to be called once per block, file
+ * or pass rather than once per value. The phase timings and the size of the
+ * sketches of distinct and frequent values are always recorded, they only
+ * cost a clock read per phase.
+ */
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct counters {
+    size_t bytes_read;
+    size_t bytes_decompressed;
+    size_t lines_parsed;
+    size_t lines_rejected;
+    size_t values_rejected;
+    size_t reallocs;
+    size_t realloc_bytes;
+    size_t select_calls;
+    size_t select_passes;
+    size_t select_touched;
+    size_t sorts;
+    size_t sketch_adds;
+    size_t digest_compressions;
+    size_t peak_centroids;
+    size_t spill_runs;
+    size_t spill_bytes_written;
+    size_t spill_passes;
+    size_t spill_bytes_read;
+    double read_seconds;
+    double merge_seconds;
+    double summary_seconds;
+    size_t distinct_bytes;
+    size_t topk_bytes;
+} counters;
+
+extern counters desc_counters;
+
+#ifdef DESC_COUNTERS
+#define COUNTERS_ENABLED true
+#define COUNTER_ADD(name, n) \
+    __atomic_fetch_add(&(desc_counters.name), (n), __ATOMIC_RELAXED)
+#define COUNTER_MAX(name, x) Counters_max(&(desc_counters.name), (x))
+#else
+#define COUNTERS_ENABLED false
+#define COUNTER_ADD(name, n) ((void)0)
+#define COUNTER_MAX(name, x) ((void)0)
+#endif
+
+void Counters_max(size_t *counter, size_t x);
+double Counters_now(void);
+void Counters_print(FILE *fp);
+
+#endif
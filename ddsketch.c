@@ -0,0 +1,386 @@
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbg.h"
+#include "ddsketch.h"
+
+// Coefficients of the cubic approximation of log2(1 + s) for s in [0, 1).
+#define A (6.0 / 35.0)
+#define B (-3.0 / 5.0)
+#define C (10.0 / 7.0)
+
+// The derivative of the cubic approximation with respect to the true log2 is
+// at least this much, so buckets are never wider than intended once the index
+// multiplier is divided by it.
+#define MIN_SLOPE 0.9902
+
+// Smallest positive value that gets its own bucket. Anything closer to 0 is
+// counted as 0.
+#define MIN_INDEXABLE DBL_MIN
+
+#define STORE_MARGIN 64
+
+typedef struct DDStore {
+    uint64_t *counts;
+    int offset;
+    size_t size;
+} DDStore;
+
+struct DDSketch {
+    DDStore positive;
+    DDStore negative;
+    uint64_t zero_count;
+    size_t count;
+    double alpha;
+    double multiplier;
+    double min;
+    double max;
+};
+
+static inline double approx_log2(double x)
+{
+    // Approximate log2(x) for a positive normal x. The exponent is read from
+    // the bits of x and log2 of the mantissa is interpolated with a cubic
+    // polynomial that is exact at 1 and 2.
+    union { double d; uint64_t u; } v;
+    double s;
+    int e;
+
+    v.d = x;
+    e = (int)((v.u >> 52) & 0x7ff) - 1023;
+    v.u = (v.u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+    s = v.d - 1;
+    return e + ((A * s + B) * s + C) * s;
+}
+
+static double approx_exp2(double t)
+{
+    // Inverse of approx_log2, only used for queries.
+    double e = floor(t), f = t - e, s = f, p, dp;
+    int i;
+
+    // Newton's method on the cubic, which is monotonic on [0, 1].
+    for (i = 0; i < 8; i++) {
+        p = ((A * s + B) * s + C) * s - f;
+        dp = (3 * A * s + 2 * B) * s + C;
+        s -= p / dp;
+    }
+    return ldexp(1 + s, (int)e);
+}
+
+static inline int DDSketch_index(DDSketch *sketch, double x)
+{
+    return (int)floor(approx_log2(x) * sketch->multiplier);
+}
+
+static double DDSketch_value(DDSketch *sketch, int index)
+{
+    // Representative value of bucket index. The harmonic mean of the bucket
+    // bounds is within alpha of any value in the bucket.
+    double lo = approx_exp2(index / sketch->multiplier);
+    double hi = approx_exp2((index + 1) / sketch->multiplier);
+    return 2 * lo * hi / (lo + hi);
+}
+
+static int DDStore_add(DDStore *store, int index, uint64_t w)
+{
+    // Add w to the count of bucket index, growing the store to cover it.
+    int lo, hi;
+    uint64_t *counts;
+
+    if (store->size == 0) {
+        lo = index - STORE_MARGIN;
+        hi = index + STORE_MARGIN;
+    } else if (index < store->offset) {
+        lo = index - STORE_MARGIN;
+        hi = store->offset + (int)store->size;
+    } else if (index >= store->offset + (int)store->size) {
+        lo = store->offset;
+        hi = index + STORE_MARGIN;
+    } else {
+        store->counts[index - store->offset] += w;
+        return 1;
+    }
+
+    counts = calloc(hi - lo, sizeof(uint64_t));
+    check_mem(counts);
+    if (store->size > 0)
+        memcpy(counts + (store->offset - lo), store->counts,
+               store->size * sizeof(uint64_t));
+    free(store->counts);
+    store->counts = counts;
+    store->offset = lo;
+    store->size = hi - lo;
+    store->counts[index - store->offset] += w;
+    return 1;
+
+error:
+    return 0;
+}
+
+static void DDStore_serialize(DDStore *store, Writer *w)
+{
+    Writer_put_i32(w, store->offset);
+    Writer_put_u64(w, store->size);
+    Writer_put(w, store->counts, store->size * sizeof(uint64_t));
+}
+
+static int DDStore_deserialize(DDStore *store, Reader *r)
+{
+    int32_t offset = Reader_get_i32(r);
+    uint64_t size = Reader_get_u64(r);
+
+    check(Reader_has(r, size, sizeof(uint64_t)), "Truncated DDSketch.");
+    if (size == 0)
+        return 1;
+    store->counts = malloc(size * sizeof(uint64_t));
+    check_mem(store->counts);
+    Reader_get(r, store->counts, size * sizeof(uint64_t));
+    store->offset = offset;
+    store->size = size;
+    return 1;
+
+error:
+    return 0;
+}
+
+static size_t DDStore_nbuckets(DDStore *store)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < store->size; i++)
+        if (store->counts[i])
+            n++;
+    return n;
+}
+
+DDSketch *DDSketch_create(double alpha)
+{
+    // Create a sketch whose quantiles are within relative error alpha, which
+    // must be between 0 and 1.
+    DDSketch *sketch = NULL;
+    double gamma;
+
+    check(alpha > 0 && alpha < 1, "DDSketch relative accuracy must be in (0, 1).");
+    sketch = calloc(1, sizeof(DDSketch));
+    check_mem(sketch);
+
+    gamma = (1 + alpha) / (1 - alpha);
+    sketch->alpha = alpha;
+    sketch->multiplier = 1 / (MIN_SLOPE * log2(gamma));
+    return sketch;
+
+error:
+    return NULL;
+}
+
+void DDSketch_destroy(DDSketch *sketch)
+{
+    if (!sketch)
+        return;
+    free(sketch->positive.counts);
+    free(sketch->negative.counts);
+    free(sketch);
+}
+
+int DDSketch_add(DDSketch *sketch, double x, size_t w)
+{
+    if (sketch->count == 0) {
+        sketch->min = x;
+        sketch->max = x;
+    } else if (x < sketch->min) {
+        sketch->min = x;
+    } else if (x > sketch->max) {
+        sketch->max = x;
+    }
+    sketch->count += w;
+
+    if (x >= MIN_INDEXABLE) {
+        return DDStore_add(&(sketch->positive), DDSketch_index(sketch, x), w);
+    } else if (x <= -MIN_INDEXABLE) {
+        return DDStore_add(&(sketch->negative), DDSketch_index(sketch, -x), w);
+    }
+    sketch->zero_count += w;
+    return 1;
+}
+
+int DDSketch_merge(DDSketch *sketch, DDSketch *other)
+{
+    // Add the bucket counts of other to sketch. Both sketches must have been
+    // created with the same alpha.
+    size_t i;
+
+    check(sketch->alpha == other->alpha,
+          "Can't merge DDSketches with different accuracies.");
+    if (other->count == 0)
+        return 1;
+
+    for (i = 0; i < other->positive.size; i++) {
+        if (other->positive.counts[i])
+            check(DDStore_add(&(sketch->positive), other->positive.offset + (int)i,
+                              other->positive.counts[i]), "Could not merge.");
+    }
+    for (i = 0; i < other->negative.size; i++) {
+        if (other->negative.counts[i])
+            check(DDStore_add(&(sketch->negative), other->negative.offset + (int)i,
+                              other->negative.counts[i]), "Could not merge.");
+    }
+    sketch->zero_count += other->zero_count;
+    if (sketch->count == 0 || other->min < sketch->min)
+        sketch->min = other->min;
+    if (sketch->count == 0 || other->max > sketch->max)
+        sketch->max = other->max;
+    sketch->count += other->count;
+    return 1;
+
+error:
+    return 0;
+}
+
+double DDSketch_percentile(DDSketch *sketch, double q)
+{
+    // Return the qth quantile, q between 0 and 1. Negative values come first,
+    // from the largest magnitude down, then zeros, then positive values.
+    double rank, x;
+    uint64_t seen = 0;
+    size_t i;
+
+    check_debug(sketch->count > 0, "Can't compute percentile of empty sketch.");
+    rank = q * (sketch->count - 1);
+
+    x = sketch->max;
+    for (i = sketch->negative.size; i-- > 0;) {
+        seen += sketch->negative.counts[i];
+        if (seen > rank) {
+            x = -DDSketch_value(sketch, sketch->negative.offset + (int)i);
+            goto found;
+        }
+    }
+    seen += sketch->zero_count;
+    if (seen > rank) {
+        x = 0;
+        goto found;
+    }
+    for (i = 0; i < sketch->positive.size; i++) {
+        seen += sketch->positive.counts[i];
+        if (seen > rank) {
+            x = DDSketch_value(sketch, sketch->positive.offset + (int)i);
+            goto found;
+        }
+    }
+
+found:
+    // The bucket value can fall slightly outside of the data.
+    if (x < sketch->min)
+        x = sketch->min;
+    if (x > sketch->max)
+        x = sketch->max;
+    return x;
+
+error:
+#ifdef NAN
+    return NAN;
+#else
+    return 0;
+#endif
+}
+
+double DDSketch_cdf(DDSketch *sketch, double x)
+{
+    // Fraction of the values at or below x, counting the whole of the
+    // buckets whose representative value is at or below x.
+    uint64_t seen = 0;
+    size_t i;
+
+    check_debug(sketch->count > 0, "Can't compute CDF of empty sketch.");
+    if (x < sketch->min)
+        return 0;
+    if (x >= sketch->max)
+        return 1;
+
+    for (i = sketch->negative.size; i-- > 0;) {
+        if (-DDSketch_value(sketch, sketch->negative.offset + (int)i) > x)
+            goto done;
+        seen += sketch->negative.counts[i];
+    }
+    if (x < 0)
+        goto done;
+    seen += sketch->zero_count;
+    for (i = 0; i < sketch->positive.size; i++) {
+        if (DDSketch_value(sketch, sketch->positive.offset + (int)i) > x)
+            goto done;
+        seen += sketch->positive.counts[i];
+    }
+
+done:
+    return (double)seen / sketch->count;
+
+error:
+#ifdef NAN
+    return NAN;
+#else
+    return 0;
+#endif
+}
+
+double DDSketch_get_alpha(DDSketch *sketch)
+{
+    return sketch->alpha;
+}
+
+size_t DDSketch_get_count(DDSketch *sketch)
+{
+    return sketch->count;
+}
+
+size_t DDSketch_get_nbuckets(DDSketch *sketch)
+{
+    // Number of non empty buckets.
+    return DDStore_nbuckets(&(sketch->positive)) +
+           DDStore_nbuckets(&(sketch->negative)) + (sketch->zero_count > 0);
+}
+
+size_t DDSketch_get_memory(DDSketch *sketch)
+{
+    return sizeof(DDSketch) + (sketch->positive.size + sketch->negative.size) *
+           sizeof(uint64_t);
+}
+
+void DDSketch_serialize(DDSketch *sketch, Writer *w)
+{
+    // Write the accuracy and the counts, followed by the positive and negative
+    // stores.
+    Writer_put_double(w, sketch->alpha);
+    Writer_put_u64(w, sketch->zero_count);
+    Writer_put_u64(w, sketch->count);
+    Writer_put_double(w, sketch->min);
+    Writer_put_double(w, sketch->max);
+    DDStore_serialize(&(sketch->positive), w);
+    DDStore_serialize(&(sketch->negative), w);
+}
+
+DDSketch *DDSketch_deserialize(Reader *r)
+{
+    // Read a sketch written by DDSketch_serialize. Returns NULL if the data is
+    // truncated or invalid.
+    DDSketch *sketch = NULL;
+    double alpha = Reader_get_double(r);
+
+    check(!r->failed, "Truncated DDSketch.");
+    sketch = DDSketch_create(alpha);
+    check(sketch, "Invalid DDSketch.");
+    sketch->zero_count = Reader_get_u64(r);
+    sketch->count = Reader_get_u64(r);
+    sketch->min = Reader_get_double(r);
+    sketch->max = Reader_get_double(r);
+    check(DDStore_deserialize(&(sketch->positive), r) &&
+          DDStore_deserialize(&(sketch->negative), r) && !r->failed,
+          "Could not read DDSketch.");
+    return sketch;
+
+error:
+    DDSketch_destroy(sketch);
+    return NULL;
+}
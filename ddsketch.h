@@ -0,0 +1,39 @@
+/*
+ * This is an implementation of DDSketch by Charles Masson, Jee E. Rim and
+ * Homin K. Lee, DDSketch: A Fast and Fully-Mergeable Quantile Sketch with
+ * Relative-Error Guarantees, https://arxiv.org/abs/1908.10693.
+ *
+ * Values are counted in logarithmically spaced buckets, so that any value
+ * returned by a quantile query is within a relative error alpha of the exact
+ * quantile, whatever the distribution. This makes it well suited to heavy
+ * tailed data such as latencies, where the t-digest gives no guarantee in the
+ * tails. Adding a value costs O(1): the logarithm is approximated with a cubic
+ * interpolation between powers of two instead of calling log(), as in the
+ * reference Java implementation. Two sketches with the same alpha merge
+ * exactly by adding their bucket counts.
+ */
+
+#ifndef DDSKETCH_H
+#define DDSKETCH_H
+
+#include <stddef.h>
+#include "serialize.h"
+
+#define DDSKETCH_DEFAULT_ALPHA 0.01
+
+typedef struct DDSketch DDSketch;
+
+DDSketch *DDSketch_create(double alpha);
+void DDSketch_destroy(DDSketch *sketch);
+int DDSketch_add(DDSketch *sketch, double x, size_t w);
+int DDSketch_merge(DDSketch *sketch, DDSketch *other);
+double DDSketch_percentile(DDSketch *sketch, double q);
+double DDSketch_cdf(DDSketch *sketch, double x);
+double DDSketch_get_alpha(DDSketch *sketch);
+size_t DDSketch_get_count(DDSketch *sketch);
+size_t DDSketch_get_nbuckets(DDSketch *sketch);
+size_t DDSketch_get_memory(DDSketch *sketch);
+void DDSketch_serialize(DDSketch *sketch, Writer *w);
+DDSketch *DDSketch_deserialize(Reader *r);
+
+#endif
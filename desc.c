@@ -1,70 +1,1004 @@
+#include <getopt.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include "counters.h"
 #include "dbg.h"
+#include "format.h"
+#include "server.h"
 #include "stats.h"
 
+// Number of bins of --cdf without --hist, and width of the longest bar of the
+// histogram.
+#define DEFAULT_CDF_BINS 20
+#define HIST_BAR_WIDTH 40
+// The output of --format is written whenever this many bytes are buffered,
+// so that its memory doesn't grow with the number of rows.
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+// Room left in the output buffer for the row that fills it, so that the
+// buffer is allocated once unless file names are very long.
+#define OUTPUT_ROW_SIZE 1024
+
+// Statistics that can be selected with -f, in the default order.
+enum field {
+    FIELD_COUNT,
+    FIELD_MIN,
+    FIELD_Q1,
+    FIELD_MEDIAN,
+    FIELD_Q3,
+    FIELD_MAX,
+    FIELD_IQR,
+    FIELD_MEAN,
+    FIELD_VAR,
+    FIELD_SD,
+    FIELD_SKEWNESS,
+    FIELD_KURTOSIS,
+    FIELD_DISTINCT,
+    NFIELDS
+};
+
+static const char *field_names[NFIELDS] = {
+    "count", "min", "Q1", "median", "Q3", "max", "IQR", "mean", "var", "sd",
+    "skewness", "kurtosis", "distinct"
+};
+
+enum output_format {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV,
+    FORMAT_TSV
+};
+
 void usage()
 {
     fprintf(stderr,
-            "usage: desc [-hs] DATAFILE\n\n"
+            "usage: desc [-hs] [-f FIELDS] [--sketch ENGINE] [--hdr DIGITS]\n"
+            "            [--delta DELTA] [--max-centroids N] [--sketch-mem SIZE]\n"
+            "            [-j JOBS]"
+            " [--mem SIZE] [--per-file] [--moments] [--accurate]\n"
+            "            [--hist BINS] [--log-bins] [--cdf] [--distinct]\n"
+            "            [--top K] [--format FORMAT] [--weighted] [--stats]\n"
+            "            [DATAFILE ...]\n"
+            "       desc [--sketch ENGINE | --hdr DIGITS] [--window SECONDS]\n"
+            "            --serve SOCKET\n\n"
             "desc analyse the data in DATAFILE and prints summary statistics\n"
             "that describe the data.\n\n"
             "The input must consist of one number per line. If no DATAFILE is\n"
             "provided, desc reads from standard input which means it can be\n"
-            "used with pipes.\n\n"
+            "used with pipes. A DATAFILE of - also stands for standard input.\n"
+            "When several DATAFILEs are given, they are read concurrently and\n"
+            "the statistics are computed on all of the data.\n\n"
             "Options\n"
             "-------\n"
             "-h    Print this usage message and exit.\n\n"
+            "-f FIELDS, --fields FIELDS\n"
+            "      Print only the statistics in the comma separated list FIELDS,\n"
+            "      in that order, among count, min, Q1, median, Q3, max, IQR,\n"
+            "      mean, var, sd, skewness, kurtosis and distinct. Without Q1,\n"
+            "      median, Q3, IQR, --hist or --cdf, the values are not kept and\n"
+            "      desc runs in constant memory, e.g. with -f mean,sd,min,max.\n\n"
             "-s    Run in streaming mode. This uses almost no memory and run \n"
             "      time scales linearly with input size. However, the percentiles\n"
             "      are calculated approximately.\n\n"
+            "--sketch ENGINE\n"
+            "      Run in streaming mode using ENGINE to approximate the\n"
+            "      percentiles. ENGINE is one of\n"
+            "        tdigest  t-digest, very accurate near the extremes (default)\n"
+            "        kll      KLL sketch, bounded memory and guaranteed rank\n"
+            "                 error of about 1.3%%\n"
+            "        ddsketch DDSketch, fastest, percentiles within 1%% relative\n"
+            "                 error, well suited to heavy tailed data\n\n"
+            "--hdr DIGITS\n"
+            "      Use an HDR histogram that keeps DIGITS significant digits\n"
+            "      (1 to 5) to compute the percentiles. Meant for non-negative\n"
+            "      integer data such as latencies in microseconds. Fractions\n"
+            "      are rounded to the nearest integer. Negative values and\n"
+            "      values of 9.2e18 or more are not recorded: they are left\n"
+            "      out of every statistic and counted in a warning. Uses\n"
+            "      little memory and is very fast.\n\n"
+            "--delta DELTA\n"
+            "      Compression parameter of the t-digest (default 0.01). Larger\n"
+            "      values give fewer centroids: faster but less accurate.\n\n"
+            "--max-centroids N\n"
+            "      Compress the t-digest whenever it has more than N centroids\n"
+            "      (default 100 / DELTA), at least 40. Adding a value takes time\n"
+            "      proportional to the number of centroids. When DELTA keeps\n"
+            "      too many centroids for N, it is raised to fit.\n\n"
+            "--sketch-mem SIZE\n"
+            "      Memory budget of the t-digest or KLL sketch, such as 64K or\n"
+            "      1M. The parameters not given explicitly are chosen to fit.\n\n"
+            "--mem SIZE\n"
+            "      Memory budget of the exact mode, such as 512M or 4G, shared\n"
+            "      by the files read concurrently. Values that don't fit are\n"
+            "      spilled to temporary files in $TMPDIR (default /tmp) and the\n"
+            "      percentiles are still exact, at the cost of a few sequential\n"
+            "      passes over the spilled data.\n\n"
+            "-j JOBS, --jobs JOBS\n"
+            "      Number of files to read concurrently. Defaults to the number\n"
+            "      of processors.\n\n"
+            "--per-file\n"
+            "      Also print a table with the statistics of each file.\n\n"
+            "--moments\n"
+            "      Also print the skewness and the excess kurtosis, computed in\n"
+            "      the same pass as the mean and variance.\n\n"
+            "--accurate\n"
+            "      Compute the moments by pairwise summation of blocks of values\n"
+            "      instead of updating them value by value. The rounding error\n"
+            "      grows with the log of the number of values instead of\n"
+            "      linearly, which matters for billions of values or data with\n"
+            "      a large offset.\n\n"
+            "--hist BINS\n"
+            "      Also print a histogram of BINS bins of equal width between the\n"
+            "      minimum and the maximum. In streaming mode, the counts are\n"
+            "      estimated by the sketch.\n\n"
+            "--log-bins\n"
+            "      Make the bins of equal width on a log scale, for positive data\n"
+            "      spanning several orders of magnitude.\n\n"
+            "--cdf\n"
+            "      Also print the fraction of the values below the upper edge of\n"
+            "      each bin, with %d bins unless --hist is given.\n\n"
+            "--distinct\n"
+            "      Also print an estimate of the number of distinct values, within\n"
+            "      about 1%%, computed with a HyperLogLog sketch of 16K.\n\n"
+            "--top K\n"
+            "      Also print the K most frequent values with their counts. The\n"
+            "      counts are exact unless there are more than %d or %d * K\n"
+            "      distinct values, in which case each count overestimates the\n"
+            "      frequency by at most its error.\n\n"
+            "--format FORMAT\n"
+            "      Print the statistics as text (default), or in a format meant\n"
+            "      for programs: json, csv or tsv. Numbers are written with as\n"
+            "      many digits as needed to read back the exact same double.\n"
+            "      With csv and tsv, the row of all the data follows the rows of\n"
+            "      --per-file with an empty file name, and the histogram and the\n"
+            "      top values are separate tables after a blank line.\n\n"
+            "--weighted\n"
+            "      Read a value and its weight on each line, separated by blanks\n"
+            "      or a comma, such as 12.5 300. The weight is the number of times\n"
+            "      the value occurs, a non-negative integer, and every statistic\n"
+            "      is that of the values repeated by their weights. Can't be used\n"
+            "      with --mem.\n\n"
+            "--stats\n"
+            "      Print the time spent in each phase and the size of the\n"
+            "      --distinct and --top sketches to standard error. When\n"
+            "      desc is built with COUNTERS=1, also print the bytes read,\n"
+            "      lines parsed, reallocations, selection passes and sketch\n"
+            "      operations.\n\n"
+            "--serve SOCKET\n"
+            "      Run as a daemon that aggregates the values sent to the Unix\n"
+            "      domain socket SOCKET into named summaries, using the engine\n"
+            "      given by --sketch or --hdr with its default parameters\n"
+            "      (t-digest if none). Clients send one VALUE or NAME:VALUE per\n"
+            "      line and query with the commands STATS NAME, PERCENTILE NAME\n"
+            "      Q ..., LIST, RESET NAME and SNAPSHOT NAME PATH. BINARY NAME\n"
+            "      switches the connection to raw doubles. SHUTDOWN, SIGINT or\n"
+            "      SIGTERM stop the server.\n\n"
+            "--window SECONDS\n"
+            "      With --serve, also keep the values of the last SECONDS\n"
+            "      seconds of each summary in a rolling window, queried with\n"
+            "      WINDOW NAME SPAN [Q ...] for the last SPAN seconds, or with\n"
+            "      DECAYED NAME HALFLIFE Q ... where the weight of values halves\n"
+            "      every HALFLIFE seconds (t-digest only).\n\n"
             "Examples\n"
             "--------\n"
             "cat data/large.dat | desc\n"
-            );
+            "desc --per-file logs/*.dat\n"
+            "desc --serve /tmp/desc.sock &\n"
+            "echo latency:12.5 | nc -U /tmp/desc.sock\n",
+            DEFAULT_CDF_BINS, TOPK_MIN_CAPACITY, TOPK_SLACK);
 
     exit(1);
 }
 
 
+size_t parse_size(char *arg)
+{
+    // Parse a size in bytes with an optional K, M or G suffix (powers of
+    // 1024). Returns 0 if arg is not a valid size.
+    char *endptr;
+    double size = strtod(arg, &endptr);
+
+    switch (*endptr) {
+    case 'g': case 'G':
+        size *= 1024;
+        // fall through
+    case 'm': case 'M':
+        size *= 1024;
+        // fall through
+    case 'k': case 'K':
+        size *= 1024;
+        endptr++;
+        break;
+    }
+    if (endptr == arg || *endptr != '\0' || size < 1)
+        return 0;
+    return (size_t)size;
+}
+
+summarizer_mode server_mode(dataset_options *opts)
+{
+    // Summaries of the server are always streaming, exact mode would grow
+    // without bound.
+    if (!opts->streaming)
+        return SUMMARIZER_TDIGEST;
+    switch (opts->sketch) {
+    case SKETCH_KLL:
+        return SUMMARIZER_KLL;
+    case SKETCH_DDSKETCH:
+        return SUMMARIZER_DDSKETCH;
+    case SKETCH_HDR:
+        return SUMMARIZER_HDR;
+    default:
+        return SUMMARIZER_TDIGEST;
+    }
+}
+
+bool field_is_count(enum field f)
+{
+    return f == FIELD_COUNT || f == FIELD_DISTINCT;
+}
+
+double field_value(dataset *ds, enum field f)
+{
+    switch (f) {
+    case FIELD_COUNT:
+        return ds->n;
+    case FIELD_MIN:
+        return min(ds);
+    case FIELD_Q1:
+        return first_quartile(ds);
+    case FIELD_MEDIAN:
+        return median(ds);
+    case FIELD_Q3:
+        return third_quartile(ds);
+    case FIELD_MAX:
+        return max(ds);
+    case FIELD_IQR:
+        return interquartile_range(ds);
+    case FIELD_MEAN:
+        return mean(ds);
+    case FIELD_VAR:
+        return var(ds);
+    case FIELD_SD:
+        return sd(ds);
+    case FIELD_SKEWNESS:
+        return skewness(ds);
+    case FIELD_KURTOSIS:
+        return kurtosis(ds);
+    default:
+        return round(distinct_count(ds));
+    }
+}
+
+int parse_fields(char *arg, enum field *fields)
+{
+    // Parse a comma separated list of field names into fields, which has
+    // room for NFIELDS. Returns the number of fields, 0 if one is unknown or
+    // given twice.
+    char *name, *saveptr = NULL;
+    int n = 0, f, i;
+
+    for (name = strtok_r(arg, ",", &saveptr); name;
+         name = strtok_r(NULL, ",", &saveptr)) {
+        for (f = 0; f < NFIELDS && strcmp(name, field_names[f]) != 0; f++)
+            ;
+        if (f == NFIELDS) {
+            fprintf(stderr, "Unknown field %s.\n\n", name);
+            return 0;
+        }
+        for (i = 0; i < n && fields[i] != (enum field)f; i++)
+            ;
+        if (i < n) {
+            fprintf(stderr, "Field %s is given twice.\n\n", name);
+            return 0;
+        }
+        fields[n++] = f;
+    }
+    return n;
+}
+
+void print_summary(dataset *ds, enum field *fields, int nfields)
+{
+    int i;
+
+    for (i = 0; i < nfields; i++) {
+        if (field_is_count(fields[i]))
+            printf("%-10s%.0f\n", field_names[fields[i]],
+                   field_value(ds, fields[i]));
+        else
+            printf("%-10s%.5g\n", field_names[fields[i]],
+                   field_value(ds, fields[i]));
+    }
+}
+
+int print_histogram(dataset *ds, size_t nbins, bool log_bins, bool hist,
+                    bool cdf)
+{
+    // Print the bins with their counts and a bar, and the cumulative
+    // fraction of the values at their upper edge, or only one of the two.
+    double *edges = NULL, *counts = NULL, top = 0, cum = 0;
+    size_t i, j, width;
+
+    edges = malloc((nbins + 1) * sizeof(double));
+    counts = malloc(nbins * sizeof(double));
+    check_mem(edges && counts);
+    check(histogram(ds, nbins, log_bins, edges, counts),
+          "Could not compute the histogram.");
+    for (i = 0; i < nbins; i++)
+        top = counts[i] > top ? counts[i] : top;
+
+    printf("\n%-11s %11s", "from", "to");
+    if (hist)
+        printf(" %11s", "count");
+    if (cdf)
+        printf(" %11s", "cdf");
+    printf("\n");
+    for (i = 0; i < nbins; i++) {
+        cum += counts[i];
+        printf("%-11.5g %11.5g", edges[i], edges[i + 1]);
+        if (hist)
+            printf(" %11.0f", counts[i]);
+        if (cdf)
+            printf(" %11.5g", cum / ds->n);
+        if (hist) {
+            width = top > 0 ? (size_t)(HIST_BAR_WIDTH * counts[i] / top + 0.5) : 0;
+            if (width > 0)
+                printf(" ");
+            for (j = 0; j < width; j++)
+                putchar('#');
+        }
+        printf("\n");
+    }
+
+    free(edges);
+    free(counts);
+    return 1;
+
+error:
+    free(edges);
+    free(counts);
+    return 0;
+}
+
+int print_top(dataset *ds, size_t k)
+{
+    // Print the k most frequent values with their counts and error bounds.
+    TopKItem *items = NULL;
+    size_t i;
+
+    items = malloc(k * sizeof(TopKItem));
+    check_mem(items);
+    k = top_values(ds, items, k);
+    printf("\n%-11s %11s %11s\n", "value", "count", "error");
+    for (i = 0; i < k; i++)
+        printf("%-11.5g %11zu %11zu\n", items[i].value, items[i].count,
+               items[i].error);
+
+    free(items);
+    return 1;
+
+error:
+    return 0;
+}
+
+void print_file_header(enum field *fields, int nfields)
+{
+    int i;
+
+    printf("%-20s", "file");
+    for (i = 0; i < nfields; i++)
+        printf(fields[i] == FIELD_COUNT ? " %10s" : " %11s",
+               field_names[fields[i]]);
+    printf("\n");
+}
+
+void print_file_row(char *filename, dataset *ds, enum field *fields,
+                    int nfields)
+{
+    int i;
+
+    printf("%-20s", filename);
+    for (i = 0; i < nfields; i++) {
+        if (fields[i] == FIELD_COUNT)
+            printf(" %10zu", ds->n);
+        else if (field_is_count(fields[i]))
+            printf(" %11.0f", field_value(ds, fields[i]));
+        else
+            printf(" %11.5g", field_value(ds, fields[i]));
+    }
+    printf("\n");
+}
+
+static int write_all(int fd, const void *buf, size_t n)
+{
+    // Write n bytes, in one call unless the output is a pipe that takes
+    // them in pieces.
+    const char *p = buf;
+    ssize_t written;
+
+    while (n > 0) {
+        written = write(fd, p, n);
+        if (written < 0 && errno == EINTR)
+            continue;
+        check(written > 0, "Could not write the output.");
+        p += written;
+        n -= written;
+    }
+    return 1;
+
+error:
+    return 0;
+}
+
+static void flush_output(Writer *w, bool force)
+{
+    // Write the buffered output once it holds OUTPUT_BUFFER_SIZE bytes, or
+    // all of it with force. A failed write marks w as failed, like a failed
+    // allocation.
+    if (w->failed || w->len == 0 || (!force && w->len < OUTPUT_BUFFER_SIZE))
+        return;
+    if (!write_all(STDOUT_FILENO, w->buf, w->len))
+        w->failed = true;
+    w->len = 0;
+}
+
+static void put_string(Writer *w, const char *s, enum output_format format)
+{
+    // Write s as a JSON string, a CSV field quoted if needed, or a TSV field
+    // whose tabs and line breaks are replaced by spaces.
+    char hex[8];
+
+    if (format == FORMAT_TSV) {
+        for (; *s; s++)
+            Writer_put(w, *s == '\t' || *s == '\n' || *s == '\r' ? " " : s, 1);
+    } else if (format == FORMAT_CSV) {
+        if (!strpbrk(s, ",\"\r\n")) {
+            Writer_put_text(w, s);
+            return;
+        }
+        Writer_put(w, "\"", 1);
+        for (; *s; s++) {
+            if (*s == '"')
+                Writer_put(w, "\"", 1);
+            Writer_put(w, s, 1);
+        }
+        Writer_put(w, "\"", 1);
+    } else {
+        Writer_put(w, "\"", 1);
+        for (; *s; s++) {
+            if (*s == '"' || *s == '\\') {
+                Writer_put(w, "\\", 1);
+                Writer_put(w, s, 1);
+            } else if ((unsigned char)*s < 0x20) {
+                snprintf(hex, sizeof(hex), "\\u%04x", (unsigned char)*s);
+                Writer_put_text(w, hex);
+            } else {
+                Writer_put(w, s, 1);
+            }
+        }
+        Writer_put(w, "\"", 1);
+    }
+}
+
+static void put_field(Writer *w, const char *name, bool first,
+                      enum output_format format)
+{
+    // Start a field of a row: its key in JSON, its separator otherwise.
+    if (!first)
+        Writer_put(w, format == FORMAT_TSV ? "\t" : ",", 1);
+    if (format == FORMAT_JSON) {
+        Writer_put(w, "\"", 1);
+        Writer_put_text(w, name);
+        Writer_put(w, "\":", 2);
+    }
+}
+
+static void put_value(Writer *w, double x, enum output_format format)
+{
+    // JSON has no NaN or infinity.
+    if (format == FORMAT_JSON && !isfinite(x))
+        Writer_put_text(w, "null");
+    else
+        Writer_put_number(w, x);
+}
+
+static void put_header(Writer *w, const char **names, size_t n,
+                       enum output_format format)
+{
+    // Write the header of a CSV or TSV table.
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        put_field(w, names[i], i == 0, format);
+        put_string(w, names[i], format);
+    }
+    Writer_put(w, "\n", 1);
+}
+
+static void write_summary_header(Writer *w, enum field *fields, int nfields,
+                                 enum output_format format)
+{
+    // Write the header of the CSV or TSV rows of write_summary.
+    const char *names[NFIELDS + 1];
+    int i;
+
+    names[0] = "file";
+    for (i = 0; i < nfields; i++)
+        names[i + 1] = field_names[fields[i]];
+    put_header(w, names, nfields + 1, format);
+}
+
+static void write_summary(Writer *w, char *filename, dataset *ds,
+                          enum field *fields, int nfields,
+                          enum output_format format)
+{
+    // Write the statistics of ds as a JSON object or a CSV or TSV row. JSON
+    // objects only have a file if filename is not NULL.
+    bool first = true;
+    int i;
+
+    if (format == FORMAT_JSON)
+        Writer_put(w, "{", 1);
+    if (filename || format != FORMAT_JSON) {
+        put_field(w, "file", true, format);
+        put_string(w, filename ? filename : "", format);
+        first = false;
+    }
+    for (i = 0; i < nfields; i++) {
+        put_field(w, field_names[fields[i]], first, format);
+        if (fields[i] == FIELD_COUNT)
+            Writer_put_size(w, ds->n);
+        else
+            put_value(w, field_value(ds, fields[i]), format);
+        first = false;
+    }
+    Writer_put_text(w, format == FORMAT_JSON ? "}" : "\n");
+}
+
+static int write_histogram(Writer *w, dataset *ds, size_t nbins,
+                           bool log_bins, bool hist, bool cdf,
+                           enum output_format format)
+{
+    // Write the bins as a JSON array or a CSV or TSV table, with the same
+    // columns as print_histogram.
+    const char *names[] = {"from", "to", hist ? "count" : "cdf", "cdf"};
+    double *edges = NULL, *counts = NULL, cum = 0;
+    size_t i;
+
+    edges = malloc((nbins + 1) * sizeof(double));
+    counts = malloc(nbins * sizeof(double));
+    check_mem(edges && counts);
+    check(histogram(ds, nbins, log_bins, edges, counts),
+          "Could not compute the histogram.");
+
+    if (format == FORMAT_JSON)
+        Writer_put_text(w, ",\n\"histogram\":[");
+    else
+        put_header(w, names, hist && cdf ? 4 : 3, format);
+    for (i = 0; i < nbins; i++) {
+        cum += counts[i];
+        if (format == FORMAT_JSON)
+            Writer_put_text(w, i > 0 ? ",\n{" : "\n{");
+        put_field(w, "from", true, format);
+        put_value(w, edges[i], format);
+        put_field(w, "to", false, format);
+        put_value(w, edges[i + 1], format);
+        if (hist) {
+            put_field(w, "count", false, format);
+            put_value(w, counts[i], format);
+        }
+        if (cdf) {
+            put_field(w, "cdf", false, format);
+            put_value(w, cum / ds->n, format);
+        }
+        Writer_put_text(w, format == FORMAT_JSON ? "}" : "\n");
+        flush_output(w, false);
+    }
+    if (format == FORMAT_JSON)
+        Writer_put(w, "]", 1);
+
+    free(edges);
+    free(counts);
+    return 1;
+
+error:
+    free(edges);
+    free(counts);
+    return 0;
+}
+
+static int write_top(Writer *w, dataset *ds, size_t k,
+                     enum output_format format)
+{
+    // Write the k most frequent values as a JSON array or a CSV or TSV
+    // table.
+    const char *names[] = {"value", "count", "error"};
+    TopKItem *items = NULL;
+    size_t i;
+
+    items = malloc(k * sizeof(TopKItem));
+    check_mem(items);
+    k = top_values(ds, items, k);
+    if (format == FORMAT_JSON)
+        Writer_put_text(w, ",\n\"top\":[");
+    else
+        put_header(w, names, 3, format);
+    for (i = 0; i < k; i++) {
+        if (format == FORMAT_JSON)
+            Writer_put_text(w, i > 0 ? ",\n{" : "\n{");
+        put_field(w, "value", true, format);
+        put_value(w, items[i].value, format);
+        put_field(w, "count", false, format);
+        Writer_put_size(w, items[i].count);
+        put_field(w, "error", false, format);
+        Writer_put_size(w, items[i].error);
+        Writer_put_text(w, format == FORMAT_JSON ? "}" : "\n");
+        flush_output(w, false);
+    }
+    if (format == FORMAT_JSON)
+        Writer_put(w, "]", 1);
+
+    free(items);
+    return 1;
+
+error:
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
-    int ch;
-    bool streaming = false;
+    int ch, i, nfiles;
+    int njobs = 0, nfields = 0;
+    bool per_file = false, stats = false, moments = false;
+    bool log_bins = false, cdf = false, keep_values;
+    enum field fields[NFIELDS];
+    size_t nbins = 0;
+    double t0;
+    dataset_options opts;
+    char *stdin_name = "-";
+    char *socket_path = NULL;
+    double window = 0;
+    dataset *ds, **datasets;
+    enum output_format format = FORMAT_TEXT;
+    Writer out = { NULL, 0, 0, false };
 
-	while ((ch = getopt(argc, argv, "hs")) != -1)
+    enum {
+        OPT_PER_FILE = 256, OPT_SKETCH, OPT_HDR, OPT_DELTA, OPT_MAX_CENTROIDS,
+        OPT_SKETCH_MEM, OPT_STATS, OPT_SERVE, OPT_WINDOW, OPT_MOMENTS,
+        OPT_ACCURATE, OPT_MEM, OPT_HIST, OPT_LOG_BINS, OPT_CDF, OPT_DISTINCT,
+        OPT_TOP, OPT_FORMAT, OPT_WEIGHTED
+    };
+    static struct option longopts[] = {
+        { "accurate",      no_argument,       NULL, OPT_ACCURATE },
+        { "cdf",           no_argument,       NULL, OPT_CDF },
+        { "delta",         required_argument, NULL, OPT_DELTA },
+        { "distinct",      no_argument,       NULL, OPT_DISTINCT },
+        { "fields",        required_argument, NULL, 'f' },
+        { "format",        required_argument, NULL, OPT_FORMAT },
+        { "help",          no_argument,       NULL, 'h' },
+        { "hist",          required_argument, NULL, OPT_HIST },
+        { "hdr",           required_argument, NULL, OPT_HDR },
+        { "jobs",          required_argument, NULL, 'j' },
+        { "log-bins",      no_argument,       NULL, OPT_LOG_BINS },
+        { "max-centroids", required_argument, NULL, OPT_MAX_CENTROIDS },
+        { "mem",           required_argument, NULL, OPT_MEM },
+        { "moments",       no_argument,       NULL, OPT_MOMENTS },
+        { "per-file",      no_argument,       NULL, OPT_PER_FILE },
+        { "serve",         required_argument, NULL, OPT_SERVE },
+        { "sketch",        required_argument, NULL, OPT_SKETCH },
+        { "sketch-mem",    required_argument, NULL, OPT_SKETCH_MEM },
+        { "stats",         no_argument,       NULL, OPT_STATS },
+        { "stream",        no_argument,       NULL, 's' },
+        { "top",           required_argument, NULL, OPT_TOP },
+        { "weighted",      no_argument,       NULL, OPT_WEIGHTED },
+        { "window",        required_argument, NULL, OPT_WINDOW },
+        { NULL,            0,                 NULL, 0 }
+    };
+
+    default_options(&opts);
+
+	while ((ch = getopt_long(argc, argv, "f:hj:s", longopts, NULL)) != -1)
 		switch (ch) {
+        case 'f':
+            nfields = parse_fields(optarg, fields);
+            if (nfields == 0)
+                usage();
+            break;
 		case 'h':
             usage();
 			break;
+        case 'j':
+            njobs = atoi(optarg);
+            if (njobs < 1)
+                usage();
+            break;
         case 's':
-            streaming = true;
+            opts.streaming = true;
+            break;
+        case OPT_SKETCH:
+            opts.streaming = true;
+            if (strcmp(optarg, "tdigest") == 0) {
+                opts.sketch = SKETCH_TDIGEST;
+            } else if (strcmp(optarg, "kll") == 0) {
+                opts.sketch = SKETCH_KLL;
+            } else if (strcmp(optarg, "ddsketch") == 0) {
+                opts.sketch = SKETCH_DDSKETCH;
+            } else {
+                fprintf(stderr, "Unknown sketch %s.\n\n", optarg);
+                usage();
+            }
+            break;
+        case OPT_HDR:
+            opts.streaming = true;
+            opts.sketch = SKETCH_HDR;
+            opts.hdr_digits = atoi(optarg);
+            if (opts.hdr_digits < HDR_MIN_DIGITS || opts.hdr_digits > HDR_MAX_DIGITS) {
+                fprintf(stderr, "DIGITS must be between %d and %d.\n\n",
+                        HDR_MIN_DIGITS, HDR_MAX_DIGITS);
+                usage();
+            }
+            break;
+        case OPT_DELTA:
+            opts.streaming = true;
+            opts.delta = atof(optarg);
+            if (opts.delta <= 0 || opts.delta >= 1) {
+                fprintf(stderr, "DELTA must be between 0 and 1.\n\n");
+                usage();
+            }
+            break;
+        case OPT_MAX_CENTROIDS:
+            opts.streaming = true;
+            opts.max_centroids = strtoul(optarg, NULL, 10);
+            if (opts.max_centroids < TDIGEST_MIN_CENTROIDS) {
+                fprintf(stderr, "N must be at least %d.\n\n",
+                        TDIGEST_MIN_CENTROIDS);
+                usage();
+            }
+            break;
+        case OPT_SKETCH_MEM:
+            opts.streaming = true;
+            opts.sketch_mem = parse_size(optarg);
+            if (opts.sketch_mem == 0) {
+                fprintf(stderr, "Invalid size %s.\n\n", optarg);
+                usage();
+            }
+            break;
+        case OPT_MEM:
+            opts.mem = parse_size(optarg);
+            if (opts.mem == 0) {
+                fprintf(stderr, "Invalid size %s.\n\n", optarg);
+                usage();
+            }
+            break;
+        case OPT_PER_FILE:
+            per_file = true;
+            break;
+        case OPT_MOMENTS:
+            moments = true;
+            break;
+        case OPT_ACCURATE:
+            opts.accurate = true;
+            break;
+        case OPT_HIST:
+            nbins = strtoul(optarg, NULL, 10);
+            if (nbins == 0 || nbins > HIST_MAX_BINS) {
+                fprintf(stderr, "BINS must be between 1 and %d.\n\n",
+                        HIST_MAX_BINS);
+                usage();
+            }
+            break;
+        case OPT_LOG_BINS:
+            log_bins = true;
+            break;
+        case OPT_CDF:
+            cdf = true;
+            break;
+        case OPT_DISTINCT:
+            opts.distinct = true;
+            break;
+        case OPT_TOP:
+            opts.topk = strtoul(optarg, NULL, 10);
+            if (opts.topk == 0 || opts.topk > TOPK_MAX) {
+                fprintf(stderr, "K must be between 1 and %d.\n\n", TOPK_MAX);
+                usage();
+            }
+            break;
+        case OPT_FORMAT:
+            if (strcmp(optarg, "text") == 0) {
+                format = FORMAT_TEXT;
+            } else if (strcmp(optarg, "json") == 0) {
+                format = FORMAT_JSON;
+            } else if (strcmp(optarg, "csv") == 0) {
+                format = FORMAT_CSV;
+            } else if (strcmp(optarg, "tsv") == 0) {
+                format = FORMAT_TSV;
+            } else {
+                fprintf(stderr, "Unknown format %s.\n\n", optarg);
+                usage();
+            }
+            break;
+        case OPT_WEIGHTED:
+            opts.weighted = true;
+            break;
+        case OPT_STATS:
+            stats = true;
+            break;
+        case OPT_SERVE:
+            socket_path = optarg;
+            break;
+        case OPT_WINDOW:
+            window = atof(optarg);
+            if (!(window > 0)) {
+                fprintf(stderr, "SECONDS must be positive.\n\n");
+                usage();
+            }
             break;
 		default:
 			usage();
 		}
+	argc -= optind;
 	argv += optind;
 
-    dataset *ds = read_data_file(argv[0], streaming);
-    if (!ds) {
+    // The compression parameters only apply to the engines that have them.
+    if ((opts.delta > 0 || opts.max_centroids > 0) &&
+        opts.sketch != SKETCH_TDIGEST) {
+        fprintf(stderr, "--delta and --max-centroids need the t-digest.\n\n");
+        usage();
+    }
+    if (opts.sketch_mem > 0 && opts.sketch != SKETCH_TDIGEST &&
+        opts.sketch != SKETCH_KLL) {
+        fprintf(stderr, "--sketch-mem needs the t-digest or the KLL sketch.\n\n");
+        usage();
+    }
+
+    if (socket_path) {
+        if (argc > 0)
+            usage();
+        return Server_run(socket_path, server_mode(&opts), window) ? 0 : 1;
+    }
+
+    if (opts.weighted && opts.mem > 0) {
+        fprintf(stderr, "--weighted can't be used with --mem.\n\n");
+        usage();
+    }
+
+    if (nfields == 0) {
+        for (i = FIELD_COUNT; i <= FIELD_SD; i++)
+            fields[nfields++] = i;
+        if (moments) {
+            fields[nfields++] = FIELD_SKEWNESS;
+            fields[nfields++] = FIELD_KURTOSIS;
+        }
+        if (opts.distinct)
+            fields[nfields++] = FIELD_DISTINCT;
+    }
+    // Without a quantile or a histogram to compute, the values are not
+    // kept at all and only the moments are updated.
+    keep_values = nbins > 0 || cdf;
+    for (i = 0; i < nfields; i++) {
+        keep_values |= fields[i] == FIELD_Q1 || fields[i] == FIELD_MEDIAN ||
+                       fields[i] == FIELD_Q3 || fields[i] == FIELD_IQR;
+        opts.distinct |= fields[i] == FIELD_DISTINCT;
+    }
+    if (!keep_values) {
+        opts.streaming = true;
+        opts.sketch = SKETCH_NONE;
+    }
+
+    nfiles = argc;
+    if (nfiles == 0) {
+        nfiles = 1;
+        argv = &stdin_name;
+    }
+    if (njobs == 0) {
+        njobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    // Each file read concurrently gets its share of the memory budget.
+    if (opts.mem > 0)
+        opts.mem /= njobs < nfiles ? njobs : nfiles;
+
+    datasets = (dataset**)calloc(nfiles, sizeof(dataset*));
+    check_mem(datasets);
+    t0 = Counters_now();
+    if (!read_data_files(argv, nfiles, &opts, njobs, datasets)) {
+        for (i = 0; i < nfiles; i++) {
+            if (datasets[i])
+                delete_dataset(datasets[i]);
+        }
+        free(datasets);
         fprintf(stderr, "\n");
         usage();
         return 1;
     }
+    desc_counters.read_seconds = Counters_now() - t0;
 
-    printf("count     %zu\n", ds->n);
-    printf("min       %.5g\n", min(ds));
-    printf("Q1        %.5g\n", first_quartile(ds));
-    printf("median    %.5g\n", median(ds));
-    printf("Q3        %.5g\n", third_quartile(ds));
-    printf("max       %.5g\n", max(ds));
-    printf("IQR       %.5g\n", interquartile_range(ds));
-    printf("mean      %.5g\n", mean(ds));
-    printf("var       %.5g\n", var(ds));
-    printf("sd        %.5g\n", sd(ds));
+    t0 = Counters_now();
+    if (format != FORMAT_TEXT) {
+        // The output goes to a buffer, written in blocks of about
+        // OUTPUT_BUFFER_SIZE bytes.
+        Writer_reserve(&out, OUTPUT_BUFFER_SIZE + OUTPUT_ROW_SIZE);
+        if (format == FORMAT_JSON)
+            Writer_put_text(&out, per_file ? "{\"files\":[" : "{");
+        else
+            write_summary_header(&out, fields, nfields, format);
+    }
+    if (per_file && format != FORMAT_TEXT) {
+        for (i = 0; i < nfiles; i++) {
+            if (format == FORMAT_JSON)
+                Writer_put_text(&out, i > 0 ? ",\n" : "\n");
+            write_summary(&out, argv[i], datasets[i], fields, nfields, format);
+            flush_output(&out, false);
+        }
+        if (format == FORMAT_JSON)
+            Writer_put_text(&out, "],\n");
+    } else if (per_file) {
+        print_file_header(fields, nfields);
+        for (i = 0; i < nfiles; i++) {
+            print_file_row(argv[i], datasets[i], fields, nfields);
+        }
+        printf("\n");
+    }
+
+    desc_counters.summary_seconds = Counters_now() - t0;
+
+    t0 = Counters_now();
+    ds = datasets[0];
+    for (i = 1; i < nfiles; i++) {
+        check(merge_datasets(ds, datasets[i]), "Could not merge %s.", argv[i]);
+        delete_dataset(datasets[i]);
+        datasets[i] = NULL;
+    }
+    desc_counters.merge_seconds = Counters_now() - t0;
+    if (ds->hll)
+        desc_counters.distinct_bytes = HLL_get_memory(ds->hll);
+    if (ds->topk)
+        desc_counters.topk_bytes = TopK_get_memory(ds->topk);
+
+    t0 = Counters_now();
+    if (format == FORMAT_TEXT) {
+        print_summary(ds, fields, nfields);
+        if (nbins > 0 || cdf) {
+            check(print_histogram(ds, nbins > 0 ? nbins : DEFAULT_CDF_BINS,
+                                  log_bins, nbins > 0, cdf),
+                  "Could not print the histogram.");
+        }
+        if (opts.topk > 0)
+            check(print_top(ds, opts.topk), "Could not print the top values.");
+    } else {
+        if (format == FORMAT_JSON)
+            Writer_put_text(&out, "\"summary\":");
+        write_summary(&out, NULL, ds, fields, nfields, format);
+        if (nbins > 0 || cdf) {
+            if (format != FORMAT_JSON)
+                Writer_put(&out, "\n", 1);
+            check(write_histogram(&out, ds,
+                                  nbins > 0 ? nbins : DEFAULT_CDF_BINS,
+                                  log_bins, nbins > 0, cdf, format),
+                  "Could not write the histogram.");
+        }
+        if (opts.topk > 0) {
+            if (format != FORMAT_JSON)
+                Writer_put(&out, "\n", 1);
+            check(write_top(&out, ds, opts.topk, format),
+                  "Could not write the top values.");
+        }
+        if (format == FORMAT_JSON)
+            Writer_put_text(&out, "}\n");
+        flush_output(&out, true);
+        check(!out.failed, "Could not print the statistics.");
+        free(out.buf);
+    }
+    desc_counters.summary_seconds += Counters_now() - t0;
+    if (stats)
+        Counters_print(stderr);
 
     delete_dataset(ds);
+    free(datasets);
     
     return 0;
+
+error:
+    return 1;
 }
@@ -0,0 +1,355 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "format.h"
+
+typedef struct diy_fp {
+    // The number f * 2^e.
+    uint64_t f;
+    int e;
+} diy_fp;
+
+// Normalized approximations of 10^k for k = -348 + 8 i, enough to bring any
+// double to the range where its digits are generated.
+static const diy_fp cached_powers[] = {
+    {UINT64_C(0xfa8fd5a0081c0288), -1220}, // 1e-348
+    {UINT64_C(0xbaaee17fa23ebf76), -1193}, // 1e-340
+    {UINT64_C(0x8b16fb203055ac76), -1166}, // 1e-332
+    {UINT64_C(0xcf42894a5dce35ea), -1140}, // 1e-324
+    {UINT64_C(0x9a6bb0aa55653b2d), -1113}, // 1e-316
+    {UINT64_C(0xe61acf033d1a45df), -1087}, // 1e-308
+    {UINT64_C(0xab70fe17c79ac6ca), -1060}, // 1e-300
+    {UINT64_C(0xff77b1fcbebcdc4f), -1034}, // 1e-292
+    {UINT64_C(0xbe5691ef416bd60c), -1007}, // 1e-284
+    {UINT64_C(0x8dd01fad907ffc3c),  -980}, // 1e-276
+    {UINT64_C(0xd3515c2831559a83),  -954}, // 1e-268
+    {UINT64_C(0x9d71ac8fada6c9b5),  -927}, // 1e-260
+    {UINT64_C(0xea9c227723ee8bcb),  -901}, // 1e-252
+    {UINT64_C(0xaecc49914078536d),  -874}, // 1e-244
+    {UINT64_C(0x823c12795db6ce57),  -847}, // 1e-236
+    {UINT64_C(0xc21094364dfb5637),  -821}, // 1e-228
+    {UINT64_C(0x9096ea6f3848984f),  -794}, // 1e-220
+    {UINT64_C(0xd77485cb25823ac7),  -768}, // 1e-212
+    {UINT64_C(0xa086cfcd97bf97f4),  -741}, // 1e-204
+    {UINT64_C(0xef340a98172aace5),  -715}, // 1e-196
+    {UINT64_C(0xb23867fb2a35b28e),  -688}, // 1e-188
+    {UINT64_C(0x84c8d4dfd2c63f3b),  -661}, // 1e-180
+    {UINT64_C(0xc5dd44271ad3cdba),  -635}, // 1e-172
+    {UINT64_C(0x936b9fcebb25c996),  -608}, // 1e-164
+    {UINT64_C(0xdbac6c247d62a584),  -582}, // 1e-156
+    {UINT64_C(0xa3ab66580d5fdaf6),  -555}, // 1e-148
+    {UINT64_C(0xf3e2f893dec3f126),  -529}, // 1e-140
+    {UINT64_C(0xb5b5ada8aaff80b8),  -502}, // 1e-132
+    {UINT64_C(0x87625f056c7c4a8b),  -475}, // 1e-124
+    {UINT64_C(0xc9bcff6034c13053),  -449}, // 1e-116
+    {UINT64_C(0x964e858c91ba2655),  -422}, // 1e-108
+    {UINT64_C(0xdff9772470297ebd),  -396}, // 1e-100
+    {UINT64_C(0xa6dfbd9fb8e5b88f),  -369}, // 1e-92
+    {UINT64_C(0xf8a95fcf88747d94),  -343}, // 1e-84
+    {UINT64_C(0xb94470938fa89bcf),  -316}, // 1e-76
+    {UINT64_C(0x8a08f0f8bf0f156b),  -289}, // 1e-68
+    {UINT64_C(0xcdb02555653131b6),  -263}, // 1e-60
+    {UINT64_C(0x993fe2c6d07b7fac),  -236}, // 1e-52
+    {UINT64_C(0xe45c10c42a2b3b06),  -210}, // 1e-44
+    {UINT64_C(0xaa242499697392d3),  -183}, // 1e-36
+    {UINT64_C(0xfd87b5f28300ca0e),  -157}, // 1e-28
+    {UINT64_C(0xbce5086492111aeb),  -130}, // 1e-20
+    {UINT64_C(0x8cbccc096f5088cc),  -103}, // 1e-12
+    {UINT64_C(0xd1b71758e219652c),   -77}, // 1e-4
+    {UINT64_C(0x9c40000000000000),   -50}, // 1e4
+    {UINT64_C(0xe8d4a51000000000),   -24}, // 1e12
+    {UINT64_C(0xad78ebc5ac620000),     3}, // 1e20
+    {UINT64_C(0x813f3978f8940984),    30}, // 1e28
+    {UINT64_C(0xc097ce7bc90715b3),    56}, // 1e36
+    {UINT64_C(0x8f7e32ce7bea5c70),    83}, // 1e44
+    {UINT64_C(0xd5d238a4abe98068),   109}, // 1e52
+    {UINT64_C(0x9f4f2726179a2245),   136}, // 1e60
+    {UINT64_C(0xed63a231d4c4fb27),   162}, // 1e68
+    {UINT64_C(0xb0de65388cc8ada8),   189}, // 1e76
+    {UINT64_C(0x83c7088e1aab65db),   216}, // 1e84
+    {UINT64_C(0xc45d1df942711d9a),   242}, // 1e92
+    {UINT64_C(0x924d692ca61be758),   269}, // 1e100
+    {UINT64_C(0xda01ee641a708dea),   295}, // 1e108
+    {UINT64_C(0xa26da3999aef774a),   322}, // 1e116
+    {UINT64_C(0xf209787bb47d6b85),   348}, // 1e124
+    {UINT64_C(0xb454e4a179dd1877),   375}, // 1e132
+    {UINT64_C(0x865b86925b9bc5c2),   402}, // 1e140
+    {UINT64_C(0xc83553c5c8965d3d),   428}, // 1e148
+    {UINT64_C(0x952ab45cfa97a0b3),   455}, // 1e156
+    {UINT64_C(0xde469fbd99a05fe3),   481}, // 1e164
+    {UINT64_C(0xa59bc234db398c25),   508}, // 1e172
+    {UINT64_C(0xf6c69a72a3989f5c),   534}, // 1e180
+    {UINT64_C(0xb7dcbf5354e9bece),   561}, // 1e188
+    {UINT64_C(0x88fcf317f22241e2),   588}, // 1e196
+    {UINT64_C(0xcc20ce9bd35c78a5),   614}, // 1e204
+    {UINT64_C(0x98165af37b2153df),   641}, // 1e212
+    {UINT64_C(0xe2a0b5dc971f303a),   667}, // 1e220
+    {UINT64_C(0xa8d9d1535ce3b396),   694}, // 1e228
+    {UINT64_C(0xfb9b7cd9a4a7443c),   720}, // 1e236
+    {UINT64_C(0xbb764c4ca7a44410),   747}, // 1e244
+    {UINT64_C(0x8bab8eefb6409c1a),   774}, // 1e252
+    {UINT64_C(0xd01fef10a657842c),   800}, // 1e260
+    {UINT64_C(0x9b10a4e5e9913129),   827}, // 1e268
+    {UINT64_C(0xe7109bfba19c0c9d),   853}, // 1e276
+    {UINT64_C(0xac2820d9623bf429),   880}, // 1e284
+    {UINT64_C(0x80444b5e7aa7cf85),   907}, // 1e292
+    {UINT64_C(0xbf21e44003acdd2d),   933}, // 1e300
+    {UINT64_C(0x8e679c2f5e44ff8f),   960}, // 1e308
+    {UINT64_C(0xd433179d9c8cb841),   986}, // 1e316
+    {UINT64_C(0x9e19db92b4e31ba9),  1013}, // 1e324
+    {UINT64_C(0xeb96bf6ebadf77d9),  1039}, // 1e332
+    {UINT64_C(0xaf87023b9bf0ee6b),  1066}, // 1e340
+};
+
+static const uint64_t pow10[] = {
+    UINT64_C(1), UINT64_C(10), UINT64_C(100), UINT64_C(1000),
+    UINT64_C(10000), UINT64_C(100000), UINT64_C(1000000),
+    UINT64_C(10000000), UINT64_C(100000000), UINT64_C(1000000000),
+    UINT64_C(10000000000), UINT64_C(100000000000),
+    UINT64_C(1000000000000), UINT64_C(10000000000000),
+    UINT64_C(100000000000000), UINT64_C(1000000000000000),
+    UINT64_C(10000000000000000), UINT64_C(100000000000000000),
+    UINT64_C(1000000000000000000), UINT64_C(10000000000000000000)
+};
+
+static diy_fp diy_normalize(diy_fp x)
+{
+    // Shift f until its most significant bit is set. f must not be 0.
+    while (!(x.f >> 63)) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static diy_fp diy_multiply(diy_fp a, diy_fp b)
+{
+    // The 64 most significant bits of the product, rounded.
+    uint64_t m32 = UINT64_C(0xffffffff);
+    uint64_t ah = a.f >> 32, al = a.f & m32, bh = b.f >> 32, bl = b.f & m32;
+    uint64_t hh = ah * bh, hl = ah * bl, lh = al * bh, ll = al * bl;
+    uint64_t mid = (ll >> 32) + (hl & m32) + (lh & m32) + (UINT64_C(1) << 31);
+
+    return (diy_fp){hh + (hl >> 32) + (lh >> 32) + (mid >> 32),
+                    a.e + b.e + 64};
+}
+
+static bool round_weed(char *digits, int len, uint64_t high_w,
+                       uint64_t unsafe, uint64_t rest, uint64_t ten_kappa,
+                       uint64_t unit)
+{
+    // Decrease the last digit while the number gets closer to w, high_w away
+    // from the upper end of the unsafe interval, then check that the result
+    // is certainly the closest and within the boundaries. The products of
+    // grisu3 are off by up to unit, so both have to hold for w - unit and
+    // w + unit. Returns false when they might not.
+    uint64_t small = high_w - unit, big = high_w + unit;
+
+    while (rest < small && unsafe - rest >= ten_kappa &&
+           (rest + ten_kappa < small ||
+            small - rest >= rest + ten_kappa - small)) {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+    if (rest < big && unsafe - rest >= ten_kappa &&
+        (rest + ten_kappa < big || big - rest > rest + ten_kappa - big))
+        return false;
+    return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+static int digit_gen(diy_fp low, diy_fp w, diy_fp high, char *digits, int *K)
+{
+    // Generate the digits of the upper end of the unsafe interval, the
+    // boundaries widened by the error of the products, until the number is
+    // within the interval. The integral part, above bit shift, fits in 32
+    // bits. Returns the number of digits, or 0 if the result might not be
+    // the shortest or might not read back.
+    int shift = -w.e, kappa = 0, len = 0;
+    uint64_t unit = 1, one = UINT64_C(1) << shift;
+    uint64_t too_high = high.f + unit, unsafe = too_high - (low.f - unit);
+    uint64_t p2 = too_high & (one - 1), rest, d;
+    uint32_t p1 = (uint32_t)(too_high >> shift);
+
+    while (kappa < 10 && p1 >= pow10[kappa])
+        kappa++;
+    while (kappa > 0) {
+        d = p1 / pow10[kappa - 1];
+        p1 %= pow10[kappa - 1];
+        digits[len++] = (char)('0' + d);
+        kappa--;
+        rest = ((uint64_t)p1 << shift) + p2;
+        if (rest < unsafe) {
+            *K += kappa;
+            return round_weed(digits, len, too_high - w.f, unsafe, rest,
+                              pow10[kappa] << shift, unit) ? len : 0;
+        }
+    }
+    while (true) {
+        p2 *= 10;
+        unit *= 10;
+        unsafe *= 10;
+        d = p2 >> shift;
+        digits[len++] = (char)('0' + d);
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < unsafe) {
+            *K += kappa;
+            return round_weed(digits, len, (too_high - w.f) * unit, unsafe,
+                              p2, one, unit) ? len : 0;
+        }
+    }
+}
+
+static int grisu3(double x, char *digits, int *K)
+{
+    // Write the digits of x, positive and finite, and set K so that x reads
+    // back from digits * 10^K. Returns the number of digits, or 0 for the
+    // about 0.5% of doubles whose shortest digits it can't be sure of.
+    uint64_t bits, frac;
+    int biased, k, i;
+    double dk;
+    diy_fp w, plus, minus, c;
+
+    memcpy(&bits, &x, sizeof(bits));
+    biased = (int)((bits >> 52) & 0x7ff);
+    frac = bits & ((UINT64_C(1) << 52) - 1);
+    if (biased) {
+        w.f = frac | (UINT64_C(1) << 52);
+        w.e = biased - 1075;
+    } else {
+        w.f = frac;
+        w.e = -1074;
+    }
+
+    // Every number strictly between the midpoints to the neighbours of x
+    // reads back as x. The lower neighbour is closer at powers of two.
+    plus = diy_normalize((diy_fp){(w.f << 1) + 1, w.e - 1});
+    if (frac == 0 && biased > 1)
+        minus = (diy_fp){(w.f << 2) - 1, w.e - 2};
+    else
+        minus = (diy_fp){(w.f << 1) - 1, w.e - 1};
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    // Scale by the cached power 10^-K that brings the binary exponent of
+    // the upper boundary between -60 and -32.
+    dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    k = (int)dk;
+    if (dk - k > 0)
+        k++;
+    i = (k >> 3) + 1;
+    *K = 348 - i * 8;
+    c = cached_powers[i];
+
+    w = diy_multiply(diy_normalize(w), c);
+    plus = diy_multiply(plus, c);
+    minus = diy_multiply(minus, c);
+    return digit_gen(minus, w, plus, digits, K);
+}
+
+static int shortest_printf(double x, char *digits, int *K)
+{
+    // Slow path for the doubles grisu3 gives up on: the fewest significant
+    // digits of %e that read back as x. printf rounds correctly, so of the
+    // strings with that many digits it gives the closest to x.
+    char tmp[FORMAT_DOUBLE_MAX], *s;
+    int precision, len = 0;
+
+    for (precision = 0; precision < 17; precision++) {
+        snprintf(tmp, sizeof(tmp), "%.*e", precision, x);
+        if (strtod(tmp, NULL) == x)
+            break;
+    }
+    for (s = tmp; *s != 'e'; s++) {
+        if (*s >= '0' && *s <= '9')
+            digits[len++] = *s;
+    }
+    *K = atoi(s + 1) - len + 1;
+    return len;
+}
+
+size_t format_double(double x, char *buf)
+{
+    // Write the shortest representation of x that reads back as x, and a
+    // NUL, to buf, which has room for FORMAT_DOUBLE_MAX bytes. Returns the
+    // length of the string.
+    char digits[20], *p = buf;
+    int len, K, X, i;
+
+    if (isnan(x)) {
+        memcpy(buf, "nan", 4);
+        return 3;
+    }
+    if (signbit(x)) {
+        *p++ = '-';
+        x = -x;
+    }
+    if (isinf(x)) {
+        memcpy(p, "inf", 4);
+        return p + 3 - buf;
+    }
+    if (x == 0) {
+        memcpy(p, "0", 2);
+        return p + 1 - buf;
+    }
+
+    len = grisu3(x, digits, &K);
+    if (len == 0)
+        len = shortest_printf(x, digits, &K);
+    X = len + K - 1;
+    if (X >= -4 && X < 17) {
+        if (K >= 0) {
+            memcpy(p, digits, len);
+            p += len;
+            for (i = 0; i < K; i++)
+                *p++ = '0';
+        } else if (X >= 0) {
+            memcpy(p, digits, X + 1);
+            p += X + 1;
+            *p++ = '.';
+            memcpy(p, digits + X + 1, len - X - 1);
+            p += len - X - 1;
+        } else {
+            *p++ = '0';
+            *p++ = '.';
+            for (i = 0; i < -X - 1; i++)
+                *p++ = '0';
+            memcpy(p, digits, len);
+            p += len;
+        }
+    } else {
+        *p++ = digits[0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        *p++ = 'e';
+        *p++ = X < 0 ? '-' : '+';
+        X = X < 0 ? -X : X;
+        if (X >= 100)
+            *p++ = (char)('0' + X / 100);
+        *p++ = (char)('0' + X / 10 % 10);
+        *p++ = (char)('0' + X % 10);
+    }
+    *p = '\0';
+    return p - buf;
+}
+
+size_t format_size(size_t n, char *buf)
+{
+    // Write n in decimal and a NUL to buf. Returns the length of the string.
+    char tmp[FORMAT_DOUBLE_MAX];
+    size_t len = 0, i;
+
+    do {
+        tmp[len++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    for (i = 0; i < len; i++)
+        buf[i] = tmp[len - 1 - i];
+    buf[len] = '\0';
+    return len;
+}
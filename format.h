@@ -0,0 +1,51 @@
+/*
+ * Text formatting of numbers for the machine readable output of desc.
+ *
+ * format_double writes the shortest decimal string that reads back as the
+ * same double, using the Grisu3 algorithm of Florian Loitsch, Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers, PLDI 2010. The
+ * digits are generated with 64-bit integer arithmetic and a table of cached
+ * powers of ten, without printf or any allocation. For the about 0.5% of
+ * doubles where Grisu3 can't prove that its digits are the shortest and
+ * closest, the digits come from printf at the smallest precision that reads
+ * back. Numbers are written like %g, in fixed notation for decimal
+ * exponents from -4 to 16 and in exponent notation otherwise.
+ *
+ * The Writer_put_ helpers below append text to a Writer, formatting numbers
+ * directly into its buffer.
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stddef.h>
+#include <string.h>
+#include "serialize.h"
+
+// Longest output of format_double, such as -2.2250738585072014e-308, and of
+// format_size, with room for the terminating NUL.
+#define FORMAT_DOUBLE_MAX 32
+
+size_t format_double(double x, char *buf);
+size_t format_size(size_t n, char *buf);
+
+static inline void Writer_put_text(Writer *w, const char *s)
+{
+    Writer_put(w, s, strlen(s));
+}
+
+static inline void Writer_put_number(Writer *w, double x)
+{
+    Writer_reserve(w, FORMAT_DOUBLE_MAX);
+    if (!w->failed)
+        w->len += format_double(x, (char*)w->buf + w->len);
+}
+
+static inline void Writer_put_size(Writer *w, size_t n)
+{
+    Writer_reserve(w, FORMAT_DOUBLE_MAX);
+    if (!w->failed)
+        w->len += format_size(n, (char*)w->buf + w->len);
+}
+
+#endif
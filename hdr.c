@@ -0,0 +1,303 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbg.h"
+#include "hdr.h"
+
+struct HdrHistogram {
+    uint64_t *counts;
+    size_t counts_len;
+    int significant_digits;
+    int sub_bucket_half_count_magnitude;
+    int64_t sub_bucket_half_count;
+    int64_t sub_bucket_mask;
+    size_t count;
+    int64_t min;
+    int64_t max;
+};
+
+static inline int count_leading_zeros(uint64_t x)
+{
+    // x must not be 0.
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while (!(x & (1ULL << 63))) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline int HdrHistogram_bucket_index(HdrHistogram *h, int64_t value)
+{
+    int pow2ceiling = 64 - count_leading_zeros((uint64_t)(value | h->sub_bucket_mask));
+    return pow2ceiling - (h->sub_bucket_half_count_magnitude + 1);
+}
+
+static inline size_t HdrHistogram_index(HdrHistogram *h, int64_t value)
+{
+    // Position of value in the array of counts. Bucket 0 holds the values
+    // below the number of sub-buckets exactly. Every following bucket covers
+    // twice the range of the previous one with half as many new sub-buckets,
+    // since its lower half overlaps the previous bucket.
+    int bucket_index = HdrHistogram_bucket_index(h, value);
+    int64_t sub_bucket_index = value >> bucket_index;
+    return ((size_t)(bucket_index + 1) << h->sub_bucket_half_count_magnitude) +
+           (sub_bucket_index - h->sub_bucket_half_count);
+}
+
+static int64_t HdrHistogram_value(HdrHistogram *h, size_t index, int64_t *size)
+{
+    // Lowest value counted at index. The number of values counted at the same
+    // index is stored in size.
+    int bucket_index = (int)(index >> h->sub_bucket_half_count_magnitude) - 1;
+    int64_t sub_bucket_index = (index & (h->sub_bucket_half_count - 1)) +
+                               h->sub_bucket_half_count;
+
+    if (bucket_index < 0) {
+        sub_bucket_index -= h->sub_bucket_half_count;
+        bucket_index = 0;
+    }
+    *size = (int64_t)1 << bucket_index;
+    return sub_bucket_index << bucket_index;
+}
+
+static int HdrHistogram_grow(HdrHistogram *h, size_t index)
+{
+    // Grow the array of counts so that it contains index.
+    size_t len = h->counts_len * 2;
+    uint64_t *counts;
+
+    if (len <= index)
+        len = index + 1;
+    counts = realloc(h->counts, len * sizeof(uint64_t));
+    check_mem(counts);
+    memset(counts + h->counts_len, 0, (len - h->counts_len) * sizeof(uint64_t));
+    h->counts = counts;
+    h->counts_len = len;
+    return 1;
+
+error:
+    return 0;
+}
+
+HdrHistogram *HdrHistogram_create(int significant_digits)
+{
+    // Create a histogram that keeps significant_digits decimal digits of
+    // precision, between HDR_MIN_DIGITS and HDR_MAX_DIGITS.
+    HdrHistogram *h = NULL;
+    int64_t largest_single_unit = 2, sub_bucket_count = 1;
+    int i, magnitude = 0;
+
+    check(significant_digits >= HDR_MIN_DIGITS &&
+          significant_digits <= HDR_MAX_DIGITS,
+          "HDR histogram precision must be between %d and %d digits.",
+          HDR_MIN_DIGITS, HDR_MAX_DIGITS);
+    h = calloc(1, sizeof(HdrHistogram));
+    check_mem(h);
+
+    // Use enough sub-buckets to tell apart values that differ by one unit in
+    // the last significant digit.
+    for (i = 0; i < significant_digits; i++)
+        largest_single_unit *= 10;
+    while (sub_bucket_count < largest_single_unit) {
+        sub_bucket_count <<= 1;
+        magnitude++;
+    }
+    h->significant_digits = significant_digits;
+    h->sub_bucket_half_count_magnitude = magnitude - 1;
+    h->sub_bucket_half_count = sub_bucket_count / 2;
+    h->sub_bucket_mask = sub_bucket_count - 1;
+
+    h->counts_len = sub_bucket_count;
+    h->counts = calloc(h->counts_len, sizeof(uint64_t));
+    check_mem(h->counts);
+    return h;
+
+error:
+    if (h) free(h);
+    return NULL;
+}
+
+void HdrHistogram_destroy(HdrHistogram *h)
+{
+    if (!h)
+        return;
+    free(h->counts);
+    free(h);
+}
+
+int HdrHistogram_add(HdrHistogram *h, int64_t value, size_t w)
+{
+    // Record value w times. Only non-negative values can be recorded.
+    size_t index;
+
+    check_debug(value >= 0, "Can't record negative value in HDR histogram.");
+    index = HdrHistogram_index(h, value);
+    if (index >= h->counts_len)
+        check(HdrHistogram_grow(h, index), "Could not grow HDR histogram.");
+    h->counts[index] += w;
+
+    if (h->count == 0 || value < h->min)
+        h->min = value;
+    if (h->count == 0 || value > h->max)
+        h->max = value;
+    h->count += w;
+    return 1;
+
+error:
+    return 0;
+}
+
+int HdrHistogram_merge(HdrHistogram *h, HdrHistogram *other)
+{
+    // Add the counts of other to h. Both histograms must have the same
+    // precision.
+    size_t i;
+
+    check(h->significant_digits == other->significant_digits,
+          "Can't merge HDR histograms with different precisions.");
+    if (other->count == 0)
+        return 1;
+    if (other->counts_len > h->counts_len)
+        check(HdrHistogram_grow(h, other->counts_len - 1),
+              "Could not grow HDR histogram.");
+    for (i = 0; i < other->counts_len; i++)
+        h->counts[i] += other->counts[i];
+
+    if (h->count == 0 || other->min < h->min)
+        h->min = other->min;
+    if (h->count == 0 || other->max > h->max)
+        h->max = other->max;
+    h->count += other->count;
+    return 1;
+
+error:
+    return 0;
+}
+
+double HdrHistogram_percentile(HdrHistogram *h, double q)
+{
+    // Return the qth quantile, q between 0 and 1. The value returned is the
+    // middle of the range of values counted together with the quantile.
+    double rank, x;
+    uint64_t seen = 0;
+    int64_t lowest, size;
+    size_t i;
+
+    check_debug(h->count > 0, "Can't compute percentile of empty histogram.");
+    rank = q * (h->count - 1);
+
+    x = h->max;
+    for (i = 0; i < h->counts_len; i++) {
+        seen += h->counts[i];
+        if (seen > rank) {
+            lowest = HdrHistogram_value(h, i, &size);
+            x = lowest + (size - 1) / 2.0;
+            break;
+        }
+    }
+    if (x < h->min)
+        x = h->min;
+    if (x > h->max)
+        x = h->max;
+    return x;
+
+error:
+#ifdef NAN
+    return NAN;
+#else
+    return 0;
+#endif
+}
+
+double HdrHistogram_cdf(HdrHistogram *h, double x)
+{
+    // Fraction of the values at or below x. The values counted at an index
+    // are taken to be spread evenly over its range.
+    double seen = 0;
+    int64_t lowest, size, top;
+    size_t i;
+
+    check_debug(h->count > 0, "Can't compute CDF of empty histogram.");
+    if (x < h->min)
+        return 0;
+    if (x >= h->max)
+        return 1;
+
+    top = (int64_t)floor(x);
+    for (i = 0; i < h->counts_len; i++) {
+        lowest = HdrHistogram_value(h, i, &size);
+        if (lowest > top)
+            break;
+        if (lowest + size - 1 <= top)
+            seen += h->counts[i];
+        else
+            seen += (double)h->counts[i] * (top - lowest + 1) / size;
+    }
+    return seen / h->count;
+
+error:
+#ifdef NAN
+    return NAN;
+#else
+    return 0;
+#endif
+}
+
+size_t HdrHistogram_get_count(HdrHistogram *h)
+{
+    return h->count;
+}
+
+size_t HdrHistogram_get_memory(HdrHistogram *h)
+{
+    return sizeof(HdrHistogram) + h->counts_len * sizeof(uint64_t);
+}
+
+void HdrHistogram_serialize(HdrHistogram *h, Writer *w)
+{
+    // Write the precision, the count and extrema, and the array of counts up
+    // to the last non-zero one.
+    size_t len = h->counts_len;
+
+    while (len > 0 && h->counts[len - 1] == 0)
+        len--;
+    Writer_put_u64(w, h->significant_digits);
+    Writer_put_u64(w, h->count);
+    Writer_put_u64(w, (uint64_t)h->min);
+    Writer_put_u64(w, (uint64_t)h->max);
+    Writer_put_u64(w, len);
+    Writer_put(w, h->counts, len * sizeof(uint64_t));
+}
+
+HdrHistogram *HdrHistogram_deserialize(Reader *r)
+{
+    // Read a histogram written by HdrHistogram_serialize. Returns NULL if the
+    // data is truncated or invalid.
+    HdrHistogram *h = NULL;
+    uint64_t digits = Reader_get_u64(r);
+    uint64_t count = Reader_get_u64(r);
+    int64_t min = (int64_t)Reader_get_u64(r);
+    int64_t max = (int64_t)Reader_get_u64(r);
+    uint64_t len = Reader_get_u64(r);
+
+    check(Reader_has(r, len, sizeof(uint64_t)) && digits <= HDR_MAX_DIGITS,
+          "Invalid HDR histogram.");
+    h = HdrHistogram_create((int)digits);
+    check(h, "Invalid HDR histogram.");
+    if (len > h->counts_len)
+        check(HdrHistogram_grow(h, len - 1), "Could not grow HDR histogram.");
+    Reader_get(r, h->counts, len * sizeof(uint64_t));
+    h->count = count;
+    h->min = min;
+    h->max = max;
+    return h;
+
+error:
+    HdrHistogram_destroy(h);
+    return NULL;
+}
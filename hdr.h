@@ -0,0 +1,36 @@
+/*
+ * This is an implementation of Gil Tene's HDR histogram,
+ * http://hdrhistogram.org, for non-negative integer values.
+ *
+ * Values are counted in log-linear buckets: each power of two range is split
+ * into enough linear sub-buckets to keep the given number of significant
+ * decimal digits. Recording a value takes a couple of shifts and an increment
+ * in a flat array of counts, and two histograms with the same precision merge
+ * exactly. The array of counts grows with the largest value recorded, up to
+ * about 8 KB per power of two of range for 3 significant digits.
+ */
+
+#ifndef HDR_H
+#define HDR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "serialize.h"
+
+#define HDR_MIN_DIGITS 1
+#define HDR_MAX_DIGITS 5
+
+typedef struct HdrHistogram HdrHistogram;
+
+HdrHistogram *HdrHistogram_create(int significant_digits);
+void HdrHistogram_destroy(HdrHistogram *h);
+int HdrHistogram_add(HdrHistogram *h, int64_t value, size_t w);
+int HdrHistogram_merge(HdrHistogram *h, HdrHistogram *other);
+double HdrHistogram_percentile(HdrHistogram *h, double q);
+double HdrHistogram_cdf(HdrHistogram *h, double x);
+size_t HdrHistogram_get_count(HdrHistogram *h);
+size_t HdrHistogram_get_memory(HdrHistogram *h);
+void HdrHistogram_serialize(HdrHistogram *h, Writer *w);
+HdrHistogram *HdrHistogram_deserialize(Reader *r);
+
+#endif
@@ -0,0 +1,108 @@
+#include <math.h>
+#include <stdlib.h>
+#include "dbg.h"
+#include "hll.h"
+
+struct HLL {
+    int precision;
+    size_t nregisters;
+    uint8_t *registers;
+};
+
+static inline int HLL_leading_zeros(uint64_t x)
+{
+    // x must not be 0.
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while (!(x & (1ULL << 63))) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+HLL *HLL_create(int precision)
+{
+    // Create a sketch of 2^precision registers, precision between
+    // HLL_MIN_PRECISION and HLL_MAX_PRECISION.
+    HLL *hll = NULL;
+
+    check(precision >= HLL_MIN_PRECISION && precision <= HLL_MAX_PRECISION,
+          "HyperLogLog precision must be between %d and %d.",
+          HLL_MIN_PRECISION, HLL_MAX_PRECISION);
+    hll = calloc(1, sizeof(HLL));
+    check_mem(hll);
+    hll->precision = precision;
+    hll->nregisters = (size_t)1 << precision;
+    hll->registers = calloc(hll->nregisters, 1);
+    check_mem(hll->registers);
+    return hll;
+
+error:
+    HLL_destroy(hll);
+    return NULL;
+}
+
+void HLL_destroy(HLL *hll)
+{
+    if (!hll)
+        return;
+    free(hll->registers);
+    free(hll);
+}
+
+void HLL_add(HLL *hll, uint64_t hash)
+{
+    // Record a value given by its hash, see hash_double. The bits after the
+    // register index are padded with a 1 so that the rank is at most
+    // 65 - precision.
+    size_t i = hash >> (64 - hll->precision);
+    uint64_t rest = (hash << hll->precision) |
+                    ((uint64_t)1 << (hll->precision - 1));
+    uint8_t rank = (uint8_t)(HLL_leading_zeros(rest) + 1);
+
+    if (rank > hll->registers[i])
+        hll->registers[i] = rank;
+}
+
+int HLL_merge(HLL *hll, HLL *other)
+{
+    // Add the values of other to hll. Both must have the same precision.
+    size_t i;
+
+    check(hll->precision == other->precision,
+          "Can't merge HyperLogLogs with different precisions.");
+    for (i = 0; i < hll->nregisters; i++) {
+        if (other->registers[i] > hll->registers[i])
+            hll->registers[i] = other->registers[i];
+    }
+    return 1;
+
+error:
+    return 0;
+}
+
+double HLL_count(HLL *hll)
+{
+    // Estimated number of distinct values.
+    double m = hll->nregisters, sum = 0, estimate;
+    size_t i, zeros = 0;
+
+    for (i = 0; i < hll->nregisters; i++) {
+        sum += ldexp(1.0, -hll->registers[i]);
+        zeros += hll->registers[i] == 0;
+    }
+    estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0)
+        estimate = m * log(m / zeros);
+    return estimate;
+}
+
+size_t HLL_get_memory(HLL *hll)
+{
+    // Number of bytes used by the sketch and its registers.
+    return sizeof(HLL) + hll->nregisters;
+}
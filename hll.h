@@ -0,0 +1,55 @@
+/*
+ * This is an implementation of HyperLogLog by Philippe Flajolet, Eric Fusy,
+ * Olivier Gandouet and Frederic Meunier, HyperLogLog: the analysis of a
+ * near-optimal cardinality estimation algorithm,
+ * https://algo.inria.fr/flajolet/Publications/FlFuGaMe07.pdf, which estimates
+ * the number of distinct values of a stream.
+ *
+ * The first p bits of the 64-bit hash of a value choose one of 2^p registers,
+ * which keeps the largest number of leading zeros seen in the other bits. The
+ * standard error of the estimate is 1.04 / sqrt(2^p), 0.8% with the default
+ * precision, in 2^p bytes. Small cardinalities are estimated by linear
+ * counting of the empty registers, and the 64-bit hash needs no correction
+ * for large ones. Sketches of the same precision merge exactly by taking the
+ * maximum of each register.
+ */
+
+#ifndef HLL_H
+#define HLL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HLL_DEFAULT_PRECISION 14
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+
+typedef struct HLL HLL;
+
+static inline uint64_t hash_double(double x)
+{
+    // Hash of the bits of x, the finalizer of MurmurHash3, which mixes every
+    // bit of the input into every bit of the output. -0 hashes like 0, since
+    // they are the same value.
+    uint64_t h;
+
+    if (x == 0)
+        x = 0;
+    memcpy(&h, &x, sizeof(h));
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+HLL *HLL_create(int precision);
+void HLL_destroy(HLL *hll);
+void HLL_add(HLL *hll, uint64_t hash);
+int HLL_merge(HLL *hll, HLL *other);
+double HLL_count(HLL *hll);
+size_t HLL_get_memory(HLL *hll);
+
+#endif
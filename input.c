@@ -0,0 +1,418 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "counters.h"
+#include "dbg.h"
+#include "input.h"
+
+#define BLOCK_SIZE (1 << 17)
+#define NBLOCKS 4
+
+enum codec {
+    CODEC_NONE,
+    CODEC_GZIP,
+    CODEC_ZSTD
+};
+
+struct Input {
+    FILE *fp;
+    bool close_fp;
+    enum codec codec;
+
+    // Raw bytes read from the file. For uncompressed input, this is also the
+    // block being parsed.
+    unsigned char *raw;
+    size_t raw_len;
+
+    // Ring of decompressed blocks. The decompression thread fills them in
+    // order and Input_gets consumes them in the same order. A block is only
+    // handed back to the decompression thread once it has been fully parsed.
+    char *blocks[NBLOCKS];
+    size_t lengths[NBLOCKS];
+    size_t produced;
+    size_t consumed;
+    bool done;
+    bool stop;
+    bool failed;
+    pthread_t thread;
+    bool has_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t emptied;
+
+    // Block currently being parsed.
+    char *cur;
+    size_t pos;
+    size_t len;
+    bool eof;
+};
+
+static char *Input_acquire_block(Input *in)
+{
+    // Wait until a block is free and return it to the decompression thread.
+    char *block = NULL;
+
+    pthread_mutex_lock(&(in->lock));
+    while (in->produced - in->consumed == NBLOCKS && !in->stop)
+        pthread_cond_wait(&(in->emptied), &(in->lock));
+    if (!in->stop)
+        block = in->blocks[in->produced % NBLOCKS];
+    pthread_mutex_unlock(&(in->lock));
+    return block;
+}
+
+static void Input_publish_block(Input *in, size_t len)
+{
+    COUNTER_ADD(bytes_decompressed, len);
+    pthread_mutex_lock(&(in->lock));
+    in->lengths[in->produced % NBLOCKS] = len;
+    in->produced++;
+    pthread_cond_signal(&(in->filled));
+    pthread_mutex_unlock(&(in->lock));
+}
+
+static void Input_finish(Input *in, bool failed)
+{
+    pthread_mutex_lock(&(in->lock));
+    in->done = true;
+    in->failed = failed;
+    pthread_cond_signal(&(in->filled));
+    pthread_mutex_unlock(&(in->lock));
+}
+
+static bool Input_refill_raw(Input *in)
+{
+    // Read the next chunk of compressed data. Returns false at end of file.
+    in->raw_len = fread(in->raw, 1, BLOCK_SIZE, in->fp);
+    COUNTER_ADD(bytes_read, in->raw_len);
+    return in->raw_len > 0;
+}
+
+static bool Input_inflate(Input *in)
+{
+    // Decompress a gzip stream. Concatenated gzip members, as produced by
+    // pigz or by cat'ing several .gz files, are decompressed one after the
+    // other.
+    z_stream zs;
+    bool in_member = false;
+    bool input_eof = false;
+    int ret;
+    char *out;
+
+    memset(&zs, 0, sizeof(zs));
+    zs.next_in = in->raw;
+    zs.avail_in = in->raw_len;
+    // 15 + 32: maximum window size and automatic gzip/zlib header detection.
+    check(inflateInit2(&zs, 15 + 32) == Z_OK, "Could not initialize zlib.");
+
+    while (!input_eof || zs.avail_in > 0) {
+        out = Input_acquire_block(in);
+        if (!out)
+            break;
+        zs.next_out = (unsigned char*)out;
+        zs.avail_out = BLOCK_SIZE;
+
+        while (zs.avail_out > 0) {
+            if (zs.avail_in == 0) {
+                if (!Input_refill_raw(in)) {
+                    input_eof = true;
+                    break;
+                }
+                zs.next_in = in->raw;
+                zs.avail_in = in->raw_len;
+            }
+            in_member = true;
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                in_member = false;
+                check(inflateReset(&zs) == Z_OK, "Could not reset zlib.");
+            } else {
+                check(ret == Z_OK || ret == Z_BUF_ERROR,
+                      "Corrupt gzip input: %s", zs.msg ? zs.msg : "unknown error");
+            }
+        }
+        Input_publish_block(in, BLOCK_SIZE - zs.avail_out);
+    }
+
+    check(!ferror(in->fp), "Failed to read compressed input.");
+    if (in_member)
+        log_warn("Compressed input is truncated.");
+    inflateEnd(&zs);
+    return true;
+
+error:
+    inflateEnd(&zs);
+    return false;
+}
+
+#ifdef HAVE_ZSTD
+static bool Input_zstd_decompress(Input *in)
+{
+    // Decompress a zstd stream, including streams made of several frames.
+    ZSTD_DStream *zds = ZSTD_createDStream();
+    ZSTD_inBuffer zin = { in->raw, in->raw_len, 0 };
+    ZSTD_outBuffer zout;
+    bool input_eof = false;
+    size_t ret = 0;
+    char *out;
+
+    check_mem(zds);
+    ZSTD_initDStream(zds);
+
+    while (!input_eof || zin.pos < zin.size) {
+        out = Input_acquire_block(in);
+        if (!out)
+            break;
+        zout.dst = out;
+        zout.size = BLOCK_SIZE;
+        zout.pos = 0;
+
+        while (zout.pos < zout.size) {
+            if (zin.pos == zin.size) {
+                if (!Input_refill_raw(in)) {
+                    input_eof = true;
+                    break;
+                }
+                zin.size = in->raw_len;
+                zin.pos = 0;
+            }
+            ret = ZSTD_decompressStream(zds, &zout, &zin);
+            check(!ZSTD_isError(ret), "Corrupt zstd input: %s",
+                  ZSTD_getErrorName(ret));
+        }
+        Input_publish_block(in, zout.pos);
+    }
+
+    check(!ferror(in->fp), "Failed to read compressed input.");
+    if (ret != 0)
+        log_warn("Compressed input is truncated.");
+    ZSTD_freeDStream(zds);
+    return true;
+
+error:
+    if (zds) ZSTD_freeDStream(zds);
+    return false;
+}
+#endif
+
+static void *Input_decompress(void *arg)
+{
+    Input *in = (Input*)arg;
+    bool ok = false;
+
+    if (in->codec == CODEC_GZIP) {
+        ok = Input_inflate(in);
+#ifdef HAVE_ZSTD
+    } else if (in->codec == CODEC_ZSTD) {
+        ok = Input_zstd_decompress(in);
+#endif
+    }
+    Input_finish(in, !ok);
+    return NULL;
+}
+
+static enum codec Input_detect_codec(unsigned char *buf, size_t len)
+{
+    if (len >= 2 && buf[0] == 0x1f && buf[1] == 0x8b)
+        return CODEC_GZIP;
+    if (len >= 4 && buf[0] == 0x28 && buf[1] == 0xb5 && buf[2] == 0x2f &&
+            buf[3] == 0xfd)
+        return CODEC_ZSTD;
+    return CODEC_NONE;
+}
+
+Input *Input_open(char *filename)
+{
+    // Open filename, or standard input if filename is NULL. The first block
+    // of the file is read immediately to find out whether it is compressed.
+    Input *in = NULL;
+    int i;
+
+    in = calloc(1, sizeof(Input));
+    check_mem(in);
+    pthread_mutex_init(&(in->lock), NULL);
+    pthread_cond_init(&(in->filled), NULL);
+    pthread_cond_init(&(in->emptied), NULL);
+
+    if (filename == NULL) {
+        in->fp = stdin;
+    } else {
+        in->fp = fopen(filename, "rb");
+        check(in->fp, "Failed to open %s.", filename);
+        in->close_fp = true;
+    }
+
+    in->raw = malloc(BLOCK_SIZE);
+    check_mem(in->raw);
+    Input_refill_raw(in);
+    check(!ferror(in->fp), "Failed to read %s.", filename ? filename : "stdin");
+
+    in->codec = Input_detect_codec(in->raw, in->raw_len);
+    if (in->codec == CODEC_NONE) {
+        in->cur = (char*)in->raw;
+        in->len = in->raw_len;
+        return in;
+    }
+#ifndef HAVE_ZSTD
+    check(in->codec != CODEC_ZSTD,
+          "zstd input is not supported, rebuild desc with ZSTD=1.");
+#endif
+
+    for (i = 0; i < NBLOCKS; i++) {
+        in->blocks[i] = malloc(BLOCK_SIZE);
+        check_mem(in->blocks[i]);
+    }
+    check(pthread_create(&(in->thread), NULL, Input_decompress, in) == 0,
+          "Could not start decompression thread.");
+    in->has_thread = true;
+
+    return in;
+
+error:
+    Input_close(in);
+    return NULL;
+}
+
+static bool Input_next_block(Input *in)
+{
+    // Move on to the next block of data. Returns false when there is no more
+    // data.
+    if (in->codec == CODEC_NONE) {
+        if (!Input_refill_raw(in))
+            return false;
+        in->cur = (char*)in->raw;
+        in->len = in->raw_len;
+        in->pos = 0;
+        return true;
+    }
+
+    pthread_mutex_lock(&(in->lock));
+    if (in->cur) {
+        // Hand the block we just finished parsing back to the decompression
+        // thread.
+        in->consumed++;
+        in->cur = NULL;
+        pthread_cond_signal(&(in->emptied));
+    }
+    while (in->produced == in->consumed && !in->done)
+        pthread_cond_wait(&(in->filled), &(in->lock));
+    if (in->produced > in->consumed) {
+        in->cur = in->blocks[in->consumed % NBLOCKS];
+        in->len = in->lengths[in->consumed % NBLOCKS];
+        in->pos = 0;
+    }
+    pthread_mutex_unlock(&(in->lock));
+
+    return in->cur != NULL;
+}
+
+char *Input_gets(char *buffer, int size, Input *in)
+{
+    // Read a line, with the same semantics as fgets: at most size - 1
+    // characters are read, reading stops after a newline, which is kept, and
+    // the result is null terminated. Returns NULL at end of input.
+    size_t i = 0, n, room;
+    char *start, *newline;
+
+    if (size <= 0)
+        return NULL;
+    room = size - 1;
+
+    while (i < room) {
+        if (in->pos >= in->len) {
+            if (in->eof || !Input_next_block(in)) {
+                in->eof = true;
+                break;
+            }
+            continue;
+        }
+        start = in->cur + in->pos;
+        n = in->len - in->pos;
+        if (n > room - i)
+            n = room - i;
+        newline = memchr(start, '\n', n);
+        if (newline)
+            n = newline - start + 1;
+        memcpy(buffer + i, start, n);
+        i += n;
+        in->pos += n;
+        if (newline)
+            break;
+    }
+
+    if (i == 0)
+        return NULL;
+    buffer[i] = '\0';
+    return buffer;
+}
+
+size_t Input_estimate_lines(Input *in)
+{
+    // Estimate the number of lines of a regular uncompressed file from its
+    // size and the average length of the lines in the first block. Returns 0
+    // when no estimate is possible. Must be called before Input_gets.
+    struct stat st;
+    size_t i, nlines = 0;
+
+    if (in->codec != CODEC_NONE || in->pos != 0 || in->raw_len == 0)
+        return 0;
+    if (fstat(fileno(in->fp), &st) != 0 || !S_ISREG(st.st_mode))
+        return 0;
+
+    for (i = 0; i < in->raw_len; i++) {
+        if (in->raw[i] == '\n')
+            nlines++;
+    }
+    if ((off_t)in->raw_len >= st.st_size) {
+        // The whole file is in the first block, the count is exact.
+        if (in->raw[in->raw_len - 1] != '\n')
+            nlines++;
+        return nlines;
+    }
+    if (nlines == 0)
+        return 0;
+    return (size_t)((double)st.st_size * nlines / in->raw_len);
+}
+
+int Input_error(Input *in)
+{
+    // Return 1 if reading or decompressing the input failed.
+    if (in->codec == CODEC_NONE)
+        return ferror(in->fp) != 0;
+    pthread_mutex_lock(&(in->lock));
+    int failed = in->failed;
+    pthread_mutex_unlock(&(in->lock));
+    return failed;
+}
+
+void Input_close(Input *in)
+{
+    int i;
+
+    if (!in)
+        return;
+    if (in->has_thread) {
+        // Stop the decompression thread in case we did not read all the
+        // data.
+        pthread_mutex_lock(&(in->lock));
+        in->stop = true;
+        pthread_cond_signal(&(in->emptied));
+        pthread_mutex_unlock(&(in->lock));
+        pthread_join(in->thread, NULL);
+    }
+    pthread_mutex_destroy(&(in->lock));
+    pthread_cond_destroy(&(in->filled));
+    pthread_cond_destroy(&(in->emptied));
+    for (i = 0; i < NBLOCKS; i++)
+        free(in->blocks[i]);
+    free(in->raw);
+    if (in->close_fp && in->fp)
+        fclose(in->fp);
+    free(in);
+}
@@ -0,0 +1,24 @@
+/*
+ * Buffered line reader for data files.
+ *
+ * Input is read in large blocks instead of line by line. Compressed input
+ * (gzip and, when built with ZSTD=1, zstd) is detected from the magic bytes at
+ * the start of the stream and decompressed in process. Decompression runs on
+ * its own thread so that it overlaps with parsing.
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct Input Input;
+
+Input *Input_open(char *filename);
+char *Input_gets(char *buffer, int size, Input *in);
+size_t Input_estimate_lines(Input *in);
+int Input_error(Input *in);
+void Input_close(Input *in);
+
+#endif
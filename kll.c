@@ -0,0 +1,418 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbg.h"
+#include "kll.h"
+
+#define KLL_MIN_CAPACITY 8
+#define KLL_MAX_LEVELS 64
+
+typedef struct KLLLevel {
+    double *items;
+    size_t size;
+    size_t allocated;
+} KLLLevel;
+
+typedef struct KLLItem {
+    double value;
+    size_t weight;
+} KLLItem;
+
+struct KLL {
+    KLLLevel levels[KLL_MAX_LEVELS];
+    unsigned int nlevels;
+    unsigned int k;
+    size_t count;
+    size_t nretained;
+    size_t capacity;
+    uint64_t rng;
+
+    // Sorted view of the retained items with their cumulative weights, used
+    // to answer queries. It is rebuilt lazily after the sketch changes.
+    KLLItem *sorted;
+    size_t nsorted;
+    bool sorted_valid;
+};
+
+static uint64_t KLL_random(KLL *kll)
+{
+    // xorshift64*, good enough to choose the compaction offsets.
+    kll->rng ^= kll->rng >> 12;
+    kll->rng ^= kll->rng << 25;
+    kll->rng ^= kll->rng >> 27;
+    return kll->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static int doublecmp(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int itemcmp(const void *a, const void *b)
+{
+    return doublecmp(&((const KLLItem*)a)->value, &((const KLLItem*)b)->value);
+}
+
+static size_t KLL_level_capacity(KLL *kll, unsigned int h)
+{
+    // Capacity of level h, which is k for the top level and shrinks by a
+    // factor of 2/3 for each level below it.
+    double capacity = kll->k;
+    unsigned int depth = kll->nlevels - h - 1;
+
+    while (depth-- > 0 && capacity > KLL_MIN_CAPACITY)
+        capacity *= 2.0 / 3.0;
+    capacity = ceil(capacity);
+    return capacity < KLL_MIN_CAPACITY ? KLL_MIN_CAPACITY : (size_t)capacity;
+}
+
+static void KLL_update_capacity(KLL *kll)
+{
+    // Recompute the total capacity of the sketch. It only changes when a level
+    // is added.
+    unsigned int h;
+
+    kll->capacity = 0;
+    for (h = 0; h < kll->nlevels; h++)
+        kll->capacity += KLL_level_capacity(kll, h);
+}
+
+static int KLL_push_level(KLL *kll, unsigned int h, double x)
+{
+    KLLLevel *level = &(kll->levels[h]);
+
+    if (level->size == level->allocated) {
+        size_t allocated = level->allocated ? level->allocated * 2 : 8;
+        double *items = realloc(level->items, allocated * sizeof(double));
+        check_mem(items);
+        level->items = items;
+        level->allocated = allocated;
+    }
+    level->items[level->size++] = x;
+    kll->nretained++;
+    if (h >= kll->nlevels) {
+        kll->nlevels = h + 1;
+        KLL_update_capacity(kll);
+    }
+    return 1;
+
+error:
+    return 0;
+}
+
+static int KLL_compact_level(KLL *kll, unsigned int h)
+{
+    // Sort level h and promote every other item to level h + 1. When the level
+    // has an odd number of items, the largest one stays behind.
+    KLLLevel *level = &(kll->levels[h]);
+    size_t i, npairs = level->size / 2;
+    size_t offset = KLL_random(kll) & 1;
+    double leftover;
+
+    check(h + 1 < KLL_MAX_LEVELS, "KLL sketch has too many levels.");
+    qsort(level->items, level->size, sizeof(double), doublecmp);
+    leftover = level->items[level->size - 1];
+
+    for (i = 0; i < npairs; i++) {
+        check(KLL_push_level(kll, h + 1, level->items[2 * i + offset]),
+              "Could not compact KLL level.");
+    }
+    kll->nretained -= 2 * npairs;
+    if (level->size % 2 == 1) {
+        level->items[0] = leftover;
+        level->size = 1;
+    } else {
+        level->size = 0;
+    }
+    return 1;
+
+error:
+    return 0;
+}
+
+static int KLL_compress(KLL *kll)
+{
+    // Compact levels, lowest first, until the sketch fits in its capacity.
+    // Whenever the total capacity is exceeded, at least one level is over its
+    // own capacity.
+    unsigned int h;
+    bool compacted;
+
+    while (kll->nretained >= kll->capacity) {
+        compacted = false;
+        for (h = 0; h < kll->nlevels; h++) {
+            if (kll->levels[h].size >= KLL_level_capacity(kll, h)) {
+                check(KLL_compact_level(kll, h), "Could not compress KLL.");
+                compacted = true;
+                break;
+            }
+        }
+        if (!compacted)
+            break;
+    }
+    return 1;
+
+error:
+    return 0;
+}
+
+KLL *KLL_create(unsigned int k)
+{
+    KLL *kll = calloc(1, sizeof(KLL));
+    check_mem(kll);
+
+    kll->k = k < KLL_MIN_CAPACITY ? KLL_MIN_CAPACITY : k;
+    kll->nlevels = 1;
+    KLL_update_capacity(kll);
+    // Seed the generator from the address of the sketch so that sketches
+    // built concurrently make independent choices.
+    kll->rng = 0x9E3779B97F4A7C15ULL ^ (uint64_t)(uintptr_t)kll;
+    if (kll->rng == 0)
+        kll->rng = 1;
+    return kll;
+
+error:
+    return NULL;
+}
+
+void KLL_destroy(KLL *kll)
+{
+    unsigned int h;
+
+    if (!kll)
+        return;
+    for (h = 0; h < KLL_MAX_LEVELS; h++)
+        free(kll->levels[h].items);
+    free(kll->sorted);
+    free(kll);
+}
+
+int KLL_add(KLL *kll, double x, size_t w)
+{
+    // Add x with weight w. The weight is decomposed in powers of two and x is
+    // added once to each level matching a bit set in w, so weighted items cost
+    // O(log w) instead of O(w).
+    unsigned int h;
+
+    kll->sorted_valid = false;
+    kll->count += w;
+    for (h = 0; w > 0; h++, w >>= 1) {
+        if (w & 1) {
+            check(h < KLL_MAX_LEVELS, "Weight too large for KLL sketch.");
+            check(KLL_push_level(kll, h, x), "Could not add to KLL sketch.");
+        }
+    }
+    if (kll->nretained >= kll->capacity)
+        return KLL_compress(kll);
+    return 1;
+
+error:
+    return 0;
+}
+
+int KLL_merge(KLL *kll, KLL *other)
+{
+    // Add all the retained items of other to kll, level by level, and compress
+    // the result.
+    unsigned int h;
+    size_t i;
+
+    kll->sorted_valid = false;
+    for (h = 0; h < other->nlevels; h++) {
+        for (i = 0; i < other->levels[h].size; i++) {
+            check(KLL_push_level(kll, h, other->levels[h].items[i]),
+                  "Could not merge KLL sketches.");
+        }
+    }
+    kll->count += other->count;
+    return KLL_compress(kll);
+
+error:
+    return 0;
+}
+
+static int KLL_sort(KLL *kll)
+{
+    // Build the sorted view of the retained items with cumulative weights.
+    unsigned int h;
+    size_t i, j = 0;
+    KLLItem *sorted;
+
+    if (kll->sorted_valid)
+        return 1;
+    sorted = realloc(kll->sorted, (kll->nretained + 1) * sizeof(KLLItem));
+    check_mem(sorted);
+    kll->sorted = sorted;
+
+    for (h = 0; h < kll->nlevels; h++) {
+        for (i = 0; i < kll->levels[h].size; i++) {
+            sorted[j].value = kll->levels[h].items[i];
+            sorted[j].weight = (size_t)1 << h;
+            j++;
+        }
+    }
+    qsort(sorted, j, sizeof(KLLItem), itemcmp);
+    for (i = 1; i < j; i++)
+        sorted[i].weight += sorted[i - 1].weight;
+    kll->nsorted = j;
+    kll->sorted_valid = true;
+    return 1;
+
+error:
+    return 0;
+}
+
+double KLL_percentile(KLL *kll, double q)
+{
+    // Return the retained item whose estimated rank is q * count, where q is
+    // between 0 and 1.
+    size_t lo, hi, mid;
+    double rank;
+
+    check_debug(kll->count > 0, "Can't compute percentile of empty sketch.");
+    check(KLL_sort(kll), "Could not sort KLL sketch.");
+
+    rank = q * kll->count;
+    lo = 0;
+    hi = kll->nsorted - 1;
+    // Find the first item whose cumulative weight exceeds rank.
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (kll->sorted[mid].weight > rank)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return kll->sorted[lo].value;
+
+error:
+#ifdef NAN
+    return NAN;
+#else
+    return 0;
+#endif
+}
+
+double KLL_cdf(KLL *kll, double x)
+{
+    // Estimated fraction of the items at or below x: the cumulative weight
+    // of the last retained item not above x.
+    size_t lo = 0, hi, mid;
+
+    check_debug(kll->count > 0, "Can't compute CDF of empty sketch.");
+    check(KLL_sort(kll), "Could not sort KLL sketch.");
+
+    hi = kll->nsorted;
+    // Find the first item above x.
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (kll->sorted[mid].value > x)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (lo == 0)
+        return 0;
+    return (double)kll->sorted[lo - 1].weight /
+           kll->sorted[kll->nsorted - 1].weight;
+
+error:
+#ifdef NAN
+    return NAN;
+#else
+    return 0;
+#endif
+}
+
+double KLL_epsilon(unsigned int k)
+{
+    // Normalized rank error guaranteed with 99% confidence for a single
+    // quantile query, as fitted empirically in Apache DataSketches.
+    return 2.296 / pow(k, 0.9723);
+}
+
+unsigned int KLL_k_for_memory(size_t bytes)
+{
+    // Largest k for which the sketch stays within bytes of memory. The
+    // compactors hold up to about 3k items, each level array may be twice as
+    // large as its content, and the sorted view used by queries holds
+    // another copy of the items with their weights.
+    size_t per_k = 3 * (2 * sizeof(double) + sizeof(KLLItem));
+    size_t k = bytes > sizeof(KLL) ? (bytes - sizeof(KLL)) / per_k : 0;
+
+    return k < KLL_MIN_CAPACITY ? KLL_MIN_CAPACITY : (unsigned int)k;
+}
+
+size_t KLL_get_count(KLL *kll)
+{
+    return kll->count;
+}
+
+size_t KLL_get_nretained(KLL *kll)
+{
+    return kll->nretained;
+}
+
+size_t KLL_get_memory(KLL *kll)
+{
+    // Number of bytes currently allocated by the sketch.
+    size_t bytes = sizeof(KLL);
+    unsigned int h;
+
+    for (h = 0; h < KLL_MAX_LEVELS; h++)
+        bytes += kll->levels[h].allocated * sizeof(double);
+    if (kll->sorted)
+        bytes += (kll->nretained + 1) * sizeof(KLLItem);
+    return bytes;
+}
+
+void KLL_serialize(KLL *kll, Writer *w)
+{
+    // Write k and the count, followed by the items retained at each level.
+    unsigned int h;
+
+    Writer_put_u64(w, kll->k);
+    Writer_put_u64(w, kll->count);
+    Writer_put_u64(w, kll->nlevels);
+    for (h = 0; h < kll->nlevels; h++) {
+        Writer_put_u64(w, kll->levels[h].size);
+        Writer_put(w, kll->levels[h].items, kll->levels[h].size * sizeof(double));
+    }
+}
+
+KLL *KLL_deserialize(Reader *r)
+{
+    // Read a sketch written by KLL_serialize. Returns NULL if the data is
+    // truncated or invalid.
+    KLL *kll = NULL;
+    uint64_t k = Reader_get_u64(r);
+    uint64_t count = Reader_get_u64(r);
+    uint64_t nlevels = Reader_get_u64(r);
+    uint64_t i, size;
+    unsigned int h;
+
+    check(!r->failed && k > 0 && k <= UINT32_MAX && nlevels > 0 &&
+          nlevels <= KLL_MAX_LEVELS, "Invalid KLL sketch.");
+    kll = KLL_create((unsigned int)k);
+    check_mem(kll);
+    for (h = 0; h < nlevels; h++) {
+        size = Reader_get_u64(r);
+        check(Reader_has(r, size, sizeof(double)), "Truncated KLL sketch.");
+        for (i = 0; i < size; i++) {
+            check(KLL_push_level(kll, h, Reader_get_double(r)),
+                  "Could not read KLL sketch.");
+        }
+    }
+    if (kll->nlevels < nlevels) {
+        kll->nlevels = nlevels;
+        KLL_update_capacity(kll);
+    }
+    kll->count = count;
+    return kll;
+
+error:
+    KLL_destroy(kll);
+    return NULL;
+}
@@ -0,0 +1,41 @@
+/*
+ * This is an implementation of the KLL quantile sketch by Zohar Karnin, Kevin
+ * Lang and Edo Liberty, Optimal Quantile Approximation in Streams,
+ * https://arxiv.org/abs/1603.05346.
+ *
+ * The sketch is a stack of compactors. Level h holds items of weight 2^h.
+ * When a level is full, it is sorted and every other item, starting at a
+ * random offset, is promoted to the next level. The capacity of the levels
+ * decreases geometrically by a factor of 2/3 from the top down, so the memory
+ * used is O(k) regardless of the number of items. The normalized rank error is
+ * about 1.7 / k (2.3 / k^0.97 with 99% confidence), independently of the
+ * distribution of the data. The lazy compaction scheme follows the one used in
+ * Apache DataSketches.
+ */
+
+#ifndef KLL_H
+#define KLL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "serialize.h"
+
+#define KLL_DEFAULT_K 200
+
+typedef struct KLL KLL;
+
+KLL *KLL_create(unsigned int k);
+void KLL_destroy(KLL *kll);
+int KLL_add(KLL *kll, double x, size_t w);
+int KLL_merge(KLL *kll, KLL *other);
+double KLL_percentile(KLL *kll, double q);
+double KLL_cdf(KLL *kll, double x);
+double KLL_epsilon(unsigned int k);
+unsigned int KLL_k_for_memory(size_t bytes);
+size_t KLL_get_count(KLL *kll);
+size_t KLL_get_nretained(KLL *kll);
+size_t KLL_get_memory(KLL *kll);
+void KLL_serialize(KLL *kll, Writer *w);
+KLL *KLL_deserialize(Reader *r);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Helpers to serialize the summaries to a flat byte buffer.
+ *
+ * Values are written in the byte order of the host with fixed widths: sizes
+ * and counts as uint64_t, indices as int32_t and values as double. Summarizer
+ * writes a header that lets readers reject buffers written by hosts with a
+ * different byte order. Errors are sticky: once a write or read fails, the
+ * following ones do nothing and the failed flag stays set, so that callers
+ * only need to check it at the end.
+ */
+
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Writer {
+    unsigned char *buf;
+    size_t len;
+    size_t allocated;
+    bool failed;
+} Writer;
+
+typedef struct Reader {
+    const unsigned char *buf;
+    size_t len;
+    size_t pos;
+    bool failed;
+} Reader;
+
+static inline void Writer_reserve(Writer *w, size_t n)
+{
+    // Make room for n more bytes, so that writes up to that size don't
+    // reallocate the buffer.
+    unsigned char *buf;
+    size_t allocated;
+
+    if (w->failed || w->len + n <= w->allocated)
+        return;
+    allocated = w->allocated ? w->allocated : 256;
+    while (allocated < w->len + n)
+        allocated *= 2;
+    buf = realloc(w->buf, allocated);
+    if (!buf) {
+        w->failed = true;
+        return;
+    }
+    w->buf = buf;
+    w->allocated = allocated;
+}
+
+static inline void Writer_put(Writer *w, const void *p, size_t n)
+{
+    // Empty arrays may come with a NULL pointer, which memcpy doesn't accept.
+    if (n == 0)
+        return;
+    Writer_reserve(w, n);
+    if (w->failed)
+        return;
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+static inline void Writer_put_u64(Writer *w, uint64_t x)
+{
+    Writer_put(w, &x, sizeof(x));
+}
+
+static inline void Writer_put_i32(Writer *w, int32_t x)
+{
+    Writer_put(w, &x, sizeof(x));
+}
+
+static inline void Writer_put_double(Writer *w, double x)
+{
+    Writer_put(w, &x, sizeof(x));
+}
+
+static inline void Reader_get(Reader *r, void *p, size_t n)
+{
+    if (n == 0)
+        return;
+    if (r->failed || r->len - r->pos < n) {
+        r->failed = true;
+        memset(p, 0, n);
+        return;
+    }
+    memcpy(p, r->buf + r->pos, n);
+    r->pos += n;
+}
+
+static inline uint64_t Reader_get_u64(Reader *r)
+{
+    uint64_t x;
+    Reader_get(r, &x, sizeof(x));
+    return x;
+}
+
+static inline int32_t Reader_get_i32(Reader *r)
+{
+    int32_t x;
+    Reader_get(r, &x, sizeof(x));
+    return x;
+}
+
+static inline double Reader_get_double(Reader *r)
+{
+    double x;
+    Reader_get(r, &x, sizeof(x));
+    return x;
+}
+
+static inline bool Reader_has(Reader *r, uint64_t n, size_t size)
+{
+    // Check that n items of size bytes remain before allocating room for
+    // them, so that a corrupt count can't trigger a huge allocation.
+    if (!r->failed && (r->len - r->pos) / size < n)
+        r->failed = true;
+    return !r->failed;
+}
+
+#endif
@@ -0,0 +1,810 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "counters.h"
+#include "dbg.h"
+#include "server.h"
+#include "window.h"
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Size of the input buffer of a client, which bounds the length of a line.
+#define SERVER_BUFFER_SIZE 8192
+// A client that lets this much of its replies pile up unread is disconnected.
+#define SERVER_MAX_OUTPUT (1 << 20)
+#define SERVER_MAX_EVENTS 64
+#define SERVER_MAX_ARGS 32
+#define SERVER_DEFAULT_NAME "default"
+// Number of buckets of the rolling windows. A query over the whole window is
+// off by at most 1 / SERVER_WINDOW_BUCKETS of its length.
+#define SERVER_WINDOW_BUCKETS 60
+
+typedef struct Summary {
+    char name[SERVER_MAX_NAME + 1];
+    Summarizer *s;
+    // Recent values, if the server keeps rolling windows.
+    Window *window;
+    size_t rejected;
+    struct Summary *next;
+} Summary;
+
+typedef struct Client {
+    int fd;
+    char in[SERVER_BUFFER_SIZE];
+    size_t nin;
+    char *out;
+    size_t nout;
+    size_t outsize;
+    // Whether the server waits for the socket to be writable.
+    bool writing;
+    // Summary fed by the client once it has switched to binary input.
+    Summary *binary;
+    bool closing;
+    struct Client *prev;
+    struct Client *next;
+} Client;
+
+typedef struct Server {
+    int listen_fd;
+    int epoll_fd;
+    // Descriptor kept open to be given up when the process runs out of them,
+    // so that a pending connection can still be accepted and closed.
+    int spare_fd;
+    summarizer_mode mode;
+    Summary *summaries;
+    Client *clients;
+    bool stop;
+    // Rolling windows, used when window is not 0: the options of their
+    // buckets, the length of a bucket and when to rotate them next.
+    double window;
+    dataset_options window_opts;
+    double interval;
+    double next_rotation;
+    // Time of the last wake-up of the event loop.
+    double now;
+} Server;
+
+static volatile sig_atomic_t server_interrupted = 0;
+
+static void Server_on_signal(int sig)
+{
+    (void)sig;
+    server_interrupted = 1;
+}
+
+static Summary *Server_find(Server *srv, const char *name, bool create)
+{
+    // Summary called name, created if it doesn't exist and create is set.
+    // Returns NULL if it doesn't exist or the name is invalid.
+    Summary *summary;
+
+    for (summary = srv->summaries; summary != NULL; summary = summary->next) {
+        if (strcmp(summary->name, name) == 0)
+            return summary;
+    }
+    if (!create || name[0] == '\0' || strlen(name) > SERVER_MAX_NAME)
+        return NULL;
+
+    summary = calloc(1, sizeof(Summary));
+    check_mem(summary);
+    summary->s = Summarizer_create(srv->mode);
+    check(summary->s, "Could not create summary %s.", name);
+    if (srv->window > 0) {
+        summary->window = Window_create(&(srv->window_opts), srv->interval,
+                                        SERVER_WINDOW_BUCKETS + 1, srv->now);
+        check(summary->window, "Could not create window of %s.", name);
+    }
+    memcpy(summary->name, name, strlen(name) + 1);
+    summary->next = srv->summaries;
+    srv->summaries = summary;
+    return summary;
+
+error:
+    if (summary) {
+        Summarizer_destroy(summary->s);
+        free(summary);
+    }
+    return NULL;
+}
+
+static int Server_reset(Server *srv, Summary *summary)
+{
+    // Forget the values of the summary. It is kept, since clients sending
+    // binary input may still refer to it.
+    Summarizer *s = Summarizer_create(srv->mode);
+
+    check(s, "Could not reset summary %s.", summary->name);
+    if (summary->window && !Window_reset(summary->window, srv->now)) {
+        Summarizer_destroy(s);
+        sentinel("Could not reset window of %s.", summary->name);
+    }
+    Summarizer_destroy(summary->s);
+    summary->s = s;
+    summary->rejected = 0;
+    return 1;
+
+error:
+    return 0;
+}
+
+static void Client_reply(Client *client, const char *fmt, ...)
+{
+    // Append a line to the output buffer of the client.
+    va_list args;
+    char line[256];
+    int len;
+    char *out;
+
+    if (client->closing)
+        return;
+    va_start(args, fmt);
+    len = vsnprintf(line, sizeof(line) - 1, fmt, args);
+    va_end(args);
+    if (len < 0)
+        return;
+    if ((size_t)len > sizeof(line) - 2)
+        len = sizeof(line) - 2;
+    line[len++] = '\n';
+
+    if (client->nout + len > client->outsize) {
+        if (client->nout + len > SERVER_MAX_OUTPUT) {
+            log_warn("Client doesn't read its replies, disconnecting.");
+            client->closing = true;
+            client->nout = 0;
+            return;
+        }
+        client->outsize = client->outsize ? client->outsize * 2 : 4096;
+        out = realloc(client->out, client->outsize);
+        if (!out) {
+            log_err("Out of memory.");
+            client->closing = true;
+            client->nout = 0;
+            return;
+        }
+        client->out = out;
+    }
+    memcpy(client->out + client->nout, line, len);
+    client->nout += len;
+}
+
+static void Client_destroy(Server *srv, Client *client)
+{
+    if (client->prev)
+        client->prev->next = client->next;
+    else
+        srv->clients = client->next;
+    if (client->next)
+        client->next->prev = client->prev;
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    free(client->out);
+    free(client);
+}
+
+static int Client_flush(Server *srv, Client *client)
+{
+    // Send as much of the pending output as the socket takes, and only wait
+    // for the socket to be writable while some is left. Returns 0 if the
+    // client has gone away.
+    struct epoll_event ev;
+    ssize_t sent;
+    size_t done = 0;
+
+    while (done < client->nout) {
+        sent = send(client->fd, client->out + done, client->nout - done,
+                    MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (sent <= 0)
+            return 0;
+        done += sent;
+    }
+    memmove(client->out, client->out + done, client->nout - done);
+    client->nout -= done;
+
+    if (client->writing != (client->nout > 0)) {
+        client->writing = client->nout > 0;
+        ev.events = EPOLLIN | (client->writing ? EPOLLOUT : 0);
+        ev.data.ptr = client;
+        epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+    }
+    return 1;
+}
+
+static void Server_add(Server *srv, Summary *summary, const char *text)
+{
+    char *endptr;
+    double x;
+
+    errno = 0;
+    x = strtod(text, &endptr);
+    while (*endptr == ' ' || *endptr == '\t')
+        endptr++;
+    if (endptr == text || *endptr != '\0' || errno == ERANGE ||
+            !isfinite(x) || !Summarizer_add(summary->s, x))
+        summary->rejected++;
+    else if (summary->window)
+        Window_add(summary->window, x, srv->now);
+}
+
+static void Server_stats(Client *client, Summary *summary)
+{
+    Summarizer *s = summary->s;
+
+    Client_reply(client, "count     %zu", Summarizer_count(s));
+    Client_reply(client, "rejected  %zu", summary->rejected);
+    Client_reply(client, "min       %.17g", Summarizer_min(s));
+    Client_reply(client, "Q1        %.17g", Summarizer_percentile(s, 25));
+    Client_reply(client, "median    %.17g", Summarizer_percentile(s, 50));
+    Client_reply(client, "Q3        %.17g", Summarizer_percentile(s, 75));
+    Client_reply(client, "max       %.17g", Summarizer_max(s));
+    Client_reply(client, "mean      %.17g", Summarizer_mean(s));
+    Client_reply(client, "var       %.17g", Summarizer_var(s));
+    Client_reply(client, "sd        %.17g", Summarizer_sd(s));
+    Client_reply(client, "skewness  %.17g", Summarizer_skewness(s));
+    Client_reply(client, "kurtosis  %.17g", Summarizer_kurtosis(s));
+}
+
+static int Server_parse_percentile(Client *client, char *arg, double *q)
+{
+    // Parse a percentile argument, replying with an error if it is invalid.
+    char *endptr;
+
+    *q = strtod(arg, &endptr);
+    if (endptr == arg || *endptr != '\0' || !(*q >= 0 && *q <= 100)) {
+        Client_reply(client, "ERR invalid percentile %s", arg);
+        return 0;
+    }
+    return 1;
+}
+
+static double Server_window_percentile(dataset *ds, double q)
+{
+    if (ds->n == 0)
+        return NAN;
+    return ds->n == 1 ? ds->min : percentile(ds, q);
+}
+
+static void Server_window_stats(Client *client, dataset *ds)
+{
+    Client_reply(client, "count     %zu", ds->n);
+    Client_reply(client, "min       %.17g", ds->n > 0 ? min(ds) : NAN);
+    Client_reply(client, "Q1        %.17g", Server_window_percentile(ds, 25));
+    Client_reply(client, "median    %.17g", Server_window_percentile(ds, 50));
+    Client_reply(client, "Q3        %.17g", Server_window_percentile(ds, 75));
+    Client_reply(client, "max       %.17g", ds->n > 0 ? max(ds) : NAN);
+    Client_reply(client, "mean      %.17g", ds->n > 0 ? mean(ds) : NAN);
+    Client_reply(client, "var       %.17g", ds->n > 1 ? var(ds) : NAN);
+    Client_reply(client, "sd        %.17g", ds->n > 1 ? sd(ds) : NAN);
+}
+
+static void Server_window(Client *client, Summary *summary, char **args,
+                          int nargs, double now)
+{
+    // WINDOW NAME SECONDS [Q ...]: statistics or percentiles of the values
+    // of the last SECONDS seconds.
+    char *endptr;
+    double span = strtod(args[1], &endptr), q[SERVER_MAX_ARGS];
+    dataset *ds;
+    int i;
+
+    if (endptr == args[1] || *endptr != '\0' || !(span >= 0)) {
+        Client_reply(client, "ERR invalid window %s", args[1]);
+        return;
+    }
+    for (i = 2; i < nargs; i++) {
+        if (!Server_parse_percentile(client, args[i], &q[i]))
+            return;
+    }
+    ds = Window_query(summary->window, span, now);
+    if (!ds) {
+        Client_reply(client, "ERR could not query window of %s", summary->name);
+        return;
+    }
+    if (nargs == 2)
+        Server_window_stats(client, ds);
+    for (i = 2; i < nargs; i++)
+        Client_reply(client, "%s %.17g", args[i], Server_window_percentile(ds, q[i]));
+    delete_dataset(ds);
+    Client_reply(client, "OK");
+}
+
+static void Server_decayed(Client *client, Summary *summary, char **args,
+                           int nargs, double now)
+{
+    // DECAYED NAME HALFLIFE Q ...: percentiles where the weight of values
+    // halves every HALFLIFE seconds.
+    char *endptr;
+    double half_life = strtod(args[1], &endptr), q[SERVER_MAX_ARGS];
+    TDigest *digest;
+    int i;
+
+    if (endptr == args[1] || *endptr != '\0' || !(half_life > 0)) {
+        Client_reply(client, "ERR invalid half-life %s", args[1]);
+        return;
+    }
+    for (i = 2; i < nargs; i++) {
+        if (!Server_parse_percentile(client, args[i], &q[i]))
+            return;
+    }
+    digest = Window_decayed(summary->window, half_life, now);
+    if (!digest) {
+        Client_reply(client, "ERR decay requires the t-digest engine");
+        return;
+    }
+    for (i = 2; i < nargs; i++) {
+        Client_reply(client, "%s %.17g", args[i], TDigest_get_count(digest) > 0 ?
+                     TDigest_percentile(digest, q[i] / 100) : NAN);
+    }
+    TDigest_destroy(digest);
+    Client_reply(client, "OK");
+}
+
+static void Server_snapshot(Client *client, Summary *summary, const char *path)
+{
+    // Write the summary to a temporary file renamed to path, so that readers
+    // of path never see a partial snapshot.
+    char tmp[4096];
+    void *buf = NULL;
+    size_t size;
+    FILE *f = NULL;
+    int len, closed;
+
+    len = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    check(len > 0 && (size_t)len < sizeof(tmp), "Snapshot path too long.");
+    buf = Summarizer_serialize(summary->s, &size);
+    check(buf, "Could not serialize %s.", summary->name);
+    f = fopen(tmp, "wb");
+    check(f, "Could not open %s.", tmp);
+    check(fwrite(buf, 1, size, f) == size, "Could not write %s.", tmp);
+    closed = fclose(f) == 0;
+    f = NULL;
+    check(closed, "Could not write %s.", tmp);
+    check(rename(tmp, path) == 0, "Could not rename %s.", tmp);
+    free(buf);
+    Client_reply(client, "OK");
+    return;
+
+error:
+    if (f)
+        fclose(f);
+    if (buf)
+        unlink(tmp);
+    free(buf);
+    Client_reply(client, "ERR could not write snapshot to %s", path);
+}
+
+static void Server_percentiles(Client *client, Summary *summary, char **args,
+                               int nargs)
+{
+    // PERCENTILE NAME Q ...: every Q is checked before the first reply, so
+    // that an invalid one gets a single ERR line.
+    double q[SERVER_MAX_ARGS];
+    int i;
+
+    for (i = 1; i < nargs; i++) {
+        if (!Server_parse_percentile(client, args[i], &q[i]))
+            return;
+    }
+    for (i = 1; i < nargs; i++)
+        Client_reply(client, "%s %.17g", args[i],
+                     Summarizer_percentile(summary->s, q[i]));
+    Client_reply(client, "OK");
+}
+
+static void Server_command(Server *srv, Client *client, char *line)
+{
+    // Run the command on line, which is modified in place.
+    char *args[SERVER_MAX_ARGS], *cmd, *save = NULL;
+    int nargs = 0;
+    Summary *summary;
+
+    cmd = strtok_r(line, " \t", &save);
+    while (nargs < SERVER_MAX_ARGS &&
+            (args[nargs] = strtok_r(NULL, " \t", &save)) != NULL)
+        nargs++;
+
+    if (strcmp(cmd, "LIST") == 0) {
+        for (summary = srv->summaries; summary; summary = summary->next)
+            Client_reply(client, "%s %zu", summary->name,
+                         Summarizer_count(summary->s));
+        Client_reply(client, "OK");
+        return;
+    }
+    if (strcmp(cmd, "SHUTDOWN") == 0) {
+        srv->stop = true;
+        Client_reply(client, "OK");
+        return;
+    }
+    if (strcmp(cmd, "STATS") != 0 && strcmp(cmd, "PERCENTILE") != 0 &&
+            strcmp(cmd, "RESET") != 0 && strcmp(cmd, "SNAPSHOT") != 0 &&
+            strcmp(cmd, "BINARY") != 0 && strcmp(cmd, "WINDOW") != 0 &&
+            strcmp(cmd, "DECAYED") != 0) {
+        Client_reply(client, "ERR unknown command %s", cmd);
+        return;
+    }
+    if (nargs == 0) {
+        Client_reply(client, "ERR %s takes a summary name", cmd);
+        return;
+    }
+
+    if (strcmp(cmd, "BINARY") == 0) {
+        client->binary = Server_find(srv, args[0], true);
+        if (client->binary)
+            Client_reply(client, "OK");
+        else
+            Client_reply(client, "ERR invalid summary name %s", args[0]);
+        return;
+    }
+    summary = Server_find(srv, args[0], false);
+    if (!summary) {
+        Client_reply(client, "ERR unknown summary %s", args[0]);
+        return;
+    }
+
+    if (strcmp(cmd, "STATS") == 0) {
+        Server_stats(client, summary);
+        Client_reply(client, "OK");
+    } else if (strcmp(cmd, "RESET") == 0) {
+        if (Server_reset(srv, summary))
+            Client_reply(client, "OK");
+        else
+            Client_reply(client, "ERR could not reset %s", args[0]);
+    } else if (strcmp(cmd, "WINDOW") == 0 || strcmp(cmd, "DECAYED") == 0) {
+        if (!summary->window)
+            Client_reply(client, "ERR the server keeps no window, see --window");
+        else if (nargs < 2 || (cmd[0] == 'D' && nargs < 3))
+            Client_reply(client, "ERR %s takes a summary name, a duration%s",
+                         cmd, cmd[0] == 'D' ? " and percentiles" : "");
+        else if (cmd[0] == 'W')
+            Server_window(client, summary, args, nargs, srv->now);
+        else
+            Server_decayed(client, summary, args, nargs, srv->now);
+    } else if (strcmp(cmd, "SNAPSHOT") == 0) {
+        if (nargs != 2)
+            Client_reply(client, "ERR SNAPSHOT takes a summary name and a path");
+        else
+            Server_snapshot(client, summary, args[1]);
+    } else {
+        if (nargs < 2) {
+            Client_reply(client, "ERR PERCENTILE takes a summary name and "
+                         "percentiles");
+            return;
+        }
+        Server_percentiles(client, summary, args, nargs);
+    }
+}
+
+static bool Server_is_number(const char *text)
+{
+    // Whether strtod reads all of text but trailing blanks.
+    char *endptr;
+
+    strtod(text, &endptr);
+    while (*endptr == ' ' || *endptr == '\t')
+        endptr++;
+    return endptr != text && *endptr == '\0';
+}
+
+static void Server_line(Server *srv, Client *client, char *line)
+{
+    // Handle one line of text input: a value, a named value or a command.
+    // Any line that reads in full as a number is a value, such as inf, which
+    // Server_add rejects.
+    char *colon, *space;
+    Summary *summary;
+    size_t len = strlen(line);
+
+    if (len > 0 && line[len - 1] == '\r')
+        line[--len] = '\0';
+    while (*line == ' ' || *line == '\t')
+        line++;
+    if (*line == '\0')
+        return;
+
+    colon = strchr(line, ':');
+    space = strpbrk(line, " \t");
+    if (colon && (!space || colon < space)) {
+        *colon = '\0';
+        summary = Server_find(srv, line, true);
+        if (summary)
+            Server_add(srv, summary, colon + 1);
+    } else if (Server_is_number(line)) {
+        summary = Server_find(srv, SERVER_DEFAULT_NAME, true);
+        if (summary)
+            Server_add(srv, summary, line);
+    } else {
+        Server_command(srv, client, line);
+    }
+}
+
+static void Server_binary(Server *srv, Client *client)
+{
+    // Add the complete doubles in the input buffer to the binary summary
+    // and keep the bytes of an incomplete one for the next read. Infinities
+    // and NaNs are rejected, like in text.
+    double batch[SERVER_BUFFER_SIZE / sizeof(double)];
+    size_t i, m = 0, n = client->nin / sizeof(double), added;
+
+    memcpy(batch, client->in, n * sizeof(double));
+    for (i = 0; i < n; i++) {
+        if (isfinite(batch[i]))
+            batch[m++] = batch[i];
+    }
+    added = Summarizer_add_batch(client->binary->s, batch, m);
+    client->binary->rejected += n - added;
+    if (client->binary->window)
+        Window_add_batch(client->binary->window, batch, m, srv->now);
+    client->nin -= n * sizeof(double);
+    memmove(client->in, client->in + n * sizeof(double), client->nin);
+}
+
+static int Server_read(Server *srv, Client *client)
+{
+    // Read what the client has sent and handle it. Returns 0 when the
+    // client must be disconnected.
+    ssize_t got;
+    char *line, *end;
+    size_t used;
+
+    got = read(client->fd, client->in + client->nin,
+               sizeof(client->in) - client->nin);
+    if (got < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return 1;
+    if (got <= 0)
+        return 0;
+    client->nin += got;
+
+    line = client->in;
+    while (!client->binary &&
+            (end = memchr(line, '\n', client->nin - (line - client->in)))) {
+        *end = '\0';
+        Server_line(srv, client, line);
+        line = end + 1;
+    }
+    used = line - client->in;
+    client->nin -= used;
+    memmove(client->in, line, client->nin);
+
+    if (client->binary) {
+        Server_binary(srv, client);
+    } else if (client->nin == sizeof(client->in)) {
+        Client_reply(client, "ERR line too long");
+        client->closing = true;
+    }
+    return 1;
+}
+
+static int Server_accept(Server *srv)
+{
+    struct epoll_event ev;
+    Client *client = NULL;
+    int fd;
+
+    fd = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+        // The connection stays pending, and the level-triggered listening
+        // socket would wake epoll_wait again at once. Free the spare
+        // descriptor to accept it and close it right away.
+        log_warn("Out of file descriptors, refusing a connection.");
+        if (srv->spare_fd >= 0) {
+            close(srv->spare_fd);
+            fd = accept(srv->listen_fd, NULL, NULL);
+            if (fd >= 0)
+                close(fd);
+            srv->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        return 1;
+    }
+    if (fd < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+               errno == ECONNABORTED;
+
+    client = calloc(1, sizeof(Client));
+    check_mem(client);
+    client->fd = fd;
+    ev.events = EPOLLIN;
+    ev.data.ptr = client;
+    check(epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0,
+          "Could not watch client.");
+    client->next = srv->clients;
+    if (srv->clients)
+        srv->clients->prev = client;
+    srv->clients = client;
+    return 1;
+
+error:
+    close(fd);
+    free(client);
+    return 1;
+}
+
+static int Server_listen(Server *srv, const char *path)
+{
+    // Bind the socket at path. A socket file left behind by a server that
+    // has exited is replaced, but not one that a live server listens on.
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    int fd;
+
+    check(strlen(path) < sizeof(addr.sun_path), "Socket path too long: %s.",
+          path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    check(fd >= 0, "Could not create socket.");
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        close(fd);
+        sentinel("A server is already listening on %s.", path);
+    }
+    close(fd);
+    unlink(path);
+
+    srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    check(srv->listen_fd >= 0, "Could not create socket.");
+    check(bind(srv->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0,
+          "Could not bind %s.", path);
+    check(listen(srv->listen_fd, SOMAXCONN) == 0, "Could not listen on %s.",
+          path);
+
+    srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    check(srv->epoll_fd >= 0, "Could not create epoll instance.");
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    check(epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listen_fd, &ev) == 0,
+          "Could not watch socket.");
+    return 1;
+
+error:
+    return 0;
+}
+
+static void Server_rotate(Server *srv)
+{
+    // Rotate the windows on a timer, so that the buckets of idle summaries
+    // are emptied when they expire.
+    Summary *summary;
+
+    if (srv->window == 0 || srv->now < srv->next_rotation)
+        return;
+    for (summary = srv->summaries; summary != NULL; summary = summary->next)
+        Window_rotate(summary->window, srv->now);
+    srv->next_rotation = srv->now + srv->interval;
+}
+
+static int Server_timeout(Server *srv)
+{
+    // Milliseconds epoll_wait may sleep before the next rotation.
+    double ms = ceil((srv->next_rotation - Counters_now()) * 1000);
+
+    if (srv->window == 0)
+        return -1;
+    return ms > 0 ? (int)ms : 0;
+}
+
+int Server_run(const char *path, summarizer_mode mode, double window)
+{
+    // Serve on the Unix domain socket at path until a client sends SHUTDOWN
+    // or the process gets SIGINT or SIGTERM. If window is not 0, each
+    // summary also keeps the values of the last window seconds in a rolling
+    // window. Returns 0 if the server could not be started.
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    struct sigaction sa, old_int, old_term;
+    Server srv;
+    Summary *summary, *next;
+    Client *client;
+    int i, n, timeout, ok = 0;
+    bool handlers = false;
+
+    memset(&srv, 0, sizeof(srv));
+    srv.listen_fd = srv.epoll_fd = -1;
+    srv.spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    srv.mode = mode;
+    srv.window = window;
+    srv.now = Counters_now();
+    if (window > 0) {
+        // Buckets use the same engine as the summaries.
+        default_options(&srv.window_opts);
+        srv.window_opts.streaming = true;
+        srv.window_opts.sketch = mode == SUMMARIZER_KLL ? SKETCH_KLL :
+                                 mode == SUMMARIZER_DDSKETCH ? SKETCH_DDSKETCH :
+                                 mode == SUMMARIZER_HDR ? SKETCH_HDR :
+                                 SKETCH_TDIGEST;
+        srv.interval = window / SERVER_WINDOW_BUCKETS;
+        srv.next_rotation = srv.now + srv.interval;
+    }
+    check(Server_listen(&srv, path), "Could not serve on %s.", path);
+
+    // No SA_RESTART, so that epoll_wait returns when the signal arrives.
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = Server_on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    handlers = true;
+
+    while (!srv.stop && !server_interrupted) {
+        timeout = Server_timeout(&srv);
+        n = epoll_wait(srv.epoll_fd, events, SERVER_MAX_EVENTS, timeout);
+        if (n < 0 && errno == EINTR)
+            continue;
+        check(n >= 0, "epoll_wait failed.");
+        srv.now = Counters_now();
+        Server_rotate(&srv);
+
+        for (i = 0; i < n; i++) {
+            client = (Client*)events[i].data.ptr;
+            if (!client) {
+                check(Server_accept(&srv), "Could not accept connection.");
+                continue;
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+                    !Server_read(&srv, client)) {
+                Client_destroy(&srv, client);
+                continue;
+            }
+            if (!Client_flush(&srv, client) ||
+                    (client->closing && client->nout == 0))
+                Client_destroy(&srv, client);
+        }
+    }
+    ok = 1;
+
+error:
+    if (handlers) {
+        sigaction(SIGINT, &old_int, NULL);
+        sigaction(SIGTERM, &old_term, NULL);
+    }
+    while (srv.clients) {
+        // Send what is left of the replies, such as the OK to SHUTDOWN.
+        Client_flush(&srv, srv.clients);
+        Client_destroy(&srv, srv.clients);
+    }
+    if (srv.epoll_fd >= 0)
+        close(srv.epoll_fd);
+    if (srv.spare_fd >= 0)
+        close(srv.spare_fd);
+    if (srv.listen_fd >= 0) {
+        close(srv.listen_fd);
+        unlink(path);
+    }
+    for (summary = srv.summaries; summary != NULL; summary = next) {
+        next = summary->next;
+        Summarizer_destroy(summary->s);
+        Window_destroy(summary->window);
+        free(summary);
+    }
+    server_interrupted = 0;
+    return ok;
+}
+
+#else
+
+int Server_run(const char *path, summarizer_mode mode, double window)
+{
+    (void)mode;
+    (void)window;
+    log_err("Can't serve on %s: server mode requires Linux.", path);
+    return 0;
+}
+
+#endif
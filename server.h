@@ -0,0 +1,48 @@
+/*
+ * Long-running aggregation of values sent over a Unix domain socket.
+ *
+ * The server keeps named summaries (running moments and a sketch of the
+ * distribution) that any number of clients feed and query concurrently. It
+ * is a single-threaded epoll event loop, so summaries need no locking and a
+ * slow client never holds up the others.
+ *
+ * Clients talk to the server with lines of text:
+ *
+ *   VALUE                    add VALUE to the summary named default,
+ *   NAME:VALUE               add VALUE to the summary NAME, which is created
+ *                            on first use,
+ *   STATS NAME               count, quartiles, mean, var and sd of NAME,
+ *   PERCENTILE NAME Q ...    the Qth percentiles of NAME, Q between 0 and 100,
+ *   LIST                     every summary with its count,
+ *   RESET NAME               forget the values of NAME,
+ *   SNAPSHOT NAME PATH       write NAME to the file PATH in the format of
+ *                            Summarizer_serialize,
+ *   BINARY NAME              read the rest of the stream as raw doubles in
+ *                            host byte order and add them to NAME,
+ *   WINDOW NAME SECONDS [Q ...]
+ *                            STATS or percentiles of the values added to NAME
+ *                            in the last SECONDS seconds,
+ *   DECAYED NAME HALFLIFE Q ...
+ *                            percentiles of NAME where the weight of a value
+ *                            halves every HALFLIFE seconds (t-digest only),
+ *   SHUTDOWN                 stop the server.
+ *
+ * WINDOW and DECAYED are only available when the server keeps rolling
+ * windows, see window.h.
+ *
+ * Any line that reads as a number is a value. Lines that add values get no
+ * reply, values that can't be parsed or recorded, infinities and NaNs are
+ * counted as rejected in the STATS of the summary. Commands reply with zero
+ * or more lines followed by OK, or with a single ERR line.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "summarizer.h"
+
+#define SERVER_MAX_NAME 64
+
+int Server_run(const char *path, summarizer_mode mode, double window);
+
+#endif
@@ -0,0 +1,203 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "dbg.h"
+#include "sharded.h"
+
+// Values buffered by a shard before they are added to its Summarizer.
+#define SHARD_BUFFER_SIZE 512
+#define CACHE_LINE_SIZE 64
+
+typedef struct Shard {
+    // Only written by the thread that owns the shard. nbuffered is published
+    // with a release store after the value is written, so that a snapshot
+    // can read the values below it while the owner appends new ones.
+    double buffer[SHARD_BUFFER_SIZE];
+    size_t nbuffered;
+
+    // Protects s and taking values out of the buffer. The owner only takes
+    // it when the buffer is full, so it is contended only by snapshots.
+    pthread_mutex_t lock;
+    Summarizer *s;
+
+    // Protected by the lock of the ShardedSummarizer.
+    struct ShardedSummarizer *owner;
+    struct Shard *prev;
+    struct Shard *next;
+} Shard;
+
+struct ShardedSummarizer {
+    summarizer_mode mode;
+    pthread_key_t key;
+    pthread_mutex_t lock;
+    Shard *shards;
+    // Values of the threads that have exited.
+    Summarizer *retired;
+};
+
+static void Shard_flush(Shard *shard)
+{
+    // Move the buffered values to the Summarizer of the shard. Must be called
+    // with the lock of the shard held, by the owner thread.
+    size_t n = __atomic_load_n(&(shard->nbuffered), __ATOMIC_RELAXED);
+
+    Summarizer_add_batch(shard->s, shard->buffer, n);
+    __atomic_store_n(&(shard->nbuffered), 0, __ATOMIC_RELEASE);
+}
+
+static void Shard_destroy(Shard *shard)
+{
+    Summarizer_destroy(shard->s);
+    pthread_mutex_destroy(&(shard->lock));
+    free(shard);
+}
+
+static void Shard_retire(void *arg)
+{
+    // Called when the owner thread exits. Fold the values of the shard into
+    // the retired values and free it.
+    Shard *shard = (Shard*)arg;
+    ShardedSummarizer *ss = shard->owner;
+
+    pthread_mutex_lock(&(ss->lock));
+    pthread_mutex_lock(&(shard->lock));
+    Shard_flush(shard);
+    if (!Summarizer_merge(ss->retired, shard->s))
+        log_err("Values of an exiting thread were lost.");
+    pthread_mutex_unlock(&(shard->lock));
+
+    if (shard->prev)
+        shard->prev->next = shard->next;
+    else
+        ss->shards = shard->next;
+    if (shard->next)
+        shard->next->prev = shard->prev;
+    pthread_mutex_unlock(&(ss->lock));
+
+    Shard_destroy(shard);
+}
+
+static Shard *ShardedSummarizer_new_shard(ShardedSummarizer *ss)
+{
+    // Create the shard of the calling thread and register it.
+    Shard *shard = NULL;
+
+    check(posix_memalign((void**)&shard, CACHE_LINE_SIZE, sizeof(Shard)) == 0,
+          "Out of memory.");
+    shard->nbuffered = 0;
+    shard->owner = ss;
+    shard->prev = NULL;
+    shard->s = Summarizer_create(ss->mode);
+    check(shard->s, "Could not create shard.");
+    pthread_mutex_init(&(shard->lock), NULL);
+
+    pthread_mutex_lock(&(ss->lock));
+    shard->next = ss->shards;
+    if (ss->shards)
+        ss->shards->prev = shard;
+    ss->shards = shard;
+    pthread_mutex_unlock(&(ss->lock));
+
+    if (pthread_setspecific(ss->key, shard) != 0) {
+        // The shard stays registered, its values are not lost.
+        log_err("Could not register shard.");
+        return NULL;
+    }
+    return shard;
+
+error:
+    if (shard) free(shard);
+    return NULL;
+}
+
+ShardedSummarizer *ShardedSummarizer_create(summarizer_mode mode)
+{
+    ShardedSummarizer *ss = calloc(1, sizeof(ShardedSummarizer));
+    check_mem(ss);
+
+    ss->mode = mode;
+    ss->retired = Summarizer_create(mode);
+    check(ss->retired, "Could not create summarizer.");
+    check(pthread_key_create(&(ss->key), Shard_retire) == 0,
+          "Could not create thread key.");
+    pthread_mutex_init(&(ss->lock), NULL);
+    return ss;
+
+error:
+    if (ss) {
+        Summarizer_destroy(ss->retired);
+        free(ss);
+    }
+    return NULL;
+}
+
+void ShardedSummarizer_destroy(ShardedSummarizer *ss)
+{
+    Shard *shard, *next;
+
+    if (!ss)
+        return;
+    // Once the key is deleted, exiting threads no longer retire their shard.
+    pthread_key_delete(ss->key);
+    for (shard = ss->shards; shard != NULL; shard = next) {
+        next = shard->next;
+        Shard_destroy(shard);
+    }
+    Summarizer_destroy(ss->retired);
+    pthread_mutex_destroy(&(ss->lock));
+    free(ss);
+}
+
+int ShardedSummarizer_add(ShardedSummarizer *ss, double x)
+{
+    // Record x in the shard of the calling thread. Returns 0 only if the
+    // shard could not be created. Values that the mode can't record, such as
+    // negative values in SUMMARIZER_HDR mode, are dropped silently.
+    Shard *shard = pthread_getspecific(ss->key);
+    size_t n;
+
+    if (!shard) {
+        shard = ShardedSummarizer_new_shard(ss);
+        if (!shard)
+            return 0;
+    }
+
+    n = __atomic_load_n(&(shard->nbuffered), __ATOMIC_RELAXED);
+    if (n == SHARD_BUFFER_SIZE) {
+        pthread_mutex_lock(&(shard->lock));
+        Shard_flush(shard);
+        pthread_mutex_unlock(&(shard->lock));
+        n = 0;
+    }
+    shard->buffer[n] = x;
+    __atomic_store_n(&(shard->nbuffered), n + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+Summarizer *ShardedSummarizer_snapshot(ShardedSummarizer *ss)
+{
+    // Merge the values recorded so far into a new Summarizer, which the
+    // caller must destroy. Recording threads are only held up while their
+    // own shard is being merged.
+    Summarizer *snapshot = Summarizer_create(ss->mode);
+    Shard *shard;
+    size_t n;
+    int ok = 1;
+
+    check(snapshot, "Could not create snapshot.");
+    pthread_mutex_lock(&(ss->lock));
+    ok = Summarizer_merge(snapshot, ss->retired);
+    for (shard = ss->shards; shard != NULL && ok; shard = shard->next) {
+        pthread_mutex_lock(&(shard->lock));
+        ok = Summarizer_merge(snapshot, shard->s);
+        n = __atomic_load_n(&(shard->nbuffered), __ATOMIC_ACQUIRE);
+        Summarizer_add_batch(snapshot, shard->buffer, n);
+        pthread_mutex_unlock(&(shard->lock));
+    }
+    pthread_mutex_unlock(&(ss->lock));
+    check(ok, "Could not merge shards.");
+    return snapshot;
+
+error:
+    Summarizer_destroy(snapshot);
+    return NULL;
+}
@@ -0,0 +1,29 @@
+/*
+ * Summarizer shared by many recording threads.
+ *
+ * Each thread that records into a ShardedSummarizer gets its own shard, so
+ * recording never contends with other threads. A shard appends values to a
+ * small buffer without taking any lock and only folds the buffer into its
+ * Summarizer when it is full. Readers ask for a snapshot, which merges the
+ * shards into a new Summarizer while recording goes on. A snapshot includes
+ * every value whose ShardedSummarizer_add returned before the snapshot was
+ * requested.
+ *
+ * When a thread exits, its shard is merged into the summarizer and freed. The
+ * ShardedSummarizer must only be destroyed once no thread records into it
+ * anymore.
+ */
+
+#ifndef SHARDED_H
+#define SHARDED_H
+
+#include "summarizer.h"
+
+typedef struct ShardedSummarizer ShardedSummarizer;
+
+DESC_API ShardedSummarizer *ShardedSummarizer_create(summarizer_mode mode);
+DESC_API void ShardedSummarizer_destroy(ShardedSummarizer *ss);
+DESC_API int ShardedSummarizer_add(ShardedSummarizer *ss, double x);
+DESC_API Summarizer *ShardedSummarizer_snapshot(ShardedSummarizer *ss);
+
+#endif
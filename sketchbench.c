@@ -0,0 +1,164 @@
+/*
+ * Compare the streaming quantile engines on throughput, memory and accuracy.
+ *
+ * For each distribution, the same values are fed to a t-digest, a KLL sketch
+ * and a DDSketch. The error reported is the rank error: the difference between
+ * the requested quantile and the fraction of the data that is smaller than the
+ * estimate. The largest relative error on the value is also given, since that
+ * is what DDSketch bounds.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench_util.h"
+#include "dbg.h"
+#include "ddsketch.h"
+#include "kll.h"
+#include "tdigest.h"
+
+#define DEFAULT_N 200000
+
+static double quantiles[] = {0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999};
+#define NQUANTILES (sizeof(quantiles) / sizeof(quantiles[0]))
+
+void usage()
+{
+    fprintf(stderr, "usage: sketchbench [N]\n"
+                    "  Compare the streaming engines on N generated values\n"
+                    "  (default %d) for several distributions.\n", DEFAULT_N);
+}
+
+void report(char *engine, double elapsed, size_t n, size_t memory,
+            double *estimates, double *sorted)
+{
+    // Print the rank error at each quantile, followed by the largest rank
+    // error and the largest relative error on the value.
+    size_t i;
+    double err, max_err = 0, rel_err, max_rel_err = 0, exact;
+
+    printf("  %-8s %8.3g Madd/s %9zu B ", engine, n / elapsed / 1e6, memory);
+    for (i = 0; i < NQUANTILES; i++) {
+        err = fabs(rank_of(sorted, n, estimates[i]) - quantiles[i]);
+        if (err > max_err)
+            max_err = err;
+        exact = sorted[(size_t)(quantiles[i] * (n - 1))];
+        rel_err = fabs(estimates[i] - exact) / fabs(exact);
+        if (rel_err > max_rel_err)
+            max_rel_err = rel_err;
+        printf(" %8.2e", err);
+    }
+    printf("  max %8.2e  rel %8.2e\n", max_err, max_rel_err);
+}
+
+// Each engine is driven through the same small interface.
+typedef struct engine {
+    char *name;
+    void *(*create)();
+    void (*add)(void *sketch, double x);
+    double (*percentile)(void *sketch, double q);
+    size_t (*memory)(void *sketch);
+    void (*destroy)(void *sketch);
+} engine;
+
+void *tdigest_create() { return TDigest_create(DEFAULT_DELTA, DEFAULT_K); }
+void tdigest_add(void *s, double x) { TDigest_add((TDigest**)s, x, 1); }
+double tdigest_percentile(void *s, double q) { return TDigest_percentile(*(TDigest**)s, q); }
+size_t tdigest_memory(void *s) { return TDigest_get_memory(*(TDigest**)s); }
+void tdigest_destroy(void *s) { TDigest_destroy(*(TDigest**)s); free(s); }
+
+void *tdigest_create_ref()
+{
+    // TDigest_add may replace the digest, so the engine holds a pointer to it.
+    TDigest **ref = malloc(sizeof(TDigest*));
+    if (ref)
+        *ref = tdigest_create();
+    return ref;
+}
+
+void *kll_create() { return KLL_create(KLL_DEFAULT_K); }
+void kll_add(void *s, double x) { KLL_add(s, x, 1); }
+double kll_percentile(void *s, double q) { return KLL_percentile(s, q); }
+size_t kll_memory(void *s) { return KLL_get_memory(s); }
+void kll_destroy(void *s) { KLL_destroy(s); }
+
+void *ddsketch_create() { return DDSketch_create(DDSKETCH_DEFAULT_ALPHA); }
+void ddsketch_add(void *s, double x) { DDSketch_add(s, x, 1); }
+double ddsketch_percentile(void *s, double q) { return DDSketch_percentile(s, q); }
+size_t ddsketch_memory(void *s) { return DDSketch_get_memory(s); }
+void ddsketch_destroy(void *s) { DDSketch_destroy(s); }
+
+static engine engines[] = {
+    { "tdigest", tdigest_create_ref, tdigest_add, tdigest_percentile,
+      tdigest_memory, tdigest_destroy },
+    { "kll", kll_create, kll_add, kll_percentile, kll_memory, kll_destroy },
+    { "ddsketch", ddsketch_create, ddsketch_add, ddsketch_percentile,
+      ddsketch_memory, ddsketch_destroy },
+};
+#define NENGINES (sizeof(engines) / sizeof(engines[0]))
+
+void bench(char *name, generator generate, size_t n)
+{
+    double *values = NULL;
+    double estimates[NENGINES][NQUANTILES];
+    double elapsed[NENGINES], t0;
+    size_t memory[NENGINES];
+    size_t i, j;
+    void *sketch;
+
+    values = malloc(n * sizeof(double));
+    check_mem(values);
+    for (i = 0; i < n; i++)
+        values[i] = generate(i, n);
+
+    printf("%s, n = %zu\n", name, n);
+
+    for (j = 0; j < NENGINES; j++) {
+        sketch = engines[j].create();
+        check_mem(sketch);
+        t0 = now();
+        for (i = 0; i < n; i++)
+            engines[j].add(sketch, values[i]);
+        elapsed[j] = now() - t0;
+        for (i = 0; i < NQUANTILES; i++)
+            estimates[j][i] = engines[j].percentile(sketch, quantiles[i]);
+        memory[j] = engines[j].memory(sketch);
+        engines[j].destroy(sketch);
+    }
+
+    // Sort only after the sketches are built so that they see the data in
+    // generation order.
+    qsort(values, n, sizeof(double), doublecmp);
+    for (j = 0; j < NENGINES; j++)
+        report(engines[j].name, elapsed[j], n, memory[j], estimates[j], values);
+
+error:
+    free(values);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t i, n = DEFAULT_N;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+        if (n == 0) {
+            usage();
+            return 1;
+        }
+    }
+
+    srand(42);
+    printf("rank error at quantiles");
+    for (i = 0; i < NQUANTILES; i++)
+        printf(" %g", quantiles[i]);
+    printf("\nKLL k = %d, guaranteed rank error %.2e (99%% confidence)\n",
+           KLL_DEFAULT_K, KLL_epsilon(KLL_DEFAULT_K));
+    printf("DDSketch guaranteed relative error %.2e\n\n", DDSKETCH_DEFAULT_ALPHA);
+
+    bench("uniform", uniform, n);
+    bench("normal", normal, n);
+    bench("lognormal", lognormal, n);
+
+    return 0;
+}
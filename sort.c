@@ -0,0 +1,190 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "dbg.h"
+#include "sort.h"
+
+// Digits of 11 bits take six passes, the last one over 9 bits. Wider digits
+// mean fewer passes but scatter the keys over more places at once.
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES ((64 + RADIX_BITS - 1) / RADIX_BITS)
+
+enum sort_phase {
+    // Replace the values by their keys and count every digit.
+    PHASE_KEYS,
+    // Count the digit of the pass.
+    PHASE_COUNT,
+    // Move the keys to their place for the digit of the pass.
+    PHASE_SCATTER,
+    // Replace the keys by their values.
+    PHASE_VALUES
+};
+
+// Share of the array of one thread. The keys are stored in the array of
+// values itself, and always accessed through memcpy while they replace
+// them.
+typedef struct sort_task {
+    enum sort_phase phase;
+    uint64_t *src;
+    uint64_t *dst;
+    size_t start;
+    size_t end;
+    unsigned shift;
+    // Histogram of the digit of the pass in [start, end), turned into the
+    // positions of the keys of each digit in dst before scattering.
+    size_t counts[RADIX_BUCKETS];
+    size_t digits[RADIX_PASSES][RADIX_BUCKETS];
+} sort_task;
+
+static void *_sort_worker(void *arg)
+{
+    sort_task *t = (sort_task*)arg;
+    uint64_t key;
+    double x;
+    size_t i, p;
+
+    switch (t->phase) {
+    case PHASE_KEYS:
+        memset(t->digits, 0, sizeof(t->digits));
+        for (i = t->start; i < t->end; i++) {
+            memcpy(&x, t->src + i, sizeof(x));
+            key = order_key(x);
+            memcpy(t->src + i, &key, sizeof(key));
+            for (p = 0; p < RADIX_PASSES; p++)
+                t->digits[p][(key >> (p * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+        }
+        break;
+    case PHASE_COUNT:
+        memset(t->counts, 0, sizeof(t->counts));
+        for (i = t->start; i < t->end; i++)
+            t->counts[(t->src[i] >> t->shift) & (RADIX_BUCKETS - 1)]++;
+        break;
+    case PHASE_SCATTER:
+        for (i = t->start; i < t->end; i++) {
+            key = t->src[i];
+            t->dst[t->counts[(key >> t->shift) & (RADIX_BUCKETS - 1)]++] = key;
+        }
+        break;
+    case PHASE_VALUES:
+        for (i = t->start; i < t->end; i++) {
+            memcpy(&key, t->src + i, sizeof(key));
+            x = key_value(key);
+            memcpy(t->src + i, &x, sizeof(x));
+        }
+        break;
+    }
+    return NULL;
+}
+
+static void _sort_run(sort_task *tasks, int nthreads, enum sort_phase phase)
+{
+    // Run a phase on every share of the array, the calling thread taking the
+    // first one. A share whose thread can't be started is done inline.
+    pthread_t threads[SORT_MAX_THREADS];
+    bool started[SORT_MAX_THREADS];
+    int i;
+
+    for (i = 0; i < nthreads; i++)
+        tasks[i].phase = phase;
+    for (i = 1; i < nthreads; i++)
+        started[i] = pthread_create(&threads[i], NULL, _sort_worker,
+                                    &tasks[i]) == 0;
+    _sort_worker(&tasks[0]);
+    for (i = 1; i < nthreads; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            _sort_worker(&tasks[i]);
+    }
+}
+
+int radix_sort(double *values, size_t n, int nthreads)
+{
+    // Sort n values in increasing order with up to nthreads threads. Needs a
+    // buffer of n values, returns 0 and leaves the values untouched if it
+    // can't be allocated.
+    uint64_t *keys = (uint64_t*)values, *buffer = NULL, *src, *dst, *tmp;
+    sort_task *tasks = NULL;
+    size_t b, p, offset, count;
+    bool counted = true, trivial;
+    int i;
+
+    if (n < 2)
+        return 1;
+    if ((size_t)nthreads > n / SORT_MIN_PER_THREAD)
+        nthreads = (int)(n / SORT_MIN_PER_THREAD);
+    if (nthreads > SORT_MAX_THREADS)
+        nthreads = SORT_MAX_THREADS;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    buffer = malloc(n * sizeof(uint64_t));
+    check_debug(buffer, "Memory error");
+    tasks = calloc(nthreads, sizeof(sort_task));
+    check_debug(tasks, "Memory error");
+    for (i = 0; i < nthreads; i++) {
+        tasks[i].src = keys;
+        tasks[i].start = n / nthreads * i;
+        tasks[i].end = i == nthreads - 1 ? n : n / nthreads * (i + 1);
+    }
+    _sort_run(tasks, nthreads, PHASE_KEYS);
+
+    src = keys;
+    dst = buffer;
+    for (p = 0; p < RADIX_PASSES; p++) {
+        // Skip the digit if every key has the same.
+        trivial = false;
+        for (b = 0; b < RADIX_BUCKETS && !trivial; b++) {
+            for (count = 0, i = 0; i < nthreads; i++)
+                count += tasks[i].digits[p][b];
+            trivial = count == n;
+        }
+        if (trivial)
+            continue;
+
+        for (i = 0; i < nthreads; i++) {
+            tasks[i].src = src;
+            tasks[i].dst = dst;
+            tasks[i].shift = p * RADIX_BITS;
+            // The counts of PHASE_KEYS hold until the keys first move
+            // between shares, which never happens with a single share.
+            if (counted)
+                memcpy(tasks[i].counts, tasks[i].digits[p],
+                       sizeof(tasks[i].counts));
+        }
+        if (!counted)
+            _sort_run(tasks, nthreads, PHASE_COUNT);
+        counted = nthreads == 1;
+
+        // Keys with the same digit keep their order, those of the first
+        // share going first.
+        offset = 0;
+        for (b = 0; b < RADIX_BUCKETS; b++) {
+            for (i = 0; i < nthreads; i++) {
+                count = tasks[i].counts[b];
+                tasks[i].counts[b] = offset;
+                offset += count;
+            }
+        }
+        _sort_run(tasks, nthreads, PHASE_SCATTER);
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != keys)
+        memcpy(keys, src, n * sizeof(uint64_t));
+    for (i = 0; i < nthreads; i++)
+        tasks[i].src = keys;
+    _sort_run(tasks, nthreads, PHASE_VALUES);
+
+    free(tasks);
+    free(buffer);
+    return 1;
+
+error:
+    free(tasks);
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Sorting of the data array, for datasets that are queried for many
+ * percentiles.
+ *
+ * radix_sort is a least significant digit radix sort on the bit patterns of
+ * the values, mapped by order_key to unsigned integers that compare like the
+ * values. Each pass reads the array once and scatters it into a buffer of
+ * the same size, so the time is linear in the number of values, and the
+ * passes over digits that are the same for every value are skipped. Large
+ * arrays are split between threads.
+ */
+
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Arrays are sorted by a single thread below this many values per thread.
+#define SORT_MIN_PER_THREAD (1 << 18)
+#define SORT_MAX_THREADS 16
+
+static inline uint64_t order_key(double x)
+{
+    // Map x to an unsigned integer such that keys are in the same order as
+    // the values, by flipping every bit of negative numbers and the sign bit
+    // of the others.
+    uint64_t u;
+
+    memcpy(&u, &x, sizeof(u));
+    return u >> 63 ? ~u : u | (UINT64_C(1) << 63);
+}
+
+static inline double key_value(uint64_t key)
+{
+    // Inverse of order_key.
+    double x;
+
+    key = key >> 63 ? key & ~(UINT64_C(1) << 63) : ~key;
+    memcpy(&x, &key, sizeof(x));
+    return x;
+}
+
+int radix_sort(double *values, size_t n, int nthreads);
+
+#endif
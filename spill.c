@@ -0,0 +1,207 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "counters.h"
+#include "dbg.h"
+#include "spill.h"
+
+// Largest number of bytes passed to a single write, which some systems cap
+// below 2 GB.
+#define SPILL_MAX_WRITE (1 << 30)
+
+Spill *Spill_create(void)
+{
+    Spill *s = calloc(1, sizeof(Spill));
+
+    check_mem(s);
+    return s;
+
+error:
+    return NULL;
+}
+
+static void Spill_release(spill_file *file)
+{
+    // Drop a reference to file, closing it with the last one. Spills sharing
+    // a file may be destroyed by different threads.
+    if (__atomic_sub_fetch(&(file->refs), 1, __ATOMIC_ACQ_REL) == 0) {
+        close(file->fd);
+        free(file);
+    }
+}
+
+void Spill_destroy(Spill *s)
+{
+    size_t i;
+
+    if (!s)
+        return;
+    for (i = 0; i < s->nruns; i++)
+        Spill_release(s->runs[i].file);
+    if (s->file)
+        Spill_release(s->file);
+    free(s->runs);
+    free(s);
+}
+
+static int Spill_add_run(Spill *s, spill_file *file, size_t offset, size_t n)
+{
+    // Append the run of n values at offset in file, taking a reference to
+    // the file.
+    size_t allocated;
+    spill_run *runs;
+
+    if (s->nruns == s->allocated) {
+        allocated = s->allocated ? s->allocated * 2 : 8;
+        runs = realloc(s->runs, allocated * sizeof(spill_run));
+        check_mem(runs);
+        s->runs = runs;
+        s->allocated = allocated;
+    }
+    __atomic_add_fetch(&(file->refs), 1, __ATOMIC_RELAXED);
+    s->runs[s->nruns].file = file;
+    s->runs[s->nruns].offset = offset;
+    s->runs[s->nruns].n = n;
+    s->nruns++;
+    s->n += n;
+    return 1;
+
+error:
+    return 0;
+}
+
+static spill_file *Spill_open_file(void)
+{
+    // Create an anonymous temporary file, referenced once by its Spill.
+    const char *dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    spill_file *file = NULL;
+
+    if (!dir || !*dir)
+        dir = "/tmp";
+    check((size_t)snprintf(path, sizeof(path), "%s/desc-spill-XXXXXX", dir) <
+          sizeof(path), "Temporary directory name too long.");
+    file = calloc(1, sizeof(spill_file));
+    check_mem(file);
+    file->fd = mkstemp(path);
+    check(file->fd >= 0, "Could not create a temporary file in %s.", dir);
+    unlink(path);
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    file->refs = 1;
+    return file;
+
+error:
+    free(file);
+    return NULL;
+}
+
+int Spill_write(Spill *s, const double *values, size_t n)
+{
+    // Append n values to the file of s as a new run. pwrite leaves the file
+    // offset alone, and other Spills only read the runs already written.
+    const char *bytes = (const char*)values;
+    size_t left = n * sizeof(double), len, pos;
+    ssize_t written;
+
+    if (n == 0)
+        return 1;
+    if (!s->file) {
+        s->file = Spill_open_file();
+        check(s->file, "Could not spill data.");
+    }
+    pos = s->file->size;
+    while (left > 0) {
+        len = left < SPILL_MAX_WRITE ? left : SPILL_MAX_WRITE;
+        written = pwrite(s->file->fd, bytes, len, (off_t)pos);
+        if (written < 0 && errno == EINTR)
+            continue;
+        check(written > 0, "Could not write spilled data.");
+        bytes += written;
+        pos += written;
+        left -= written;
+    }
+    check(Spill_add_run(s, s->file, s->file->size / sizeof(double), n),
+          "Could not spill data.");
+    s->file->size = pos;
+    COUNTER_ADD(spill_runs, 1);
+    COUNTER_ADD(spill_bytes_written, n * sizeof(double));
+    return 1;
+
+error:
+    return 0;
+}
+
+int Spill_merge(Spill *s, Spill *other)
+{
+    // Add the runs of other to s. The files are shared, other is left
+    // untouched.
+    size_t i;
+
+    for (i = 0; i < other->nruns; i++) {
+        check(Spill_add_run(s, other->runs[i].file, other->runs[i].offset,
+                            other->runs[i].n),
+              "Could not merge spilled data.");
+    }
+    return 1;
+
+error:
+    return 0;
+}
+
+static int Spill_read(int fd, double *block, size_t n, size_t offset)
+{
+    // Read the n values at offset (in values) of fd into block. pread leaves
+    // the file offset alone, since a file may be shared with other Spills.
+    char *bytes = (char*)block;
+    size_t left = n * sizeof(double);
+    off_t pos = (off_t)(offset * sizeof(double));
+    ssize_t nread;
+
+    while (left > 0) {
+        nread = pread(fd, bytes, left, pos);
+        if (nread < 0 && errno == EINTR)
+            continue;
+        check(nread > 0, "Could not read spilled data.");
+        bytes += nread;
+        pos += nread;
+        left -= nread;
+    }
+    return 1;
+
+error:
+    return 0;
+}
+
+int Spill_scan(Spill *s, spill_visitor visit, void *ctx)
+{
+    // Pass every value of s to visit, run by run and block by block.
+    // Returns 0 on error or if visit stopped the scan.
+    double *block = NULL;
+    size_t i, offset, n, max = SPILL_BLOCK / sizeof(double);
+
+    block = malloc(SPILL_BLOCK);
+    check_mem(block);
+    for (i = 0; i < s->nruns; i++) {
+        for (offset = 0; offset < s->runs[i].n; offset += n) {
+            n = s->runs[i].n - offset < max ? s->runs[i].n - offset : max;
+            check(Spill_read(s->runs[i].file->fd, block, n,
+                             s->runs[i].offset + offset),
+                  "Could not scan spilled data.");
+            check_debug(visit(ctx, block, n), "Scan stopped.");
+        }
+    }
+    COUNTER_ADD(spill_passes, 1);
+    COUNTER_ADD(spill_bytes_read, s->n * sizeof(double));
+    free(block);
+    return 1;
+
+error:
+    free(block);
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Temporary storage for the values of exact datasets that don't fit in their
+ * memory budget.
+ *
+ * A Spill is a list of runs of doubles in host byte order, each written in one
+ * go when the data array of a dataset is full. The runs of a Spill are
+ * appended to a single file, created in $TMPDIR, or /tmp, and unlinked right
+ * away, so that it disappears with the process however it exits. A run is
+ * never modified once written, which lets Spill_merge share runs instead of
+ * copying them: the merged Spill refers to the same file, which is closed
+ * when the last run in it is released. The number of open files is thus that
+ * of the Spills that wrote data, whatever the number of runs. Runs are only
+ * read sequentially, in blocks of SPILL_BLOCK bytes, by Spill_scan.
+ */
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stddef.h>
+
+#define SPILL_BLOCK (1 << 20)
+
+typedef struct spill_file {
+    int fd;
+    // Number of runs stored in the file, in all the Spills sharing it, plus
+    // one while its Spill may append to it.
+    size_t refs;
+    // Bytes written, where the next run starts.
+    size_t size;
+} spill_file;
+
+typedef struct spill_run {
+    spill_file *file;
+    // Offset of the run in the file, in values.
+    size_t offset;
+    size_t n;
+} spill_run;
+
+typedef struct Spill {
+    // File the runs written by this Spill are appended to, NULL until the
+    // first one.
+    spill_file *file;
+    spill_run *runs;
+    size_t nruns;
+    size_t allocated;
+    // Number of values in all the runs.
+    size_t n;
+} Spill;
+
+// Called by Spill_scan with each block of values. Returns 0 to stop the scan.
+typedef int (*spill_visitor)(void *ctx, const double *values, size_t n);
+
+Spill *Spill_create(void);
+void Spill_destroy(Spill *s);
+int Spill_write(Spill *s, const double *values, size_t n);
+int Spill_merge(Spill *s, Spill *other);
+int Spill_scan(Spill *s, spill_visitor visit, void *ctx);
+
+#endif
@@ -1,19 +1,52 @@
+#ifdef __linux__
+// For mremap.
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <time.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "counters.h"
 #include "dbg.h"
+#include "input.h"
+#include "sort.h"
 #include "stats.h"
 
 #define MAX_LINELENGTH 100
 #define BASE_DATA_SIZE 32
 #define MICROSECS_PER_SEC 1000000
+// Number of buckets of the histograms of the external selection. Each pass
+// over the spilled data divides the range of the candidates by this factor.
+#define SPILL_BUCKETS (1 << 16)
+// Largest number of ranks looked for in the same passes.
+#define SPILL_MAX_RANKS 6
+// The data array is sorted once this many selections have been made since it
+// last changed.
+#define SORT_AFTER_SELECTS 8
+// Values whose bin is computed at once by histogram.
+#define BIN_BLOCK 256
+// Data arrays of at least this many bytes are anonymous mappings when mremap
+// is available.
+#define DATA_MMAP_THRESHOLD (1 << 20)
+// Returned by _sketch_add for values the engine can't represent, as opposed
+// to 0 for failures.
+#define SKETCH_REJECTED -1
+
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+#define HAVE_MREMAP
+#endif
 
 #define SWAP(a, b) tmp=(a); a=(b); (b)=tmp;
+#define SWAP_WEIGHTS(a, b) wtmp=(a); a=(b); (b)=wtmp;
 
-size_t _grow_data(double **data, size_t n);
+int _grow_data(dataset *ds);
 double _select(double *list, size_t n, size_t k);
 
 void clear(dataset *ds)
@@ -21,27 +54,402 @@ void clear(dataset *ds)
     ds->n = 0;
     ds->data_size = 0;
     ds->has_q1 = false;
+    ds->has_q2 = false;
     ds->has_q3 = false;
     ds->streaming = false;
+    ds->sorted = false;
+    ds->nselects = 0;
     ds->M1 = 0;
     ds->M2 = 0;
+    ds->M3 = 0;
+    ds->M4 = 0;
+}
+
+void default_options(dataset_options *opts)
+{
+    // Exact statistics, with the t-digest as the streaming engine.
+    opts->streaming = false;
+    opts->accurate = false;
+    opts->sketch = SKETCH_TDIGEST;
+    opts->hdr_digits = 3;
+    opts->delta = 0;
+    opts->max_centroids = 0;
+    opts->sketch_mem = 0;
+    opts->mem = 0;
+    opts->distinct = false;
+    opts->topk = 0;
+    opts->weighted = false;
+}
+
+int _init_sketch(dataset *ds, dataset_options *opts)
+{
+    // Create the approximate quantile engine selected in opts.
+    double delta = DEFAULT_DELTA;
+    size_t max_centroids = 0;
+
+    ds->streaming = true;
+    ds->sketch = opts->sketch;
+    switch (opts->sketch) {
+    case SKETCH_KLL:
+        ds->kll = KLL_create(opts->sketch_mem ?
+                             KLL_k_for_memory(opts->sketch_mem) : KLL_DEFAULT_K);
+        check_mem(ds->kll);
+        break;
+    case SKETCH_DDSKETCH:
+        ds->ddsketch = DDSketch_create(DDSKETCH_DEFAULT_ALPHA);
+        check_mem(ds->ddsketch);
+        break;
+    case SKETCH_HDR:
+        ds->hdr = HdrHistogram_create(opts->hdr_digits);
+        check(ds->hdr, "Could not create HDR histogram.");
+        break;
+    case SKETCH_NONE:
+        break;
+    default:
+        if (opts->sketch_mem)
+            TDigest_params_for_memory(opts->sketch_mem, &delta, &max_centroids);
+        if (opts->delta > 0)
+            delta = opts->delta;
+        if (opts->max_centroids > 0) {
+            max_centroids = opts->max_centroids;
+            // Without an explicit delta, leave room for new centroids after
+            // each compression, as TDigest_params_for_memory does.
+            if (opts->delta <= 0 && 20.0 / max_centroids > delta)
+                delta = 20.0 / max_centroids < TDIGEST_MAX_DELTA ?
+                        20.0 / max_centroids : TDIGEST_MAX_DELTA;
+        }
+        ds->digest = TDigest_create(delta, DEFAULT_K);
+        check_mem(ds->digest);
+        if (max_centroids > 0)
+            TDigest_set_max_centroids(ds->digest, max_centroids);
+    }
+    return 1;
+
+error:
+    return 0;
+}
+
+double _sketch_percentile(dataset *ds, double q)
+{
+    // Approximate qth quantile, q between 0 and 1, from the streaming engine.
+    // The interpolation of the t-digest between heavy centroids and the
+    // rounding of the HDR histogram can go past the extremes of the data,
+    // the result is kept within them.
+    double x;
+
+    if (ds->n == 0)
+        return NAN;
+    switch (ds->sketch) {
+    case SKETCH_KLL:
+        x = KLL_percentile(ds->kll, q);
+        break;
+    case SKETCH_DDSKETCH:
+        x = DDSketch_percentile(ds->ddsketch, q);
+        break;
+    case SKETCH_HDR:
+        x = HdrHistogram_percentile(ds->hdr, q);
+        break;
+    case SKETCH_NONE:
+        return NAN;
+    default:
+        x = TDigest_percentile(ds->digest, q);
+        break;
+    }
+    if (x < ds->min)
+        x = ds->min;
+    if (x > ds->max)
+        x = ds->max;
+    return x;
+}
+
+int _sketch_add(dataset *ds, double datum, size_t w)
+{
+    // Add datum with weight w to the streaming engine. Returns 1 on success,
+    // SKETCH_REJECTED if the engine can't record datum and 0 on failure.
+    int added;
+
+    switch (ds->sketch) {
+    case SKETCH_KLL:
+        added = KLL_add(ds->kll, datum, w);
+        break;
+    case SKETCH_DDSKETCH:
+        added = DDSketch_add(ds->ddsketch, datum, w);
+        break;
+    case SKETCH_HDR:
+        // The HDR histogram only records non-negative integers that fit in
+        // an int64_t. Fractions are rounded to the nearest integer.
+        if (!(datum >= 0 && datum < 9.2e18))
+            return SKETCH_REJECTED;
+        added = HdrHistogram_add(ds->hdr, llround(datum), w);
+        break;
+    case SKETCH_NONE:
+        added = 1;
+        break;
+    default:
+        TDigest_add(&(ds->digest), datum, w);
+        added = 1;
+    }
+    if (added == 1)
+        COUNTER_ADD(sketch_adds, 1);
+    return added;
+}
+
+double _sketch_cdf(dataset *ds, double x)
+{
+    // Approximate fraction of the values at or below x from the streaming
+    // engine.
+    switch (ds->sketch) {
+    case SKETCH_KLL:
+        return KLL_cdf(ds->kll, x);
+    case SKETCH_DDSKETCH:
+        return DDSketch_cdf(ds->ddsketch, x);
+    case SKETCH_HDR:
+        return HdrHistogram_cdf(ds->hdr, x);
+    case SKETCH_NONE:
+        return NAN;
+    default:
+        return TDigest_cdf(ds->digest, x);
+    }
+}
+
+int _sketch_merge(dataset *ds, dataset *other)
+{
+    // Merge the streaming engine of other into the one of ds.
+    switch (ds->sketch) {
+    case SKETCH_KLL:
+        return KLL_merge(ds->kll, other->kll);
+    case SKETCH_DDSKETCH:
+        return DDSketch_merge(ds->ddsketch, other->ddsketch);
+    case SKETCH_HDR:
+        return HdrHistogram_merge(ds->hdr, other->hdr);
+    case SKETCH_NONE:
+        return 1;
+    default:
+        return TDigest_merge(&(ds->digest), other->digest);
+    }
+}
+
+static void _combine_moments(moments *a, const moments *b)
+{
+    // Add the values described by b to a, using the pairwise formulas of
+    // Chan, Golub and LeVeque for M2 and their extension to M3 and M4 by
+    // Pebay. This gives the same result as adding the values one by one.
+    double na = a->n, nb = b->n, n = a->n + b->n, delta = b->M1 - a->M1;
+    double delta2 = delta * delta;
+
+    if (nb == 0)
+        return;
+    a->M4 += b->M4 + delta2 * delta2 * na * nb * (na * na - na * nb + nb * nb) /
+             (n * n * n) +
+             6 * delta2 * (na * na * b->M2 + nb * nb * a->M2) / (n * n) +
+             4 * delta * (na * b->M3 - nb * a->M3) / n;
+    a->M3 += b->M3 + delta2 * delta * na * nb * (na - nb) / (n * n) +
+             3 * delta * (na * b->M2 - nb * a->M2) / n;
+    a->M2 += b->M2 + delta2 * na * nb / n;
+    a->M1 += delta * nb / n;
+    a->n = n;
+}
+
+static void _dataset_moments(dataset *ds, moments *m)
+{
+    m->n = ds->n;
+    m->M1 = ds->M1;
+    m->M2 = ds->M2;
+    m->M3 = ds->M3;
+    m->M4 = ds->M4;
+}
+
+static void _set_dataset_moments(dataset *ds, const moments *m)
+{
+    ds->M1 = m->M1;
+    ds->M2 = m->M2;
+    ds->M3 = m->M3;
+    ds->M4 = m->M4;
+}
+
+static void _block_moments(const double *values, size_t n, moments *m)
+{
+    // Moments of a block of values in two passes: the mean, then the sums of
+    // the powers of the deviations from it. The sums are split over four
+    // independent accumulators, which pipeline and vectorize, and the mean is
+    // corrected by the residual sum of the deviations. The sums are then
+    // shifted to the corrected mean, so that all the moments share it.
+    double s[4] = {0, 0, 0, 0}, d1[4] = {0, 0, 0, 0}, d2[4] = {0, 0, 0, 0};
+    double d3[4] = {0, 0, 0, 0}, d4[4] = {0, 0, 0, 0};
+    double mean, d, dd, sum1, sum2, sum3, sum4, shift;
+    size_t i, j;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        for (j = 0; j < 4; j++)
+            s[j] += values[i + j];
+    }
+    for (; i < n; i++)
+        s[0] += values[i];
+    mean = ((s[0] + s[1]) + (s[2] + s[3])) / n;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        for (j = 0; j < 4; j++) {
+            d = values[i + j] - mean;
+            dd = d * d;
+            d1[j] += d;
+            d2[j] += dd;
+            d3[j] += dd * d;
+            d4[j] += dd * dd;
+        }
+    }
+    for (; i < n; i++) {
+        d = values[i] - mean;
+        dd = d * d;
+        d1[0] += d;
+        d2[0] += dd;
+        d3[0] += dd * d;
+        d4[0] += dd * dd;
+    }
+    sum1 = (d1[0] + d1[1]) + (d1[2] + d1[3]);
+    sum2 = (d2[0] + d2[1]) + (d2[2] + d2[3]);
+    sum3 = (d3[0] + d3[1]) + (d3[2] + d3[3]);
+    sum4 = (d4[0] + d4[1]) + (d4[2] + d4[3]);
+    shift = sum1 / n;
+    m->n = n;
+    m->M1 = mean + shift;
+    m->M2 = sum2 - sum1 * shift;
+    m->M3 = sum3 - 3 * shift * sum2 + 2 * n * shift * shift * shift;
+    m->M4 = sum4 - 4 * shift * sum3 + 6 * shift * shift * sum2 -
+            3 * n * shift * shift * shift * shift;
+}
+
+static void _accurate_insert(accurate_sums *acc, moments *m, size_t level)
+{
+    // Insert the moments of about 2^level blocks. Like a carry in a binary
+    // counter, they are combined with the occupant of the level and moved up
+    // until they find an empty level, so that only aggregates of similar
+    // sizes are combined.
+    while (level < ACCURATE_LEVELS - 1 && acc->levels[level].n > 0) {
+        _combine_moments(m, &(acc->levels[level]));
+        acc->levels[level].n = 0;
+        level++;
+    }
+    _combine_moments(m, &(acc->levels[level]));
+    acc->levels[level] = *m;
+}
+
+static void _accurate_add(accurate_sums *acc, double datum)
+{
+    moments m;
+
+    acc->block[acc->nblock++] = datum;
+    if (acc->nblock == ACCURATE_BLOCK) {
+        _block_moments(acc->block, ACCURATE_BLOCK, &m);
+        _accurate_insert(acc, &m, 0);
+        acc->nblock = 0;
+    }
+}
+
+static void _sync_moments(dataset *ds)
+{
+    // In accurate mode, combine the levels and the current block into M1 to
+    // M4, from the smallest aggregates to the largest.
+    moments total = {0, 0, 0, 0, 0}, m;
+    size_t i;
+
+    if (!ds->accurate)
+        return;
+    for (i = 0; i < ACCURATE_LEVELS; i++)
+        _combine_moments(&total, &(ds->accurate->levels[i]));
+    if (ds->accurate->nblock > 0) {
+        _block_moments(ds->accurate->block, ds->accurate->nblock, &m);
+        _combine_moments(&total, &m);
+    }
+    _set_dataset_moments(ds, &total);
+}
+
+static size_t _resident(dataset *ds)
+{
+    // Number of values in the data array.
+    return ds->spill ? ds->n - ds->spill->n : ds->n;
+}
+
+static int _spill_data(dataset *ds, size_t n)
+{
+    // Move the first n values of the data array to a new run, which leaves
+    // the array free.
+    check(Spill_write(ds->spill, ds->data, n), "Could not spill data.");
+    return 1;
+
+error:
+    return 0;
+}
+
+static int _spill_store(dataset *ds, const double *values, size_t n)
+{
+    // Copy n values after those of the data array, spilling the array
+    // whenever it is full. ds->n is left for the caller to update.
+    size_t resident = _resident(ds), len;
+
+    while (n > 0) {
+        if (resident == ds->data_size) {
+            check(_spill_data(ds, resident), "Could not store data.");
+            resident = 0;
+        }
+        len = ds->data_size - resident < n ? ds->data_size - resident : n;
+        memcpy(ds->data + resident, values, len * sizeof(double));
+        resident += len;
+        values += len;
+        n -= len;
+    }
+    return 1;
+
+error:
+    return 0;
+}
+
+static inline void _count_value(dataset *ds, double datum, size_t w)
+{
+    // Feed datum, with weight w, to the sketches of distinct and frequent
+    // values, hashing it once for both.
+    uint64_t hash;
+
+    if (!ds->hll && !ds->topk)
+        return;
+    hash = hash_double(datum);
+    if (ds->hll)
+        HLL_add(ds->hll, hash);
+    if (ds->topk)
+        TopK_add(ds->topk, datum, hash, w);
 }
 
 int push(dataset *ds, double datum)
 {
     // Add a single data point to the dataset.
-    double delta, delta_n;
+    double delta, delta_n, delta_n2, term;
+    int added;
+
+    if (ds->weighted)
+        return push_weighted(ds, datum, 1);
 
     // Check if space is sufficient. If not, grow.
     if (ds->streaming) {
-        TDigest_add(&(ds->digest), datum, 1);
+        added = _sketch_add(ds, datum, 1);
+        check_debug(added != SKETCH_REJECTED, "Value rejected by sketch.");
+        check(added, "Could not add to sketch.");
+    } else if (ds->spill) {
+        // The data array has its full size from the start, spill it instead
+        // of growing it.
+        if (_resident(ds) == ds->data_size)
+            check(_spill_data(ds, ds->data_size), "Could not store data.");
+        ds->data[_resident(ds)] = datum;
+        // The quartiles are cached, since they take passes over the runs.
+        ds->has_q1 = ds->has_q2 = ds->has_q3 = false;
+        ds->sorted = false;
+        ds->nselects = 0;
     } else {
-        if (ds->n >= ds->data_size) {
-            ds->data_size = _grow_data(&(ds->data), ds->data_size);
-            check(ds->data_size != (size_t)-1, "Could not grow data.");
-        }
+        if (ds->n >= ds->data_size)
+            check(_grow_data(ds), "Could not grow data.");
         ds->data[ds->n] = datum;
+        ds->sorted = false;
+        ds->nselects = 0;
     }
+    _count_value(ds, datum, 1);
 
     // Check for minimum and maximum.
     if (ds->n > 0) {
@@ -55,14 +463,268 @@ int push(dataset *ds, double datum)
     }
 
     ds->n += 1;
+    if (ds->accurate) {
+        _accurate_add(ds->accurate, datum);
+        return 1;
+    }
 
     // Update running stats using the method in
     // http://www.johndcook.com/blog/skewness_kurtosis/
     delta = datum - ds->M1;
     delta_n = delta / ds->n;
+    delta_n2 = delta_n * delta_n;
+    term = delta * delta_n * (ds->n - 1);
     ds->M1 += delta_n;
-    ds->M2 += delta * delta_n * (ds->n - 1);
+    ds->M4 += term * delta_n2 * (ds->n * ds->n - 3.0 * ds->n + 3) +
+              6 * delta_n2 * ds->M2 - 4 * delta_n * ds->M3;
+    ds->M3 += term * delta_n * (ds->n - 2.0) - 3 * delta_n * ds->M2;
+    ds->M2 += term;
+
+    return 1;
+
+error:
+    return 0;
+}
+
+#ifdef HAVE_MREMAP
+static size_t _mapping_size(size_t n)
+{
+    // Size in bytes of the mapping that holds n values, a multiple of the
+    // page size.
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes = (n > 0 ? n : 1) * sizeof(double);
+
+    return (bytes + page - 1) / page * page;
+}
+#endif
+
+int _resize_data(dataset *ds, size_t n)
+{
+    // Resize the data array of ds to hold n values, keeping the first
+    // min(n, ds->n) of them.
+    //
+    // Large arrays are anonymous mappings resized with mremap, which moves
+    // pages instead of copying them, so that growing never needs the old and
+    // new arrays in memory at the same time. MAP_NORESERVE leaves the pages
+    // that are never written, such as those of an overestimated file size,
+    // uncommitted.
+    double *newdata;
+
+#ifdef HAVE_MREMAP
+    if (ds->data_mapped) {
+        newdata = mremap(ds->data, _mapping_size(ds->data_size),
+                         _mapping_size(n), MREMAP_MAYMOVE);
+        check_debug(newdata != MAP_FAILED, "Memory error");
+        ds->data = newdata;
+        ds->data_size = n;
+        return 1;
+    }
+    if (n * sizeof(double) >= DATA_MMAP_THRESHOLD) {
+        newdata = mmap(NULL, _mapping_size(n), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        check_debug(newdata != MAP_FAILED, "Memory error");
+#ifdef MADV_HUGEPAGE
+        // Fewer TLB misses during selection, which jumps all over the array.
+        madvise(newdata, _mapping_size(n), MADV_HUGEPAGE);
+#endif
+        if (ds->data) {
+            memcpy(newdata, ds->data, (ds->n < n ? ds->n : n) * sizeof(double));
+            free(ds->data);
+        }
+        ds->data = newdata;
+        ds->data_size = n;
+        ds->data_mapped = true;
+        return 1;
+    }
+#endif
+
+    newdata = (double*)realloc(ds->data, (n > 0 ? n : 1) * sizeof(double));
+    check_debug(newdata, "Memory error");
+    ds->data = newdata;
+    ds->data_size = n;
+    return 1;
+
+error:
+    return 0;
+}
+
+void _free_data(dataset *ds)
+{
+#ifdef HAVE_MREMAP
+    if (ds->data_mapped) {
+        munmap(ds->data, _mapping_size(ds->data_size));
+        ds->data = NULL;
+        ds->data_mapped = false;
+        return;
+    }
+#endif
+    free(ds->data);
+    ds->data = NULL;
+}
+
+size_t push_batch(dataset *ds, const double *values, size_t n)
+{
+    // Add n data points at once and return the number added. The moments of
+    // the batch are computed in one pass and combined with those of ds as in
+    // merge_datasets, and in exact mode the values are copied in one go after
+    // growing the array at most once, or spilling it as often as needed with
+    // a memory budget. Values rejected by the sketch are skipped.
+    size_t i, m = 0, total;
+    int added;
+    double bmean = 0, bM2 = 0, bM3 = 0, bM4 = 0, bmin = 0, bmax = 0;
+    double delta, delta_m, delta_m2, term;
+    moments batch, current;
+
+    if (n == 0)
+        return 0;
+    if (ds->weighted) {
+        for (i = 0; i < n; i++)
+            m += push_weighted(ds, values[i], 1);
+        return m;
+    }
+    if (ds->spill) {
+        check(_spill_store(ds, values, n), "Could not store data.");
+    } else if (!ds->streaming && ds->n + n > ds->data_size) {
+        total = ds->data_size * 2 > ds->n + n ? ds->data_size * 2 : ds->n + n;
+        check(_resize_data(ds, total), "Could not grow data.");
+        COUNTER_ADD(reallocs, 1);
+        COUNTER_ADD(realloc_bytes, ds->n * sizeof(double));
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ds->streaming) {
+            added = _sketch_add(ds, values[i], 1);
+            if (added == 0)
+                log_err("Could not add to sketch.");
+            if (added != 1)
+                continue;
+        }
+        _count_value(ds, values[i], 1);
+        if (m == 0) {
+            bmin = bmax = values[i];
+        } else if (values[i] < bmin) {
+            bmin = values[i];
+        } else if (values[i] > bmax) {
+            bmax = values[i];
+        }
+        m++;
+        if (ds->accurate) {
+            _accurate_add(ds->accurate, values[i]);
+            continue;
+        }
+        delta = values[i] - bmean;
+        delta_m = delta / m;
+        delta_m2 = delta_m * delta_m;
+        term = delta * delta_m * (m - 1);
+        bmean += delta_m;
+        bM4 += term * delta_m2 * ((double)m * m - 3.0 * m + 3) +
+               6 * delta_m2 * bM2 - 4 * delta_m * bM3;
+        bM3 += term * delta_m * (m - 2.0) - 3 * delta_m * bM2;
+        bM2 += term;
+    }
+    if (!ds->streaming && !ds->spill)
+        memcpy(ds->data + ds->n, values, n * sizeof(double));
+    if (!ds->streaming) {
+        ds->sorted = false;
+        ds->nselects = 0;
+    }
+    if (m == 0)
+        return 0;
+
+    if (ds->n == 0 || bmin < ds->min)
+        ds->min = bmin;
+    if (ds->n == 0 || bmax > ds->max)
+        ds->max = bmax;
+    if (!ds->accurate) {
+        batch = (moments){m, bmean, bM2, bM3, bM4};
+        _dataset_moments(ds, &current);
+        _combine_moments(&current, &batch);
+        _set_dataset_moments(ds, &current);
+    }
+    ds->n += m;
+    ds->has_q1 = false;
+    ds->has_q2 = false;
+    ds->has_q3 = false;
+    return m;
+
+error:
+    return 0;
+}
+
+static int _weighted_append(weighted_values *wv, const double *values,
+                            const size_t *weights, size_t n)
+{
+    // Append n values and their weights, doubling the arrays when full.
+    size_t allocated = wv->allocated > 0 ? wv->allocated : BASE_DATA_SIZE;
+    double *newvalues;
+    size_t *newweights;
+
+    while (allocated < wv->n + n)
+        allocated *= 2;
+    if (allocated > wv->allocated) {
+        newvalues = realloc(wv->values, allocated * sizeof(double));
+        check_mem(newvalues);
+        wv->values = newvalues;
+        newweights = realloc(wv->weights, allocated * sizeof(size_t));
+        check_mem(newweights);
+        wv->weights = newweights;
+        wv->allocated = allocated;
+        COUNTER_ADD(reallocs, 1);
+        COUNTER_ADD(realloc_bytes, wv->n * (sizeof(double) + sizeof(size_t)));
+    }
+    memcpy(wv->values + wv->n, values, n * sizeof(double));
+    memcpy(wv->weights + wv->n, weights, n * sizeof(size_t));
+    wv->n += n;
+    return 1;
+
+error:
+    return 0;
+}
+
+int push_weighted(dataset *ds, double datum, size_t w)
+{
+    // Add datum with weight w, as if it was pushed w times. Exact datasets
+    // keep the value and its weight, streaming ones add it to the sketch
+    // with its weight. The moments are updated by combining them with those
+    // of w copies of datum, which is Welford's update for weighted values.
+    // A weight of 0 leaves the dataset untouched.
+    moments point = {w, datum, 0, 0, 0}, current;
+    size_t nblocks, level = 0;
+    int added;
+
+    if (w == 0)
+        return 1;
+    if (ds->streaming) {
+        added = _sketch_add(ds, datum, w);
+        check_debug(added != SKETCH_REJECTED, "Value rejected by sketch.");
+        check(added, "Could not add to sketch.");
+    } else {
+        check(ds->weighted, "Weights need a weighted dataset.");
+        check(_weighted_append(ds->weighted, &datum, &w, 1),
+              "Could not store data.");
+    }
+    _count_value(ds, datum, w);
+
+    if (ds->n == 0 || datum < ds->min)
+        ds->min = datum;
+    if (ds->n == 0 || datum > ds->max)
+        ds->max = datum;
 
+    if (ds->accurate) {
+        // The moments of the w copies go to the level of their size, like
+        // those of a merged dataset.
+        for (nblocks = w / ACCURATE_BLOCK; nblocks > 1; nblocks /= 2)
+            level++;
+        _accurate_insert(ds->accurate, &point, level);
+    } else {
+        _dataset_moments(ds, &current);
+        _combine_moments(&current, &point);
+        _set_dataset_moments(ds, &current);
+    }
+    ds->n += w;
+    ds->has_q1 = false;
+    ds->has_q2 = false;
+    ds->has_q3 = false;
     return 1;
 
 error:
@@ -76,17 +738,65 @@ dataset* init_empty_dataset(size_t n)
     ds = (dataset*)calloc(1, sizeof(dataset));
     check_mem(ds);
 
-    ds->data = (double*)calloc(n, sizeof(double));
-    check_mem(ds->data);
-    ds->data_size = n;
+    check_mem(_resize_data(ds, n));
 
     return ds;
 
 error:
-    if (ds) {
-        if (ds->data) free(ds->data);
-        free(ds);
+    if (ds) free(ds);
+    return NULL;
+}
+
+dataset* create_empty_dataset(dataset_options *opts, size_t n)
+{
+    // Create an empty dataset configured by opts. In exact mode, room is
+    // reserved for n values, or for as many values as the memory budget
+    // allows if there is one.
+    dataset *ds = NULL;
+
+    if (opts->weighted && !opts->streaming) {
+        // The values and their weights go to their own arrays.
+        check(opts->mem == 0, "A memory budget can't be used with weights.");
+        ds = calloc(1, sizeof(dataset));
+        check_mem(ds);
+        ds->weighted = calloc(1, sizeof(weighted_values));
+        check_mem(ds->weighted);
+    } else if (opts->streaming && opts->sketch == SKETCH_NONE) {
+        // Nothing but the moments, not even a data array.
+        ds = calloc(1, sizeof(dataset));
+        check_mem(ds);
+        check(_init_sketch(ds, opts), "Could not create sketch.");
+    } else if (opts->streaming) {
+        ds = init_empty_dataset(1);
+        check_mem(ds);
+        check(_init_sketch(ds, opts), "Could not create sketch.");
+    } else if (opts->mem > 0) {
+        n = opts->mem / sizeof(double);
+        ds = init_empty_dataset(n > BASE_DATA_SIZE ? n : BASE_DATA_SIZE);
+        check_mem(ds);
+        ds->spill = Spill_create();
+        check_mem(ds->spill);
+    } else {
+        ds = init_empty_dataset(n > 0 ? n : BASE_DATA_SIZE);
+        check_mem(ds);
+    }
+    if (opts->accurate) {
+        ds->accurate = calloc(1, sizeof(accurate_sums));
+        check_mem(ds->accurate);
+    }
+    if (opts->distinct) {
+        ds->hll = HLL_create(HLL_DEFAULT_PRECISION);
+        check_mem(ds->hll);
     }
+    if (opts->topk > 0) {
+        n = opts->topk * TOPK_SLACK;
+        ds->topk = TopK_create(n > TOPK_MIN_CAPACITY ? n : TOPK_MIN_CAPACITY);
+        check_mem(ds->topk);
+    }
+    return ds;
+
+error:
+    if (ds) delete_dataset(ds);
     return NULL;
 }
 
@@ -114,78 +824,120 @@ error:
 void delete_dataset(dataset *ds)
 {
     check(ds, "Can't delete non existent dataset.");
-    if (ds->streaming) {
+    if (ds->digest)
         TDigest_destroy(ds->digest);
+    if (ds->kll)
+        KLL_destroy(ds->kll);
+    if (ds->ddsketch)
+        DDSketch_destroy(ds->ddsketch);
+    if (ds->hdr)
+        HdrHistogram_destroy(ds->hdr);
+    free(ds->accurate);
+    Spill_destroy(ds->spill);
+    HLL_destroy(ds->hll);
+    TopK_destroy(ds->topk);
+    if (ds->weighted) {
+        free(ds->weighted->values);
+        free(ds->weighted->weights);
+        free(ds->weighted);
     }
-    free(ds->data);
+    _free_data(ds);
     free(ds);
 
 error:
     return;
 }
 
-size_t _grow_data(double **data, size_t n)
+int _grow_data(dataset *ds)
 {
-    // Try to allocate more memory for a data array.
+    // Try to allocate more memory for the data array of ds.
     // First, try to double the size of the array. If that fails, increment the
     // size of the array by the greatest possible multiple of BASE_DATA_SIZE.
-    //
-    // NOTE: It is necessary to pass a pointer to the data pointer because C is
-    // pass by value. If only the data pointer is passed, the assignment
-    // data = newdata is only local to this function and the data pointer in
-    // the calling function is not changed. This will blow up because realloc
-    // frees the memory pointed to by data.
-    unsigned int ntry, max_tries;
-    size_t next_size = n * 2;
+    // The array is left untouched if every attempt fails.
+    size_t n = ds->data_size > BASE_DATA_SIZE ? ds->data_size : BASE_DATA_SIZE;
+    size_t ntry, max_tries;
+    int ok;
 
     ntry = max_tries = n / BASE_DATA_SIZE - 1;
 
-    double *newdata = (double*)realloc(*data, next_size * sizeof(double));
-    while (!newdata && ntry > 0) {
+    ok = _resize_data(ds, n * 2);
+    while (!ok && ntry > 0) {
         if (ntry == max_tries) {
             log_warn("The dataset is large and you are "
                      "running low on memory.");
         }
-        next_size = n + ntry * BASE_DATA_SIZE;
+        ok = _resize_data(ds, n + ntry * BASE_DATA_SIZE);
         ntry--;
-        newdata = (double*)realloc(*data, next_size * sizeof(double));
     }
-    check_debug(newdata, "Memory error");
-    *data = newdata;
-    return next_size;
+    check_debug(ok, "Memory error");
+    COUNTER_ADD(reallocs, 1);
+    COUNTER_ADD(realloc_bytes, ds->n * sizeof(double));
+    return 1;
 
 error:
-    if (newdata) free(newdata);
-    return (size_t)-1;
+    return 0;
 }
 
 dataset* read_data_file(char *filename, bool streaming)
+{
+    dataset_options opts;
+
+    default_options(&opts);
+    opts.streaming = streaming;
+    return read_data_file_opts(filename, &opts);
+}
+
+static int _parse_weight(char *s, size_t *w)
+{
+    // Parse the weight that follows a value, after blanks or a comma. It
+    // must be a non-negative integer, possibly written like 1e3.
+    char *endptr;
+    double x;
+
+    s += strspn(s, " \t");
+    if (*s == ',')
+        s++;
+    x = strtod(s, &endptr);
+    check_debug(endptr != s && x >= 0 && x < 1.8e19 && x == floor(x),
+                "Invalid weight.");
+    check_debug(endptr[strspn(endptr, " \t\r\n")] == '\0', "Invalid weight.");
+    *w = (size_t)x;
+    return 1;
+
+error:
+    return 0;
+}
+
+dataset* read_data_file_opts(char *filename, dataset_options *opts)
 {
     dataset *ds = NULL;
     char buffer[MAX_LINELENGTH];
     double datum;
-    FILE *fp;
+    Input *in = NULL;
     char *endptr;
+    size_t nlines = 0, nskipped = 0, nrejected = 0, w;
 
-    if (filename == NULL) {
-        fp = stdin;
-    } else {
-        fp = fopen(filename, "r");
-        // Make sure file was opened.
-        check(fp, "Failed to open %s.", filename);
-    }
+    // Input_open reads from stdin when filename is NULL and transparently
+    // decompresses gzip and zstd files.
+    in = Input_open(filename);
+    check(in, "Failed to read %s.", filename ? filename : "stdin");
 
-    // Start by creating an empty dataset of small size.
-    if (streaming) {
-        ds = init_empty_dataset(1);
-        ds->digest = TDigest_create(DEFAULT_DELTA, DEFAULT_K);
-        ds->streaming = true;
-    } else {
-        ds = init_empty_dataset(BASE_DATA_SIZE);
+    // Reserve room for the whole file up front when its size is known, so
+    // that the data array is not copied over and over while it grows. The
+    // margin covers a first block with longer lines than the rest of the
+    // file. Untouched pages of a large allocation are never committed, so
+    // overestimating only costs address space. If the reservation fails the
+    // array starts small and grows as usual.
+    size_t estimate = Input_estimate_lines(in);
+    ds = create_empty_dataset(opts, BASE_DATA_SIZE);
+    check(ds, "Could not create dataset.");
+    if (ds->data && !ds->streaming && !ds->spill && estimate > 0) {
+        _resize_data(ds, estimate + estimate / 8 + BASE_DATA_SIZE);
     }
-    check_mem(ds);
 
-    while(fgets(buffer, MAX_LINELENGTH, fp) != NULL) {
+    while(Input_gets(buffer, MAX_LINELENGTH, in) != NULL) {
+        nlines++;
+        errno = 0;
         datum = strtod(buffer, &endptr);
 
         if (errno == ERANGE) {
@@ -195,36 +947,232 @@ dataset* read_data_file(char *filename, bool streaming)
 
         if (endptr == buffer) {
             // No conversion was performed. Go to to next line.
+            nskipped++;
             continue;
         }
 
-        push(ds, datum);
+        if (opts->weighted) {
+            // A line with a value but no valid weight is rejected.
+            if (!_parse_weight(endptr, &w) || !push_weighted(ds, datum, w))
+                nrejected++;
+        } else if (!push(ds, datum)) {
+            nrejected++;
+        }
+    }
+
+    check(!Input_error(in), "Failed to read %s.", filename ? filename : "stdin");
+    if (nrejected > 0) {
+        log_warn("%zu values in %s could not be recorded.", nrejected,
+                 filename ? filename : "stdin");
     }
+    Input_close(in);
+    in = NULL;
 
-    if (filename)
-        fclose(fp);
+    COUNTER_ADD(lines_parsed, nlines);
+    COUNTER_ADD(lines_rejected, nskipped);
+    COUNTER_ADD(values_rejected, nrejected);
+    if (ds->digest)
+        COUNTER_MAX(peak_centroids, TDigest_get_ncentroids(ds->digest));
 
-    // Free the unused memory at the end of the data array.
-    size_t real_data_size = ds->n > ds->data_size ? ds->data_size : ds->n;
-    ds->data = (double*)realloc(ds->data, real_data_size * sizeof(double));
-    check_mem(ds->data);
-    ds->data_size = real_data_size;
+    // Free the unused memory at the end of the data array. With a memory
+    // budget, the array keeps its size for the values added later.
+    if (!ds->streaming && !ds->spill && ds->n < ds->data_size)
+        check_mem(_resize_data(ds, ds->n));
 
     return ds;
 
 error:
-    if (filename && fp) fclose(fp);
+    if (in) Input_close(in);
     if (ds) delete_dataset(ds);
     return NULL;
 }
 
+int merge_datasets(dataset *ds, dataset *other)
+{
+    // Merge the data points of other into ds. other is left untouched.
+    //
+    // The running moments are combined with _combine_moments, which gives
+    // the same result as pushing the data points of other one by one. In
+    // accurate mode, the moments of other are inserted in the summation tree
+    // at the level of their size.
+    size_t n, nblocks, level = 0;
+    moments current, added;
+
+    check(ds->streaming == other->streaming,
+          "Can't merge a streaming dataset with an exact one.");
+    check(!ds->streaming || ds->sketch == other->sketch,
+          "Can't merge datasets using different sketches.");
+    check(!ds->hll == !other->hll && !ds->topk == !other->topk,
+          "Can't merge datasets counting different values.");
+    check(!ds->weighted == !other->weighted,
+          "Can't merge a weighted dataset with an unweighted one.");
+    if (other->n == 0)
+        return 1;
+
+    if (ds->streaming) {
+        check(_sketch_merge(ds, other), "Could not merge sketches.");
+    } else if (ds->weighted) {
+        check(_weighted_append(ds->weighted, other->weighted->values,
+                               other->weighted->weights, other->weighted->n),
+              "Could not merge data.");
+    } else if (ds->spill) {
+        // The runs of other are shared rather than copied.
+        check(_spill_store(ds, other->data, _resident(other)),
+              "Could not merge data.");
+        if (other->spill)
+            check(Spill_merge(ds->spill, other->spill), "Could not merge data.");
+        ds->sorted = false;
+        ds->nselects = 0;
+    } else {
+        check(!other->spill, "Can't merge a spilled dataset into one without "
+              "a memory budget.");
+        n = ds->n + other->n;
+        if (n > ds->data_size) {
+            size_t new_size = ds->data_size * 2 > n ? ds->data_size * 2 : n;
+            check_mem(_resize_data(ds, new_size));
+            COUNTER_ADD(reallocs, 1);
+            COUNTER_ADD(realloc_bytes, ds->n * sizeof(double));
+        }
+        memcpy(ds->data + ds->n, other->data, other->n * sizeof(double));
+        ds->sorted = false;
+        ds->nselects = 0;
+    }
+    if (ds->hll)
+        check(HLL_merge(ds->hll, other->hll), "Could not merge distinct counts.");
+    if (ds->topk)
+        check(TopK_merge(ds->topk, other->topk), "Could not merge top values.");
+
+    if (ds->n == 0) {
+        ds->min = other->min;
+        ds->max = other->max;
+    } else {
+        if (other->min < ds->min)
+            ds->min = other->min;
+        if (other->max > ds->max)
+            ds->max = other->max;
+    }
+
+    _sync_moments(other);
+    _dataset_moments(other, &added);
+    if (ds->accurate) {
+        for (nblocks = other->n / ACCURATE_BLOCK; nblocks > 1; nblocks /= 2)
+            level++;
+        _accurate_insert(ds->accurate, &added, level);
+    } else {
+        _dataset_moments(ds, &current);
+        _combine_moments(&current, &added);
+        _set_dataset_moments(ds, &current);
+    }
+    ds->n += other->n;
+    ds->has_q1 = false;
+    ds->has_q2 = false;
+    ds->has_q3 = false;
+
+    return 1;
+
+error:
+    return 0;
+}
+
+typedef struct file_queue {
+    char **filenames;
+    size_t nfiles;
+    size_t next;
+    dataset_options *opts;
+    bool failed;
+    dataset **results;
+    pthread_mutex_t lock;
+} file_queue;
+
+void *_read_worker(void *arg)
+{
+    // Read files from the queue until it is empty.
+    file_queue *queue = (file_queue*)arg;
+    size_t i;
+    char *filename;
+
+    while (true) {
+        pthread_mutex_lock(&(queue->lock));
+        i = queue->next++;
+        pthread_mutex_unlock(&(queue->lock));
+        if (i >= queue->nfiles)
+            break;
+
+        filename = queue->filenames[i];
+        if (strcmp(filename, "-") == 0)
+            filename = NULL;
+        queue->results[i] = read_data_file_opts(filename, queue->opts);
+        if (!queue->results[i]) {
+            pthread_mutex_lock(&(queue->lock));
+            queue->failed = true;
+            pthread_mutex_unlock(&(queue->lock));
+        }
+    }
+    return NULL;
+}
+
+int read_data_files(char **filenames, size_t nfiles, dataset_options *opts,
+                    int nthreads, dataset **results)
+{
+    // Read several files concurrently using a pool of nthreads threads. The
+    // dataset for filenames[i] is stored in results[i]. A filename of "-"
+    // stands for standard input. Returns 1 on success and 0 if any file could
+    // not be read, in which case results may be partially filled.
+    file_queue queue;
+    pthread_t *threads = NULL;
+    int i, nstarted = 0;
+
+    queue.filenames = filenames;
+    queue.nfiles = nfiles;
+    queue.next = 0;
+    queue.opts = opts;
+    queue.failed = false;
+    queue.results = results;
+    memset(results, 0, nfiles * sizeof(dataset*));
+    pthread_mutex_init(&(queue.lock), NULL);
+
+    if (nthreads < 1)
+        nthreads = 1;
+    if ((size_t)nthreads > nfiles)
+        nthreads = nfiles;
+
+    threads = (pthread_t*)calloc(nthreads, sizeof(pthread_t));
+    check_mem(threads);
+    for (i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, _read_worker, &queue) != 0) {
+            log_warn("Could not start reader thread, using fewer threads.");
+            break;
+        }
+        nstarted++;
+    }
+    // The calling thread takes part in the work.
+    _read_worker(&queue);
+    for (i = 1; i <= nstarted; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    pthread_mutex_destroy(&(queue.lock));
+    return !queue.failed;
+
+error:
+    pthread_mutex_destroy(&(queue.lock));
+    return 0;
+}
+
 double mean(dataset *ds)
 {
+    if (ds->n == 0)
+        return NAN;
+    _sync_moments(ds);
     return ds->M1;
 }
 
 double var(dataset *ds)
 {
+    if (ds->n == 0)
+        return NAN;
+    _sync_moments(ds);
     return ds->M2 / (ds->n - 1.0);
 }
 
@@ -233,33 +1181,363 @@ double sd(dataset *ds)
     return sqrt(var(ds));
 }
 
+double skewness(dataset *ds)
+{
+    // Sample skewness g1 = m3 / m2^(3/2), where mk are the central moments.
+    _sync_moments(ds);
+    return sqrt((double)ds->n) * ds->M3 / pow(ds->M2, 1.5);
+}
+
+double kurtosis(dataset *ds)
+{
+    // Sample excess kurtosis g2 = m4 / m2^2 - 3, 0 for a normal distribution.
+    _sync_moments(ds);
+    return ds->n * ds->M4 / (ds->M2 * ds->M2) - 3.0;
+}
+
+static bool _spilled(dataset *ds)
+{
+    return ds->spill && ds->spill->n > 0;
+}
+
+// Search for the value of a given rank among the keys in [lo, hi]. Searches
+// for ranks in the same range, such as the two neighbours of a percentile,
+// share the histogram and candidates of the first of them.
+typedef struct rank_search {
+    size_t rank;
+    uint64_t lo;
+    uint64_t hi;
+    // Number of values with a key below lo, and in [lo, hi].
+    size_t below;
+    size_t count;
+    struct rank_search *owner;
+    // Histogram of the keys in [lo, hi], bucket i counting the keys of
+    // lo + (i << shift) to lo + ((i + 1) << shift) - 1.
+    unsigned shift;
+    size_t *counts;
+    double *values;
+    size_t nvalues;
+    double result;
+    bool done;
+} rank_search;
+
+typedef struct external_select {
+    rank_search *searches;
+    size_t nsearches;
+    // Copy the candidates instead of counting them.
+    bool collect;
+} external_select;
+
+static int _external_visit(void *ctx, const double *values, size_t n)
+{
+    // Count or copy the values of a block that fall in the range of each
+    // active search.
+    external_select *sel = (external_select*)ctx;
+    rank_search *r;
+    uint64_t key;
+    size_t i, j;
+
+    for (j = 0; j < sel->nsearches; j++) {
+        r = &(sel->searches[j]);
+        if (r->done || r->owner != r)
+            continue;
+        for (i = 0; i < n; i++) {
+            key = order_key(values[i]);
+            if (key < r->lo || key > r->hi)
+                continue;
+            if (sel->collect)
+                r->values[r->nvalues++] = values[i];
+            else
+                r->counts[(key - r->lo) >> r->shift]++;
+        }
+    }
+    return 1;
+}
+
+static int _external_select(dataset *ds, const size_t *ranks, double *results,
+                            size_t nranks)
+{
+    // Find the values of the given ranks, 0 being the smallest, in a spilled
+    // dataset, reading the runs sequentially.
+    //
+    // Each pass builds a histogram of the values of the range that holds a
+    // rank, and narrows the range down to the bucket of the rank. As soon
+    // as the candidates of every rank fit in the data array, a last pass
+    // copies them there and the ranks are found with _select. Values are
+    // bucketed by order_key, whose 64 bits are divided by SPILL_BUCKETS in
+    // each pass, so that there are at most four histogram passes even when
+    // many values are equal.
+    rank_search searches[SPILL_MAX_RANKS], *r, *o;
+    external_select sel = {searches, nranks, false};
+    size_t i, j, b, nbuckets, total, active, offset;
+    uint64_t start;
+    int ok = 0;
+
+    check(nranks <= SPILL_MAX_RANKS, "Too many ranks.");
+    memset(searches, 0, sizeof(searches));
+    for (i = 0; i < nranks; i++) {
+        searches[i].rank = ranks[i];
+        searches[i].lo = order_key(ds->min);
+        searches[i].hi = order_key(ds->max);
+        searches[i].count = ds->n;
+    }
+    // The data array is the buffer of the candidates, so its values go to a
+    // run first.
+    check(_spill_data(ds, _resident(ds)), "Could not select.");
+
+    while (true) {
+        total = active = 0;
+        for (i = 0; i < nranks; i++) {
+            r = &searches[i];
+            if (r->done)
+                continue;
+            if (r->lo == r->hi) {
+                r->result = key_value(r->lo);
+                r->done = true;
+                continue;
+            }
+            r->owner = r;
+            for (j = 0; j < i; j++) {
+                o = &searches[j];
+                if (!o->done && o->owner == o && o->lo == r->lo &&
+                    o->hi == r->hi) {
+                    r->owner = o;
+                    break;
+                }
+            }
+            if (r->owner == r)
+                total += r->count;
+            active++;
+        }
+        if (active == 0)
+            break;
+
+        if (total <= ds->data_size) {
+            offset = 0;
+            for (i = 0; i < nranks; i++) {
+                r = &searches[i];
+                if (!r->done && r->owner == r) {
+                    r->values = ds->data + offset;
+                    r->nvalues = 0;
+                    offset += r->count;
+                }
+            }
+            sel.collect = true;
+            check(Spill_scan(ds->spill, _external_visit, &sel),
+                  "Could not select.");
+            for (i = 0; i < nranks; i++) {
+                r = &searches[i];
+                if (r->done)
+                    continue;
+                o = r->owner;
+                check(o->nvalues == o->count, "Spilled data changed.");
+                r->result = _select(o->values, o->count, r->rank - r->below);
+                r->done = true;
+            }
+            break;
+        }
+
+        for (i = 0; i < nranks; i++) {
+            r = &searches[i];
+            if (r->done || r->owner != r)
+                continue;
+            if (!r->counts) {
+                r->counts = malloc(SPILL_BUCKETS * sizeof(size_t));
+                check_mem(r->counts);
+            }
+            for (r->shift = 0; ((r->hi - r->lo) >> r->shift) >= SPILL_BUCKETS;
+                 r->shift++)
+                ;
+            memset(r->counts, 0, SPILL_BUCKETS * sizeof(size_t));
+        }
+        sel.collect = false;
+        check(Spill_scan(ds->spill, _external_visit, &sel), "Could not select.");
+
+        // Searches are updated from the last, since they read the range of
+        // their owner, which comes before them.
+        for (i = nranks; i-- > 0;) {
+            r = &searches[i];
+            if (r->done)
+                continue;
+            o = r->owner;
+            nbuckets = ((o->hi - o->lo) >> o->shift) + 1;
+            for (b = 0; b < nbuckets && r->below + o->counts[b] <= r->rank; b++)
+                r->below += o->counts[b];
+            check(b < nbuckets, "Spilled data changed.");
+            start = o->lo + ((uint64_t)b << o->shift);
+            r->count = o->counts[b];
+            r->hi = start + ((o->hi - start) < (UINT64_C(1) << o->shift) - 1 ?
+                             (o->hi - start) : (UINT64_C(1) << o->shift) - 1);
+            r->lo = start;
+        }
+    }
+
+    for (i = 0; i < nranks; i++)
+        results[i] = searches[i].result;
+    ok = 1;
+
+error:
+    for (i = 0; i < nranks; i++)
+        free(searches[i].counts);
+    return ok;
+}
+
+static void _percentile_ranks(size_t n, double q, size_t *ranks,
+                              double *weight_above)
+{
+    // Ranks of the two values around the qth percentile of n values, and
+    // the weight of the second one.
+    double index = q * (n - 1) / 100.0;
+
+    ranks[0] = (size_t)index;
+    ranks[1] = ranks[0] + 1;
+    if (ranks[1] > n - 1) {
+        ranks[1] = n - 1;
+    }
+    *weight_above = index - ranks[0];
+}
+
+static int _external_quartiles(dataset *ds)
+{
+    // Compute the quartiles of a spilled dataset in the same passes over the
+    // runs, rather than reading them again for each quartile.
+    size_t n = ds->n, ranks[6];
+    double values[6], w1, w3;
+
+    _percentile_ranks(n, 25.0, ranks, &w1);
+    ranks[2] = n % 2 == 0 ? n / 2 - 1 : n / 2;
+    ranks[3] = n / 2;
+    _percentile_ranks(n, 75.0, ranks + 4, &w3);
+    check(_external_select(ds, ranks, values, 6),
+          "Could not compute the quartiles.");
+
+    ds->q1 = values[0] * (1 - w1) + values[1] * w1;
+    ds->q2 = values[2] + 0.5 * (values[3] - values[2]);
+    ds->q3 = values[4] * (1 - w3) + values[5] * w3;
+    ds->has_q1 = ds->has_q2 = ds->has_q3 = true;
+    return 1;
+
+error:
+    return 0;
+}
+
+static double _weighted_select(double *values, size_t *weights, size_t n,
+                               size_t k)
+{
+    // Value of rank k, 0 being the smallest, of n values repeated by their
+    // weights, which must add up to more than k. Like _select, the range of
+    // the rank is narrowed down by partitioning around a median of three,
+    // here in three parts whose weights are summed, so that runs of equal
+    // values end the search at once.
+    size_t lo = 0, hi = n, lt, gt, i, below, equal, wtmp;
+    double pivot, a, b, c, tmp;
+
+    check_debug(n > 0, "Can't select from empty dataset.");
+    while (hi - lo > 1) {
+        a = values[lo];
+        b = values[lo + (hi - lo) / 2];
+        c = values[hi - 1];
+        pivot = a < b ? (b < c ? b : (a < c ? c : a)) :
+                        (a < c ? a : (b < c ? c : b));
+        // [lo, lt) is below the pivot, [lt, i) equal and [gt, hi) above.
+        lt = i = lo;
+        gt = hi;
+        below = equal = 0;
+        while (i < gt) {
+            if (values[i] < pivot) {
+                below += weights[i];
+                SWAP(values[i], values[lt]);
+                SWAP_WEIGHTS(weights[i], weights[lt]);
+                lt++;
+                i++;
+            } else if (values[i] > pivot) {
+                gt--;
+                SWAP(values[i], values[gt]);
+                SWAP_WEIGHTS(weights[i], weights[gt]);
+            } else {
+                equal += weights[i];
+                i++;
+            }
+        }
+        if (k < below) {
+            hi = lt;
+        } else if (k < below + equal) {
+            return pivot;
+        } else {
+            k -= below + equal;
+            lo = gt;
+        }
+    }
+    return values[lo];
+
+error:
+    return NAN;
+}
+
+static double _rank_value(dataset *ds, size_t k)
+{
+    // Value of rank k, 0 being the smallest, in the data array. Each
+    // selection costs a pass or two over the array, so after
+    // SORT_AFTER_SELECTS of them the array is sorted once and the next
+    // ranks are read directly. If the sort buffer can't be allocated,
+    // selection goes on.
+    if (ds->weighted)
+        return _weighted_select(ds->weighted->values, ds->weighted->weights,
+                                ds->weighted->n, k);
+    if (!ds->sorted && ++ds->nselects > SORT_AFTER_SELECTS) {
+        if (radix_sort(ds->data, ds->n, (int)sysconf(_SC_NPROCESSORS_ONLN))) {
+            ds->sorted = true;
+            COUNTER_ADD(sorts, 1);
+        } else {
+            ds->nselects = 0;
+        }
+    }
+    if (ds->sorted)
+        return ds->data[k];
+    return _select(ds->data, ds->n, k);
+}
+
 double median(dataset *ds)
 {
     // Compute the median using selection. This could be done using the
     // percentile function, but here we only perform one select call for arrays
     // of odd length.
     if (ds->streaming)
-        return TDigest_percentile(ds->digest, 0.5);
+        return _sketch_percentile(ds, 0.5);
+    if (_spilled(ds)) {
+        if (!ds->has_q2)
+            check(_external_quartiles(ds), "Could not compute the median.");
+        return ds->q2;
+    }
     double high, low;
-    size_t data_size = ds->data_size;
+    size_t data_size = ds->n;
 
-    high = _select(ds->data, data_size, data_size / 2);
+    high = _rank_value(ds, data_size / 2);
     if (data_size % 2 == 0) {
         // Use slightly convoluted formula to avoid overflow.
-        low = _select(ds->data, data_size, data_size / 2 - 1);
+        low = _rank_value(ds, data_size / 2 - 1);
         return low + 0.5 * (high - low);
     } else {
         return high;
     }
+
+error:
+#ifdef NAN
+    return NAN;
+#else
+    return 0;
+#endif
 }
 
 double first_quartile(dataset *ds)
 {
     // Compute the first quartile using selection.
     if (ds->streaming)
-        return TDigest_percentile(ds->digest, 0.25);
+        return _sketch_percentile(ds, 0.25);
     if (ds->has_q1)
         return ds->q1;
+    if (_spilled(ds) && _external_quartiles(ds))
+        return ds->q1;
     ds->q1 = percentile(ds, 25.0);
     ds->has_q1 = true;
     return ds->q1;
@@ -270,9 +1548,11 @@ double third_quartile(dataset *ds)
 {
     // Compute the third quartile using selection.
     if (ds->streaming)
-        return TDigest_percentile(ds->digest, 0.75);
+        return _sketch_percentile(ds, 0.75);
     if (ds->has_q3)
         return ds->q3;
+    if (_spilled(ds) && _external_quartiles(ds))
+        return ds->q3;
     ds->q3 = percentile(ds, 75.0);
     ds->has_q3 = true;
     return ds->q3;
@@ -286,21 +1566,22 @@ double percentile(dataset *ds, double q)
     // Inspired by the implementation in Numpy
     // http://github.com/numpy/numpy/blob/v1.9.1/numpy/lib/function_base.py#L2947
     if (ds->streaming)
-        return TDigest_percentile(ds->digest, q / 100.0);
-    size_t data_size = ds->data_size;
+        return _sketch_percentile(ds, q / 100.0);
+    size_t data_size = ds->n;
     check_debug(data_size > 1, "Can't compute percentile dataset with less than 2 elements.");
-    double index = q * (data_size - 1) / 100.0;
-    double weight_above, low, high;
-    size_t index_below = (size_t)index;
-    size_t index_above = index_below + 1;
+    double weight_above, low, high, values[2];
+    size_t ranks[2];
 
-    if (index_above > data_size - 1) {
-        index_above = data_size - 1;
+    _percentile_ranks(data_size, q, ranks, &weight_above);
+    if (_spilled(ds)) {
+        check(_external_select(ds, ranks, values, 2),
+              "Could not compute percentile.");
+        low = values[0];
+        high = values[1];
+    } else {
+        low = _rank_value(ds, ranks[0]);
+        high = _rank_value(ds, ranks[1]);
     }
-
-    weight_above = index - index_below;
-    low = _select(ds->data, data_size, index_below);
-    high = _select(ds->data, data_size, index_above);
     return low * (1 - weight_above) + high * weight_above;
 
 error:
@@ -311,6 +1592,164 @@ error:
 #endif
 }
 
+// Bins of a histogram, of equal width on a linear or a log scale.
+typedef struct binning {
+    double lo;
+    double scale;
+    double last;
+    bool log_bins;
+    const double *edges;
+    size_t *counts;
+} binning;
+
+static size_t _bin_fix(binning *b, double x, size_t i)
+{
+    // Move x to the previous or next bin if rounding put it on the wrong
+    // side of an edge.
+    if (i > 0 && x < b->edges[i])
+        return i - 1;
+    if (i < b->last && x >= b->edges[i + 1])
+        return i + 1;
+    return i;
+}
+
+static size_t _bin_index(binning *b, double x)
+{
+    // Bin of x. NaNs and values below the first bin go to the first one,
+    // values above the last bin to the last one.
+    double f = ((b->log_bins ? log(x) : x) - b->lo) * b->scale;
+
+    f = f > 0 ? f : 0;
+    return _bin_fix(b, x, (size_t)(f < b->last ? f : b->last));
+}
+
+static void _bin_values(binning *b, const double *values, size_t n)
+{
+    // Count n values in their bins. The bins of a block of values are
+    // computed first, by a loop without branches that the compiler
+    // vectorizes, and counted afterwards.
+    int32_t bins[BIN_BLOCK];
+    double x[BIN_BLOCK], f;
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = n - i < BIN_BLOCK ? n - i : BIN_BLOCK;
+        if (b->log_bins) {
+            for (j = 0; j < len; j++)
+                x[j] = log(values[i + j]);
+        } else {
+            memcpy(x, values + i, len * sizeof(double));
+        }
+        for (j = 0; j < len; j++) {
+            f = (x[j] - b->lo) * b->scale;
+            f = f > 0 ? f : 0;
+            f = f < b->last ? f : b->last;
+            bins[j] = (int32_t)f;
+        }
+        for (j = 0; j < len; j++)
+            b->counts[_bin_fix(b, values[i + j], bins[j])]++;
+    }
+}
+
+static int _bin_visit(void *ctx, const double *values, size_t n)
+{
+    _bin_values((binning*)ctx, values, n);
+    return 1;
+}
+
+static void _bin_sorted(binning *b, const double *values, size_t n,
+                        size_t nbins)
+{
+    // Count sorted values in their bins by looking for the first value of
+    // each bin, using the same bin function as _bin_values.
+    size_t i, lo, hi, mid, start = 0;
+
+    for (i = 1; i < nbins; i++) {
+        lo = start;
+        hi = n;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (_bin_index(b, values[mid]) >= i)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        b->counts[i - 1] = lo - start;
+        start = lo;
+    }
+    b->counts[nbins - 1] = n - start;
+}
+
+int histogram(dataset *ds, size_t nbins, bool log_bins, double *edges,
+              double *counts)
+{
+    // Count the values in nbins bins of equal width between the minimum and
+    // the maximum, on a log scale if log_bins is set, which needs positive
+    // values. edges receives the nbins + 1 edges of the bins. Bin i holds
+    // the values in [edges[i], edges[i + 1]), and the last bin the maximum
+    // as well.
+    //
+    // The exact counts take a single pass over the data, or a binary search
+    // per bin if it is sorted. In streaming mode, the counts are the
+    // differences of the CDF of the sketch at the edges.
+    binning b;
+    double lo, hi, width, prev = 0, cum;
+    size_t i;
+
+    b.counts = NULL;
+    check(nbins > 0 && nbins <= HIST_MAX_BINS, "Invalid number of bins.");
+    check(ds->n > 0, "Can't compute the histogram of an empty dataset.");
+    check(!ds->streaming || ds->sketch != SKETCH_NONE,
+          "Can't compute the histogram without the values.");
+    check(!log_bins || ds->min > 0, "Log bins need positive values.");
+
+    lo = log_bins ? log(ds->min) : ds->min;
+    hi = log_bins ? log(ds->max) : ds->max;
+    width = (hi - lo) / nbins;
+    for (i = 0; i <= nbins; i++)
+        edges[i] = log_bins ? exp(lo + i * width) : lo + i * width;
+    edges[0] = ds->min;
+    edges[nbins] = ds->max;
+
+    if (ds->streaming) {
+        for (i = 0; i < nbins; i++) {
+            cum = i == nbins - 1 ? 1 : _sketch_cdf(ds, edges[i + 1]);
+            cum = cum > prev ? cum : prev;
+            counts[i] = (cum - prev) * ds->n;
+            prev = cum;
+        }
+        return 1;
+    }
+
+    b.lo = lo;
+    b.scale = width > 0 ? 1 / width : 0;
+    b.last = nbins - 1;
+    b.log_bins = log_bins;
+    b.edges = edges;
+    b.counts = calloc(nbins, sizeof(size_t));
+    check_mem(b.counts);
+    if (ds->weighted) {
+        for (i = 0; i < ds->weighted->n; i++)
+            b.counts[_bin_index(&b, ds->weighted->values[i])] +=
+                ds->weighted->weights[i];
+    } else if (ds->sorted && !_spilled(ds)) {
+        _bin_sorted(&b, ds->data, ds->n, nbins);
+    } else {
+        _bin_values(&b, ds->data, _resident(ds));
+        if (_spilled(ds))
+            check(Spill_scan(ds->spill, _bin_visit, &b),
+                  "Could not read spilled data.");
+    }
+    for (i = 0; i < nbins; i++)
+        counts[i] = b.counts[i];
+    free(b.counts);
+    return 1;
+
+error:
+    free(b.counts);
+    return 0;
+}
+
 double interquartile_range(dataset *ds)
 {
     // The interquartile range is the distance between the first and the third
@@ -321,15 +1760,38 @@ double interquartile_range(dataset *ds)
 double min(dataset *ds)
 {
     // Find the minimum in the array.
+    if (ds->n == 0)
+        return NAN;
     return ds->min;
 }
 
 double max(dataset *ds)
 {
     // Find the maximum in the array.
+    if (ds->n == 0)
+        return NAN;
     return ds->max;
 }
 
+double distinct_count(dataset *ds)
+{
+    // Estimated number of distinct values, NAN unless the dataset was
+    // created with the distinct option.
+    if (!ds->hll)
+        return NAN;
+    return HLL_count(ds->hll);
+}
+
+size_t top_values(dataset *ds, TopKItem *items, size_t k)
+{
+    // Store the k most frequent values in items, by decreasing count, and
+    // return their number. Their counts are exact as long as the dataset
+    // has fewer distinct values than the sketch has counters.
+    if (!ds->topk)
+        return 0;
+    return TopK_top(ds->topk, items, k);
+}
+
 double _select(double *list, size_t n, size_t k)
 {
     // Given a list of size n, find the kth smallest value in the list.
@@ -338,6 +1800,9 @@ double _select(double *list, size_t n, size_t k)
     size_t i, j;
     size_t left, mid, right;
     double a, tmp;
+#ifdef DESC_COUNTERS
+    size_t npasses = 0, ntouched = 0;
+#endif
 
     check_debug(n > 0, "Can't select from empty dataset.");
     left = 0;
@@ -347,8 +1812,15 @@ double _select(double *list, size_t n, size_t k)
             if (right == left + 1 && list[right] < list[left]) {
                 SWAP(list[left], list[right]);
             }
+            COUNTER_ADD(select_calls, 1);
+            COUNTER_ADD(select_passes, npasses);
+            COUNTER_ADD(select_touched, ntouched);
             return list[k];
         } else {
+#ifdef DESC_COUNTERS
+            npasses++;
+            ntouched += right - left + 1;
+#endif
             mid = left + (right - left) / 2;
             SWAP(list[mid], list[left + 1]);
             if (list[left] > list[right]) {
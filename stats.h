@@ -3,35 +3,159 @@
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include "ddsketch.h"
+#include "hdr.h"
+#include "hll.h"
+#include "kll.h"
+#include "spill.h"
 #include "tdigest.h"
+#include "topk.h"
+
+// Approximate quantile engines available in streaming mode.
+typedef enum sketch_type {
+    SKETCH_TDIGEST,
+    SKETCH_KLL,
+    SKETCH_DDSKETCH,
+    SKETCH_HDR,
+    // No engine: the values are not kept, only the count, the extremes and
+    // the moments are computed, in constant memory. Percentiles are NAN.
+    SKETCH_NONE
+} sketch_type;
+
+// Values per block and number of levels of the pairwise summation tree of the
+// accurate mode.
+#define ACCURATE_BLOCK 256
+#define ACCURATE_LEVELS 64
+
+// Largest number of bins of a histogram.
+#define HIST_MAX_BINS (1 << 24)
+
+typedef struct dataset_options {
+    bool streaming;
+    // Compute the moments by blocked pairwise summation instead of Welford's
+    // update, see accurate_sums.
+    bool accurate;
+    sketch_type sketch;
+    int hdr_digits;
+    // t-digest compression parameters, 0 to use the defaults.
+    double delta;
+    size_t max_centroids;
+    // Memory budget of the sketch in bytes, 0 for no budget. It chooses the
+    // parameters of the t-digest and KLL engines that are not set explicitly.
+    size_t sketch_mem;
+    // Memory budget of the data array in bytes in exact mode, 0 for no
+    // budget. The values that don't fit are spilled to temporary files, see
+    // spill.h, and the percentiles are found by external selection.
+    size_t mem;
+    // Also estimate the number of distinct values with a HyperLogLog, and
+    // track the topk most frequent values with Space-Saving, 0 for none.
+    bool distinct;
+    size_t topk;
+    // Each value comes with a weight, the number of times it occurs, see
+    // push_weighted. Can't be used with a memory budget.
+    bool weighted;
+} dataset_options;
+
+// Count, mean and sums of the 2nd, 3rd and 4th powers of the deviations from
+// the mean of a set of values.
+typedef struct moments {
+    double n;
+    double M1;
+    double M2;
+    double M3;
+    double M4;
+} moments;
+
+// State of the accurate mode. Values are buffered into blocks whose moments
+// are computed in two passes, and the moments of the blocks are combined
+// pairwise like the digits of a binary counter: levels[i] holds 2^i blocks,
+// or is empty if its count is 0. The rounding error then grows with the log
+// of the number of values instead of linearly.
+typedef struct accurate_sums {
+    double block[ACCURATE_BLOCK];
+    size_t nblock;
+    moments levels[ACCURATE_LEVELS];
+} accurate_sums;
+
+// Values of a weighted dataset in exact mode, each with its weight, a
+// positive count. Their percentiles are those of the values repeated by
+// their weights, found by a selection that sums the weights.
+typedef struct weighted_values {
+    double *values;
+    size_t *weights;
+    size_t n;
+    size_t allocated;
+} weighted_values;
 
 typedef struct dataset {
     double *data;
     TDigest *digest;
+    KLL *kll;
+    DDSketch *ddsketch;
+    HdrHistogram *hdr;
+    sketch_type sketch;
     size_t data_size;
     size_t n;
     double q1;
+    double q2;
     double q3;
     double M1;
     double M2;
+    double M3;
+    double M4;
     double min;
     double max;
     bool has_q1;
+    bool has_q2;
     bool has_q3;
     bool streaming;
+    // The data array is an anonymous mapping rather than a malloc'd block.
+    bool data_mapped;
+    // The data array is sorted, and the number of selections made in it
+    // since it last changed, see SORT_AFTER_SELECTS.
+    bool sorted;
+    size_t nselects;
+    // Set in accurate mode, where M1 to M4 are only brought up to date by the
+    // functions that read them.
+    accurate_sums *accurate;
+    // Set when the dataset has a memory budget. The data array then holds
+    // the values that were not spilled yet, ds->n - spill->n of them.
+    Spill *spill;
+    // Optional sketches of the distinct and most frequent values, fed with
+    // the hash of every value in both modes.
+    HLL *hll;
+    TopK *topk;
+    // Set for weighted datasets in exact mode, which have no data array.
+    // ds->n is then the sum of the weights.
+    weighted_values *weighted;
 } dataset;
 
+void default_options(dataset_options *opts);
 dataset* create_dataset(double *array, size_t n);
+dataset* create_empty_dataset(dataset_options *opts, size_t n);
+int push(dataset *ds, double datum);
+size_t push_batch(dataset *ds, const double *values, size_t n);
+int push_weighted(dataset *ds, double datum, size_t w);
 dataset* read_data_file(char *filename, bool streaming);
+dataset* read_data_file_opts(char *filename, dataset_options *opts);
+int read_data_files(char **filenames, size_t nfiles, dataset_options *opts,
+                    int nthreads, dataset **results);
+int merge_datasets(dataset *ds, dataset *other);
 void delete_dataset(dataset *ds);
 double mean(dataset *ds);
 double var(dataset *ds);
 double sd(dataset *ds);
+double skewness(dataset *ds);
+double kurtosis(dataset *ds);
 double median(dataset *ds);
 double percentile(dataset *ds, double q);
 double first_quartile(dataset *ds);
 double third_quartile(dataset *ds);
 double interquartile_range(dataset *ds);
+double distinct_count(dataset *ds);
+size_t top_values(dataset *ds, TopKItem *items, size_t k);
+int histogram(dataset *ds, size_t nbins, bool log_bins, double *edges,
+              double *counts);
 double min(dataset *ds);
 double max(dataset *ds);
 double timeit(double (*datafunc)(dataset *), dataset *ds, int n);
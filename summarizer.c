@@ -0,0 +1,267 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbg.h"
+#include "serialize.h"
+#include "stats.h"
+#include "summarizer.h"
+
+#define SUMMARIZER_MAGIC "DESC"
+#define BYTE_ORDER_MARK 0x01020304U
+
+struct Summarizer {
+    dataset *ds;
+    summarizer_mode mode;
+};
+
+static void Summarizer_options(summarizer_mode mode, dataset_options *opts)
+{
+    default_options(opts);
+    opts->streaming = mode != SUMMARIZER_EXACT;
+    switch (mode) {
+    case SUMMARIZER_KLL:
+        opts->sketch = SKETCH_KLL;
+        break;
+    case SUMMARIZER_DDSKETCH:
+        opts->sketch = SKETCH_DDSKETCH;
+        break;
+    case SUMMARIZER_HDR:
+        opts->sketch = SKETCH_HDR;
+        break;
+    default:
+        opts->sketch = SKETCH_TDIGEST;
+    }
+}
+
+Summarizer *Summarizer_create(summarizer_mode mode)
+{
+    // Create an empty summarizer. SUMMARIZER_EXACT keeps all the values to
+    // compute exact percentiles, the other modes use the approximate engine
+    // of the same name with its default parameters.
+    Summarizer *s = NULL;
+    dataset_options opts;
+
+    check(mode >= SUMMARIZER_EXACT && mode <= SUMMARIZER_HDR,
+          "Unknown summarizer mode %d.", (int)mode);
+    s = calloc(1, sizeof(Summarizer));
+    check_mem(s);
+    Summarizer_options(mode, &opts);
+    s->mode = mode;
+    s->ds = create_empty_dataset(&opts, 0);
+    check(s->ds, "Could not create summarizer.");
+    return s;
+
+error:
+    if (s) free(s);
+    return NULL;
+}
+
+void Summarizer_destroy(Summarizer *s)
+{
+    if (!s)
+        return;
+    if (s->ds)
+        delete_dataset(s->ds);
+    free(s);
+}
+
+int Summarizer_add(Summarizer *s, double x)
+{
+    // Returns 0 if x could not be recorded, e.g. a negative value in
+    // SUMMARIZER_HDR mode, in which case the summary is left unchanged.
+    return push(s->ds, x);
+}
+
+size_t Summarizer_add_batch(Summarizer *s, const double *values, size_t n)
+{
+    // Add n values. Returns the number of values recorded.
+    return push_batch(s->ds, values, n);
+}
+
+int Summarizer_merge(Summarizer *s, Summarizer *other)
+{
+    // Add the values summarized by other to s. Both must use the same mode.
+    // other is left untouched.
+    check(s->mode == other->mode, "Can't merge summarizers of different modes.");
+    return merge_datasets(s->ds, other->ds);
+
+error:
+    return 0;
+}
+
+summarizer_mode Summarizer_get_mode(Summarizer *s)
+{
+    return s->mode;
+}
+
+size_t Summarizer_count(Summarizer *s)
+{
+    return s->ds->n;
+}
+
+double Summarizer_mean(Summarizer *s)
+{
+    return s->ds->n > 0 ? mean(s->ds) : NAN;
+}
+
+double Summarizer_var(Summarizer *s)
+{
+    return s->ds->n > 1 ? var(s->ds) : NAN;
+}
+
+double Summarizer_sd(Summarizer *s)
+{
+    return s->ds->n > 1 ? sd(s->ds) : NAN;
+}
+
+double Summarizer_skewness(Summarizer *s)
+{
+    // Sample skewness, NAN if the values are all equal.
+    return s->ds->n > 1 && s->ds->M2 > 0 ? skewness(s->ds) : NAN;
+}
+
+double Summarizer_kurtosis(Summarizer *s)
+{
+    // Sample excess kurtosis, NAN if the values are all equal.
+    return s->ds->n > 1 && s->ds->M2 > 0 ? kurtosis(s->ds) : NAN;
+}
+
+double Summarizer_min(Summarizer *s)
+{
+    return s->ds->n > 0 ? min(s->ds) : NAN;
+}
+
+double Summarizer_max(Summarizer *s)
+{
+    return s->ds->n > 0 ? max(s->ds) : NAN;
+}
+
+double Summarizer_percentile(Summarizer *s, double q)
+{
+    // qth percentile, q between 0 and 100.
+    if (s->ds->n == 0 || !(q >= 0 && q <= 100))
+        return NAN;
+    if (s->ds->n == 1)
+        return s->ds->min;
+    return percentile(s->ds, q);
+}
+
+void *Summarizer_serialize(Summarizer *s, size_t *size)
+{
+    // Serialize s to a buffer allocated with malloc, whose size is stored in
+    // size. The buffer starts with a header giving the format version and the
+    // byte order of the host, followed by the running moments and either the
+    // values (exact mode) or the state of the sketch. Returns NULL on failure.
+    Writer w = { NULL, 0, 0, false };
+    dataset *ds = s->ds;
+    uint32_t header[3] = { SUMMARIZER_FORMAT_VERSION, BYTE_ORDER_MARK, s->mode };
+
+    Writer_put(&w, SUMMARIZER_MAGIC, 4);
+    Writer_put(&w, header, sizeof(header));
+    Writer_put_u64(&w, ds->n);
+    Writer_put_double(&w, ds->M1);
+    Writer_put_double(&w, ds->M2);
+    Writer_put_double(&w, ds->M3);
+    Writer_put_double(&w, ds->M4);
+    Writer_put_double(&w, ds->min);
+    Writer_put_double(&w, ds->max);
+
+    switch (s->mode) {
+    case SUMMARIZER_EXACT:
+        Writer_put(&w, ds->data, ds->n * sizeof(double));
+        break;
+    case SUMMARIZER_KLL:
+        KLL_serialize(ds->kll, &w);
+        break;
+    case SUMMARIZER_DDSKETCH:
+        DDSketch_serialize(ds->ddsketch, &w);
+        break;
+    case SUMMARIZER_HDR:
+        HdrHistogram_serialize(ds->hdr, &w);
+        break;
+    default:
+        TDigest_serialize(ds->digest, &w);
+    }
+    check(!w.failed, "Could not serialize summarizer.");
+
+    *size = w.len;
+    return w.buf;
+
+error:
+    free(w.buf);
+    return NULL;
+}
+
+Summarizer *Summarizer_deserialize(const void *buf, size_t size)
+{
+    // Read a summarizer written by Summarizer_serialize. Returns NULL if the
+    // buffer is truncated, corrupt, or was written by a host with a different
+    // byte order or with another version of the format.
+    Reader r = { buf, size, 0, false };
+    Summarizer *s = NULL;
+    dataset_options opts;
+    dataset *ds;
+    char magic[4];
+    uint32_t header[3];
+    uint64_t n;
+
+    Reader_get(&r, magic, 4);
+    Reader_get(&r, header, sizeof(header));
+    check(!r.failed && memcmp(magic, SUMMARIZER_MAGIC, 4) == 0,
+          "Not a serialized summarizer.");
+    check(header[0] == SUMMARIZER_FORMAT_VERSION,
+          "Unsupported summarizer format version %u.", header[0]);
+    check(header[1] == BYTE_ORDER_MARK,
+          "Summarizer serialized with a different byte order.");
+    check(header[2] <= SUMMARIZER_HDR, "Unknown summarizer mode %u.", header[2]);
+    n = Reader_get_u64(&r);
+    check(header[2] != SUMMARIZER_EXACT || Reader_has(&r, n, sizeof(double)),
+          "Truncated summarizer.");
+
+    s = calloc(1, sizeof(Summarizer));
+    check_mem(s);
+    s->mode = (summarizer_mode)header[2];
+    Summarizer_options(s->mode, &opts);
+    // Sketches are read from the buffer, don't create them here.
+    opts.streaming = false;
+    ds = s->ds = create_empty_dataset(&opts, s->mode == SUMMARIZER_EXACT ? n : 1);
+    check(ds, "Could not create summarizer.");
+
+    ds->n = n;
+    ds->M1 = Reader_get_double(&r);
+    ds->M2 = Reader_get_double(&r);
+    ds->M3 = Reader_get_double(&r);
+    ds->M4 = Reader_get_double(&r);
+    ds->min = Reader_get_double(&r);
+    ds->max = Reader_get_double(&r);
+    if (s->mode == SUMMARIZER_EXACT) {
+        Reader_get(&r, ds->data, n * sizeof(double));
+    } else {
+        ds->streaming = true;
+        ds->sketch = opts.sketch;
+        switch (s->mode) {
+        case SUMMARIZER_KLL:
+            ds->kll = KLL_deserialize(&r);
+            check(ds->kll, "Invalid KLL sketch.");
+            break;
+        case SUMMARIZER_DDSKETCH:
+            ds->ddsketch = DDSketch_deserialize(&r);
+            check(ds->ddsketch, "Invalid DDSketch.");
+            break;
+        case SUMMARIZER_HDR:
+            ds->hdr = HdrHistogram_deserialize(&r);
+            check(ds->hdr, "Invalid HDR histogram.");
+            break;
+        default:
+            ds->digest = TDigest_deserialize(&r);
+            check(ds->digest, "Invalid t-digest.");
+        }
+    }
+    check(!r.failed && r.pos == r.len, "Corrupt summarizer.");
+    return s;
+
+error:
+    Summarizer_destroy(s);
+    return NULL;
+}
@@ -0,0 +1,58 @@
+/*
+ * Public API of libdesc, to summarize data from other programs.
+ *
+ * A Summarizer holds the running statistics of a stream of values, either
+ * exactly or with one of the approximate quantile engines of desc. Values are
+ * added one at a time or in batches, summaries of different parts of the data
+ * can be merged, and a summary can be serialized to bytes to be stored or sent
+ * to another process and read back.
+ *
+ * The library keeps no global state, so different summarizers can be used
+ * from different threads concurrently. A single summarizer is not
+ * synchronized: it must not be used from several threads at the same time,
+ * queries included, since these reorder the data or update cached views.
+ */
+
+#ifndef SUMMARIZER_H
+#define SUMMARIZER_H
+
+#include <stddef.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DESC_API __attribute__((visibility("default")))
+#else
+#define DESC_API
+#endif
+
+// Version of the serialization format written by Summarizer_serialize.
+#define SUMMARIZER_FORMAT_VERSION 1
+
+typedef enum summarizer_mode {
+    SUMMARIZER_EXACT,
+    SUMMARIZER_TDIGEST,
+    SUMMARIZER_KLL,
+    SUMMARIZER_DDSKETCH,
+    SUMMARIZER_HDR
+} summarizer_mode;
+
+typedef struct Summarizer Summarizer;
+
+DESC_API Summarizer *Summarizer_create(summarizer_mode mode);
+DESC_API void Summarizer_destroy(Summarizer *s);
+DESC_API int Summarizer_add(Summarizer *s, double x);
+DESC_API size_t Summarizer_add_batch(Summarizer *s, const double *values, size_t n);
+DESC_API int Summarizer_merge(Summarizer *s, Summarizer *other);
+DESC_API summarizer_mode Summarizer_get_mode(Summarizer *s);
+DESC_API size_t Summarizer_count(Summarizer *s);
+DESC_API double Summarizer_mean(Summarizer *s);
+DESC_API double Summarizer_var(Summarizer *s);
+DESC_API double Summarizer_sd(Summarizer *s);
+DESC_API double Summarizer_skewness(Summarizer *s);
+DESC_API double Summarizer_kurtosis(Summarizer *s);
+DESC_API double Summarizer_min(Summarizer *s);
+DESC_API double Summarizer_max(Summarizer *s);
+DESC_API double Summarizer_percentile(Summarizer *s, double q);
+DESC_API void *Summarizer_serialize(Summarizer *s, size_t *size);
+DESC_API Summarizer *Summarizer_deserialize(const void *buf, size_t size);
+
+#endif
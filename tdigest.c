@@ -10,7 +10,9 @@
 #include <float.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include "counters.h"
 #include "tdigest.h"
 #include "tree.h"
 
@@ -31,20 +33,47 @@ struct TDigest {
     size_t ncentroids;
     double delta;
     unsigned int K;
+    size_t max_centroids;
     size_t ncompressions;
+    uint64_t rng;
 };
 
 RB_GENERATE(CentroidTree, Centroid, entry, centroidcmp)
 
+static uint64_t TDigest_random(TDigest *digest)
+{
+    // xorshift64*. Each digest has its own generator so that digests can be
+    // used from several threads, unlike rand().
+    digest->rng ^= digest->rng >> 12;
+    digest->rng ^= digest->rng << 25;
+    digest->rng ^= digest->rng >> 27;
+    return digest->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t TDigest_random_below(TDigest *digest, size_t n)
+{
+    // Random integer in [0, n). The modulo bias is negligible for the number
+    // of centroids of a digest.
+    return TDigest_random(digest) % n;
+}
+
 TDigest* TDigest_create(double delta, unsigned int K)
 {
     TDigest *digest = calloc(1, sizeof(TDigest));
+    if (!digest)
+        return NULL;
     RB_INIT(&(digest->C));
     digest->delta = delta;
     digest->K = K;
+    digest->max_centroids = K / delta;
     digest->count = 0;
     digest->ncentroids = 0;
     digest->ncompressions = 0;
+    // Seed the generator from the address of the digest so that digests
+    // built concurrently make independent choices.
+    digest->rng = 0x9E3779B97F4A7C15ULL ^ (uint64_t)(uintptr_t)digest;
+    if (digest->rng == 0)
+        digest->rng = 1;
     return digest;
 }
 
@@ -78,7 +107,7 @@ void TDigest_add(TDigest **digest, double x, size_t w)
 
     (*digest)->count += w;
 
-    if ((*digest)->ncentroids > (*digest)->K / (*digest)->delta) {
+    if ((*digest)->ncentroids > (*digest)->max_centroids) {
         TDigest_compress(digest);
     }
 }
@@ -125,7 +154,7 @@ Centroid *TDigest_find_closest_centroid(TDigest *digest, double x, size_t w)
         threshold = 4 * digest->count * digest->delta * qc * (1 - qc);
         if (c->count + w <= threshold) {
             n++;
-            if (rand() / (double)RAND_MAX < 1.0 / n) {
+            if ((TDigest_random(digest) >> 11) * 0x1.0p-53 < 1.0 / n) {
                 closest = c;
             }
         }
@@ -134,15 +163,20 @@ Centroid *TDigest_find_closest_centroid(TDigest *digest, double x, size_t w)
     return closest;
 }
 
-void TDigest_compress(TDigest **digest)
+static TDigest *TDigest_rebuild(TDigest *digestp, double delta)
 {
-    TDigest *digestp = *digest;
-    TDigest *new_digest = TDigest_create(digestp->delta, digestp->K);
+    // Move the centroids of digestp, in random order, to a new digest with
+    // compression parameter delta and destroy digestp. The new digest is not
+    // compressed while it is filled.
+    TDigest *new_digest = TDigest_create(delta, digestp->K);
     Centroid *c;
     int i, j;
 
+    new_digest->max_centroids = SIZE_MAX;
+    new_digest->rng = TDigest_random(digestp) | 1;
+
     while (!RB_EMPTY(&(digestp->C))) {
-        j = arc4random_uniform(digestp->ncentroids);
+        j = TDigest_random_below(digestp, digestp->ncentroids);
         c = RB_MIN(CentroidTree, &(digestp->C));
         for (i = 0; i < j; i++) {
             c = RB_NEXT(CentroidTree, &(digestp->C), c);
@@ -154,12 +188,104 @@ void TDigest_compress(TDigest **digest)
         free(c);
     }
 
+    new_digest->max_centroids = digestp->max_centroids;
     new_digest->ncompressions = digestp->ncompressions;
     TDigest_destroy(digestp);
+    return new_digest;
+}
+
+void TDigest_compress(TDigest **digest)
+{
+    TDigest *new_digest;
+    double delta = (*digest)->delta;
+
+    COUNTER_ADD(digest_compressions, 1);
+    COUNTER_MAX(peak_centroids, (*digest)->ncentroids);
+    new_digest = TDigest_rebuild(*digest, delta);
+
+    // If delta keeps more centroids than max_centroids allows, every new
+    // value would trigger a compression. Raise delta until there is room for
+    // as many new centroids as survived the compression, so that the limit
+    // holds. Once delta exceeds the count, every centroid can absorb its
+    // neighbours and raising it further would not help.
+    while (2 * new_digest->ncentroids > new_digest->max_centroids &&
+           delta < new_digest->count) {
+        delta *= 2;
+        new_digest = TDigest_rebuild(new_digest, delta);
+    }
+
     *digest = new_digest;
     ((*digest)->ncompressions)++;
 }
 
+int TDigest_merge(TDigest **digest, TDigest *other)
+{
+    return TDigest_merge_weighted(digest, other, 1);
+}
+
+int TDigest_merge_weighted(TDigest **digest, TDigest *other, double weight)
+{
+    // Add all the centroids of other to digest, with their counts multiplied
+    // by weight and rounded. Centroids whose count rounds to 0 are left out.
+    // The centroids are added in random order, as recommended by Dunning and
+    // Ertl, so that merging does not bias the centroid sizes towards one end
+    // of the distribution.
+    Centroid **centroids, *c, *tmp;
+    size_t i, j, w, n = other->ncentroids;
+
+    if (n == 0)
+        return 1;
+    centroids = malloc(n * sizeof(Centroid*));
+    if (!centroids)
+        return 0;
+
+    i = 0;
+    RB_FOREACH(c, CentroidTree, &(other->C)) {
+        centroids[i++] = c;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = TDigest_random_below(*digest, i + 1);
+        tmp = centroids[i];
+        centroids[i] = centroids[j];
+        centroids[j] = tmp;
+    }
+    for (i = 0; i < n; i++) {
+        w = weight == 1 ? centroids[i]->count :
+            (size_t)llround(centroids[i]->count * weight);
+        if (w > 0)
+            TDigest_add(digest, centroids[i]->mean, w);
+    }
+    (*digest)->ncompressions += other->ncompressions;
+
+    free(centroids);
+    return 1;
+}
+
+void TDigest_set_max_centroids(TDigest *digest, size_t max_centroids)
+{
+    // Compress the digest whenever it has more than max_centroids centroids,
+    // instead of the default K / delta. Fewer centroids make adding values
+    // faster, at the cost of more frequent compressions.
+    digest->max_centroids = max_centroids > TDIGEST_MIN_CENTROIDS ?
+                            max_centroids : TDIGEST_MIN_CENTROIDS;
+}
+
+void TDigest_params_for_memory(size_t bytes, double *delta, size_t *max_centroids)
+{
+    // Choose the compression parameters so that the digest never uses more
+    // than bytes of memory. After a compression, a digest holds about 10 /
+    // delta centroids, so delta is chosen to leave room for as many new
+    // centroids before the next compression.
+    size_t n = bytes > sizeof(TDigest) ? (bytes - sizeof(TDigest)) / sizeof(Centroid) : 0;
+
+    if (n < TDIGEST_MIN_CENTROIDS)
+        n = TDIGEST_MIN_CENTROIDS;
+    *max_centroids = n;
+    *delta = 20.0 / n;
+    if (*delta > TDIGEST_MAX_DELTA)
+        *delta = TDIGEST_MAX_DELTA;
+}
+
 size_t TDigest_get_ncompressions(TDigest *digest)
 {
     return digest->ncompressions;
@@ -170,6 +296,13 @@ double TDigest_percentile(TDigest *digest, double q)
     double delta, t = 0;
     bool first = true;
     Centroid *c;
+
+    if (digest->count == 0)
+        return NAN;
+    // A single centroid has no neighbour to interpolate with, which happens
+    // with one value or when max_centroids forces everything together.
+    if (digest->ncentroids == 1)
+        return RB_MIN(CentroidTree, &(digest->C))->mean;
     q *= digest->count;
     RB_FOREACH(c, CentroidTree, &(digest->C)) {
         if (q < t + c->count) {
@@ -188,6 +321,41 @@ double TDigest_percentile(TDigest *digest, double q)
     return RB_MAX(CentroidTree, &(digest->C))->mean;
 }
 
+double TDigest_cdf(TDigest *digest, double x)
+{
+    // Fraction of the weight at or below x. Half of the weight of a centroid
+    // is taken to be below its mean, and the cumulative weight is
+    // interpolated linearly between the means of consecutive centroids.
+    // Below the first mean and above the last one, the interpolation is that
+    // of TDigest_percentile, which spreads the weight of the centroid over
+    // the distance to its neighbour.
+    Centroid *c, *prev = NULL, *last;
+    double t = 0, delta;
+
+    if (digest->count == 0)
+        return NAN;
+    last = RB_MAX(CentroidTree, &(digest->C));
+    RB_FOREACH(c, CentroidTree, &(digest->C)) {
+        if (x < c->mean) {
+            if (prev)
+                return (t - prev->count / 2.0 + (prev->count + c->count) / 2.0 *
+                        (x - prev->mean) / (c->mean - prev->mean)) / digest->count;
+            if (c == last)
+                return 0;
+            delta = RB_NEXT(CentroidTree, &(digest->C), c)->mean - c->mean;
+            t = c->count * ((x - c->mean) / delta + 0.5);
+            return (t > 0 ? t : 0) / digest->count;
+        }
+        t += c->count;
+        prev = c;
+    }
+    if (last == RB_MIN(CentroidTree, &(digest->C)))
+        return 1;
+    delta = last->mean - RB_PREV(CentroidTree, &(digest->C), last)->mean;
+    t = digest->count - last->count * (0.5 - (x - last->mean) / delta);
+    return (t < digest->count ? t : digest->count) / digest->count;
+}
+
 size_t TDigest_get_ncentroids(TDigest *digest)
 {
     return digest->ncentroids;
@@ -205,11 +373,74 @@ Centroid *TDigest_get_centroid(TDigest *digest, size_t i)
     return c;
 }
 
+size_t TDigest_get_memory(TDigest *digest)
+{
+    // Number of bytes used by the digest and its centroids.
+    return sizeof(TDigest) + digest->ncentroids * sizeof(Centroid);
+}
+
 size_t TDigest_get_count(TDigest *digest)
 {
     return digest->count;
 }
 
+void TDigest_serialize(TDigest *digest, Writer *w)
+{
+    // Write the parameters of the digest followed by its centroids in
+    // increasing order.
+    Centroid *c;
+
+    Writer_put_double(w, digest->delta);
+    Writer_put_u64(w, digest->K);
+    Writer_put_u64(w, digest->max_centroids);
+    Writer_put_u64(w, digest->ncompressions);
+    Writer_put_u64(w, digest->ncentroids);
+    RB_FOREACH(c, CentroidTree, &(digest->C)) {
+        Writer_put_double(w, c->mean);
+        Writer_put_u64(w, c->count);
+    }
+}
+
+TDigest *TDigest_deserialize(Reader *r)
+{
+    // Read a digest written by TDigest_serialize. Returns NULL if the data is
+    // truncated or invalid.
+    TDigest *digest;
+    Centroid *c;
+    double delta = Reader_get_double(r);
+    uint64_t K = Reader_get_u64(r);
+    uint64_t max_centroids = Reader_get_u64(r);
+    uint64_t ncompressions = Reader_get_u64(r);
+    uint64_t i, n = Reader_get_u64(r);
+
+    if (!Reader_has(r, n, 2 * sizeof(uint64_t)) || !(delta > 0 && delta < 1) ||
+            K == 0 || K > UINT32_MAX || max_centroids == 0)
+        return NULL;
+    digest = TDigest_create(delta, (unsigned int)K);
+    if (!digest)
+        return NULL;
+    digest->max_centroids = max_centroids;
+    digest->ncompressions = ncompressions;
+
+    for (i = 0; i < n; i++) {
+        c = malloc(sizeof(Centroid));
+        if (!c)
+            goto error;
+        c->mean = Reader_get_double(r);
+        c->count = Reader_get_u64(r);
+        RB_INSERT(CentroidTree, &(digest->C), c);
+        digest->ncentroids++;
+        digest->count += c->count;
+    }
+    if (r->failed)
+        goto error;
+    return digest;
+
+error:
+    TDigest_destroy(digest);
+    return NULL;
+}
+
 Centroid* Centroid_create(double x, size_t w)
 {
     Centroid *centroid = malloc(sizeof(Centroid));
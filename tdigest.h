@@ -12,6 +12,14 @@
 
 #define DEFAULT_DELTA 0.01
 #define DEFAULT_K 100
+// Largest delta chosen up front to fit a number of centroids.
+#define TDIGEST_MAX_DELTA 0.5
+// Fewest centroids a digest can be limited to. Below that, the singletons
+// kept at the extremes alone can exceed the limit.
+#define TDIGEST_MIN_CENTROIDS 40
+
+#include <stddef.h>
+#include "serialize.h"
 
 typedef struct TDigest TDigest;
 typedef struct Centroid Centroid;
@@ -21,11 +29,19 @@ void TDigest_destroy(TDigest* digest);
 void TDigest_add(TDigest **digest, double x, size_t w);
 Centroid *TDigest_find_closest_centroid(TDigest *digest, double x, size_t w);
 void TDigest_compress(TDigest **digest);
+int TDigest_merge(TDigest **digest, TDigest *other);
+int TDigest_merge_weighted(TDigest **digest, TDigest *other, double weight);
+void TDigest_set_max_centroids(TDigest *digest, size_t max_centroids);
+void TDigest_params_for_memory(size_t bytes, double *delta, size_t *max_centroids);
 double TDigest_percentile(TDigest *digest, double q);
+double TDigest_cdf(TDigest *digest, double x);
 size_t TDigest_get_ncentroids(TDigest *digest);
 Centroid *TDigest_get_centroid(TDigest *digest, size_t i);
 size_t TDigest_get_ncompressions(TDigest *digest);
 size_t TDigest_get_count(TDigest *digest);
+size_t TDigest_get_memory(TDigest *digest);
+void TDigest_serialize(TDigest *digest, Writer *w);
+TDigest *TDigest_deserialize(Reader *r);
 
 Centroid* Centroid_create(double x, size_t w);
 void Centroid_add(Centroid *c, double x, size_t w);
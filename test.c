@@ -1,8 +1,21 @@
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "tdigest.h"
 #include "dbg.h"
+#include "format.h"
 #include "stats.h"
+#include "collector.h"
+#include "server.h"
+#include "sharded.h"
+#include "sort.h"
+#include "summarizer.h"
+#include "window.h"
 
 #define EPSILON 1e-8
 
@@ -120,6 +133,20 @@ char *test_odd3_streaming()
     test_dataset(1e-2);
 }
 
+char *test_odd3_gzip()
+{
+    dataset *ds = read_data_file("data/odd.dat.gz", false);
+
+    double answer[9] = {0.50382482225561787,
+                        0.50233294716282062, 0.082897444134665946,
+                        0.28791916249993843, 0.25413486746800,
+                        0.75404246086600, 0.499907593398,
+                        0.00019540681109, 0.99961258962500};
+    mu_assert(ds != NULL, "Could not read gzip file");
+    mu_assert(ds->n == 5001, "Incorrect count for gzip file");
+    test_dataset(EPSILON);
+}
+
 char *test_odd4()
 {
     double data[7] = {8.64, 9.4, 2.1, -6.5, 34.2, 3.34, 67.5};
@@ -209,6 +236,21 @@ char *test_even3_streaming()
     test_dataset(1e-2);
 }
 
+char *test_even3_kll()
+{
+    double answer[9] = {0.50056922106177648,
+                        0.50006327290531249, 0.08331229878740451,
+                        0.28863869939321113, 0.25445019760600, 0.74980086801600,
+                        0.49535067041, 0.00007428522194, 0.99986769224100};
+    dataset_options opts;
+
+    default_options(&opts);
+    opts.streaming = true;
+    opts.sketch = SKETCH_KLL;
+    dataset *ds = read_data_file_opts("data/even.dat", &opts);
+    test_dataset(2e-2);
+}
+
 char *test_even4()
 {
     double data[6] = {7, 15, 36, 39, 40, 41};
@@ -220,6 +262,602 @@ char *test_even4()
     test_dataset(EPSILON);
 }
 
+char *test_merge()
+{
+    double data1[3] = {4.3, 9.4, 2.1};
+    double data2[5] = {-6.5, 34.2, 3.34, 67.5, 8.64};
+    double answer[9] = {6.47, 15.3725, 582.09930714285713,
+                        24.126734282593183, 3.03, 15.6, 12.57, -6.5, 67.5};
+
+    dataset *ds = create_dataset(data1, 3);
+    dataset *other = create_dataset(data2, 5);
+    mu_assert(merge_datasets(ds, other) == 1, "Could not merge datasets");
+    mu_assert(ds->n == 8, "Incorrect count after merge");
+    delete_dataset(other);
+    test_dataset(EPSILON);
+}
+
+char *test_moments()
+{
+    // Skewness and kurtosis of data/example.dat, added one at a time, in a
+    // batch, and merged from two parts.
+    double data[10] = {2, 22, 19, 29, 25, 26, 5, 20, 16, 21};
+    double skew = -0.8804765981524106, kurt = -0.38516832087065467;
+    dataset_options opts;
+    dataset *ds, *batch, *part;
+
+    default_options(&opts);
+    ds = create_dataset(data, 10);
+    batch = create_empty_dataset(&opts, 0);
+    part = create_empty_dataset(&opts, 0);
+    mu_assert(push_batch(batch, data, 4) == 4 && push_batch(part, data + 4, 6) == 6 &&
+              merge_datasets(batch, part), "Could not build datasets");
+    mu_assert(check_answer(skewness(ds), skew, EPSILON) &&
+              check_answer(kurtosis(ds), kurt, EPSILON), "Incorrect moments");
+    mu_assert(check_answer(skewness(batch), skew, EPSILON) &&
+              check_answer(kurtosis(batch), kurt, EPSILON),
+              "Incorrect moments after batch and merge");
+    delete_dataset(ds);
+    delete_dataset(batch);
+    delete_dataset(part);
+    return NULL;
+}
+
+char *test_accurate()
+{
+    // 10^6 values 10^9 + k/8, k = 0 to 3, whose exact mean is 10^9 + 3/16
+    // and exact variance (5/256) n / (n - 1). Both are representable, and
+    // the accurate mode must find them to the last bit, read in one piece
+    // or merged from parts of different sizes.
+    size_t i, n = 1000000;
+    double x, exact_var = 5.0 / 256 * n / (n - 1.0);
+    dataset_options opts;
+    dataset *ds, *parts[3];
+
+    default_options(&opts);
+    opts.accurate = true;
+    ds = create_empty_dataset(&opts, n);
+    for (i = 0; i < 3; i++)
+        parts[i] = create_empty_dataset(&opts, 0);
+    for (i = 0; i < n; i++) {
+        x = 1e9 + (i % 4) / 8.0;
+        mu_assert(push(ds, x), "Could not add value");
+        mu_assert(push(parts[i < 1000 ? 0 : i < 300000 ? 1 : 2], x), "Could not add value");
+    }
+    mu_assert(mean(ds) == 1e9 + 3.0 / 16 && var(ds) == exact_var,
+              "Inaccurate moments");
+    mu_assert(merge_datasets(parts[1], parts[0]) && merge_datasets(parts[1], parts[2]),
+              "Could not merge datasets");
+    mu_assert(mean(parts[1]) == 1e9 + 3.0 / 16 &&
+              fabs(var(parts[1]) - exact_var) <= 1e-15 * exact_var,
+              "Inaccurate moments after merge");
+    delete_dataset(ds);
+    for (i = 0; i < 3; i++)
+        delete_dataset(parts[i]);
+
+    // With a block mean that isn't representable, the higher moments must be
+    // centred on the same mean. 10^9 + 0.1 and 10^9 + 0.2 round to 1 and 2
+    // times the same number of ulps, so the values are exactly symmetric.
+    ds = create_empty_dataset(&opts, 0);
+    for (i = 0; i < 999999; i++)
+        push(ds, 1e9 + (i % 3) / 10.0);
+    mu_assert(fabs(skewness(ds)) < 1e-9 && fabs(kurtosis(ds) + 1.5) < 1e-9,
+              "Inaccurate higher moments");
+    delete_dataset(ds);
+    return NULL;
+}
+
+char *test_spill()
+{
+    // With a budget of 128 values, most of the data goes to runs, added
+    // one by one, by batch and by merging a spilled dataset. The quartiles
+    // and percentiles must match those of the same values in memory, also
+    // with many equal values and across zero.
+    size_t i, n = 20000;
+    double x, batch[1000], q[] = {0, 1, 33.3, 50, 90, 99.9, 100};
+    dataset_options opts;
+    dataset *ds, *other, *exact;
+
+    default_options(&opts);
+    exact = create_empty_dataset(&opts, 0);
+    opts.mem = 128 * sizeof(double);
+    ds = create_empty_dataset(&opts, 0);
+    other = create_empty_dataset(&opts, 0);
+    for (i = 0; i < n; i++) {
+        x = i % 7 == 0 ? 3.0 : (double)((i * 7919) % 10007) - 5000.5;
+        mu_assert(push(i % 3 == 0 ? other : ds, x), "Could not add value");
+        mu_assert(push(exact, x), "Could not add value");
+    }
+    for (i = 0; i < 1000; i++)
+        batch[i] = -1e-300 * i;
+    mu_assert(push_batch(ds, batch, 1000) == 1000, "Could not add batch");
+    mu_assert(push_batch(exact, batch, 1000) == 1000, "Could not add batch");
+    mu_assert(merge_datasets(ds, other), "Could not merge datasets");
+    mu_assert(ds->n == exact->n && ds->spill->nruns > 100, "Data not spilled");
+    // The runs of each dataset go to a single file, which the merged dataset
+    // keeps open after the other one is gone.
+    for (i = 0; i < ds->spill->nruns; i++)
+        mu_assert(ds->spill->runs[i].file == ds->spill->file ||
+                  ds->spill->runs[i].file == other->spill->file,
+                  "Run not in the file of its dataset");
+    delete_dataset(other);
+
+    mu_assert(first_quartile(ds) == first_quartile(exact) &&
+              median(ds) == median(exact) &&
+              third_quartile(ds) == third_quartile(exact),
+              "Incorrect quartiles of spilled data");
+    for (i = 0; i < sizeof(q) / sizeof(q[0]); i++)
+        mu_assert(percentile(ds, q[i]) == percentile(exact, q[i]),
+                  "Incorrect percentile of spilled data");
+    mu_assert(fabs(mean(ds) - mean(exact)) < 1e-9,
+              "Incorrect mean of spilled data");
+    // Values added after a query go to the data array again.
+    mu_assert(push(ds, 1e6) && push(exact, 1e6), "Could not add value");
+    mu_assert(percentile(ds, 100) == 1e6 && median(ds) == median(exact),
+              "Incorrect median after a query");
+
+    delete_dataset(ds);
+    delete_dataset(exact);
+    return NULL;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+char *test_sort()
+{
+    // The radix sort agrees with qsort on negative, subnormal, infinite and
+    // repeated values, with one thread and with four. A dataset queried for
+    // many percentiles sorts its data array once, and gives the same
+    // percentiles as selection until values are added.
+    size_t i, n = 1 << 20, below;
+    double *values = malloc(n * sizeof(double));
+    double *expected = malloc(n * sizeof(double));
+    double index, q;
+    int nthreads;
+    dataset_options opts;
+    dataset *ds, *other;
+
+    mu_assert(values && expected, "Out of memory");
+    for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+        for (i = 0; i < n; i++) {
+            values[i] = i % 11 == 0 ? 42.0 :
+                        i % 13 == 0 ? 1e-310 * (i % 7) :
+                        i % 1009 == 0 ? -INFINITY :
+                        ((double)((i * 2654435761u) % 100003) - 50000) / 3;
+        }
+        memcpy(expected, values, n * sizeof(double));
+        qsort(expected, n, sizeof(double), compare_doubles);
+        mu_assert(radix_sort(values, n, nthreads), "Could not sort");
+        mu_assert(memcmp(values, expected, n * sizeof(double)) == 0,
+                  "Incorrect radix sort");
+    }
+
+    for (i = 0; i < 100000; i++)
+        values[i] = i % 11 == 0 ? 42.0 : (double)((i * 7919) % 100003) / 7 - 5000;
+    ds = create_dataset(values, 100000);
+    mu_assert(ds, "Could not create dataset");
+    memcpy(expected, values, 100000 * sizeof(double));
+    qsort(expected, 100000, sizeof(double), compare_doubles);
+    for (i = 0; i <= 20; i++) {
+        q = 5.0 * i;
+        index = q * (100000 - 1) / 100.0;
+        below = (size_t)index;
+        mu_assert(percentile(ds, q) ==
+                  expected[below] * (1 - (index - below)) +
+                  expected[below < 99999 ? below + 1 : below] * (index - below),
+                  "Incorrect percentile");
+    }
+    mu_assert(ds->sorted, "Data not sorted after many percentiles");
+    mu_assert(push(ds, -1e300) && !ds->sorted, "Sorted flag not cleared");
+    mu_assert(percentile(ds, 0) == -1e300, "Incorrect percentile after push");
+    delete_dataset(ds);
+
+    // The same with a memory budget, before anything is spilled, whether the
+    // values come one by one, in a batch or from a merge.
+    default_options(&opts);
+    opts.mem = 1024 * sizeof(double);
+    ds = create_empty_dataset(&opts, 0);
+    other = create_empty_dataset(&opts, 0);
+    mu_assert(ds && other, "Could not create dataset with memory budget");
+    for (i = 0; i < 100; i++) {
+        values[i] = i;
+        push(ds, i);
+        push(other, -2000.0 - i);
+    }
+    for (i = 0; i < 10; i++)
+        percentile(ds, 10.0 * i);
+    mu_assert(ds->sorted, "Data not sorted after many percentiles");
+    for (i = 0; i < 100; i++)
+        push(ds, -1000.0 - i);
+    mu_assert(!ds->sorted && median(ds) == -500 && percentile(ds, 0) == -1099,
+              "Incorrect percentile after push with memory budget");
+    for (i = 0; i < 10; i++)
+        percentile(ds, 10.0 * i);
+    mu_assert(push_batch(ds, values, 100) == 100 && !ds->sorted,
+              "Sorted flag not cleared by batch with memory budget");
+    for (i = 0; i < 10; i++)
+        percentile(ds, 10.0 * i);
+    mu_assert(merge_datasets(ds, other) && !ds->sorted &&
+              percentile(ds, 0) == -2099,
+              "Sorted flag not cleared by merge with memory budget");
+    delete_dataset(ds);
+    delete_dataset(other);
+
+    free(values);
+    free(expected);
+    return NULL;
+}
+
+char *test_histogram()
+{
+    // 1000 values 0 to 999.9 fall 100 per bin in 10 bins, whether the data
+    // is in memory, sorted or spilled. The sketches estimate the same
+    // counts from their CDF, and log bins split 1 to 10^4 by decades.
+    size_t i, j, n = 10000;
+    double edges[11], counts[10], sum;
+    dataset_options opts;
+    dataset *ds, *spilled, *stream[4];
+    sketch_type sketches[] = {SKETCH_TDIGEST, SKETCH_KLL, SKETCH_DDSKETCH,
+                              SKETCH_HDR};
+    // DDSketch counts the whole bucket of an edge, about 2% of the values
+    // wide at 1000.
+    double tolerance[] = {5, 60, 200, 10};
+
+    default_options(&opts);
+    ds = create_empty_dataset(&opts, 0);
+    opts.mem = 64 * sizeof(double);
+    spilled = create_empty_dataset(&opts, 0);
+    opts.mem = 0;
+    opts.streaming = true;
+    for (j = 0; j < 4; j++) {
+        opts.sketch = sketches[j];
+        stream[j] = create_empty_dataset(&opts, 0);
+    }
+    for (i = 0; i < n; i++) {
+        push(ds, (i * 7 % n) / 10.0);
+        push(spilled, (i * 7 % n) / 10.0);
+        for (j = 0; j < 4; j++)
+            push(stream[j], (i * 7 % n) / 10.0);
+    }
+
+    mu_assert(histogram(ds, 10, false, edges, counts), "Could not bin");
+    mu_assert(edges[0] == 0 && edges[10] == 999.9, "Incorrect edges");
+    for (i = 0; i < 10; i++)
+        mu_assert(counts[i] == 1000, "Incorrect bin count");
+    mu_assert(histogram(spilled, 10, false, edges, counts), "Could not bin");
+    for (i = 0; i < 10; i++)
+        mu_assert(counts[i] == 1000, "Incorrect bin count of spilled data");
+    for (i = 0; i < 20; i++)
+        percentile(ds, i);
+    mu_assert(ds->sorted && histogram(ds, 10, false, edges, counts),
+              "Could not bin sorted data");
+    for (i = 0; i < 10; i++)
+        mu_assert(counts[i] == 1000, "Incorrect bin count of sorted data");
+    for (j = 0; j < 4; j++) {
+        mu_assert(histogram(stream[j], 10, false, edges, counts),
+                  "Could not bin streaming data");
+        for (sum = 0, i = 0; i < 10; i++) {
+            mu_assert(fabs(counts[i] - 1000) < tolerance[j],
+                      "Inaccurate bin count");
+            sum += counts[i];
+        }
+        mu_assert(fabs(sum - n) < 1e-6, "Bin counts don't add up");
+    }
+    mu_assert(!histogram(ds, 10, true, edges, counts),
+              "Log bins accepted with a value of 0");
+    delete_dataset(ds);
+
+    opts.streaming = false;
+    ds = create_empty_dataset(&opts, 0);
+    for (i = 1; i <= 10000; i++)
+        push(ds, i);
+    mu_assert(histogram(ds, 4, true, edges, counts), "Could not bin");
+    mu_assert(fabs(edges[1] - 10) < 1e-9 && fabs(edges[3] - 1000) < 1e-9,
+              "Incorrect log bin edges");
+    for (i = 0; i < 4; i++) {
+        for (sum = 0, j = 1; j <= 10000; j++)
+            sum += j >= edges[i] && (j < edges[i + 1] || i == 3);
+        mu_assert(counts[i] == sum, "Incorrect log bin count");
+    }
+
+    delete_dataset(ds);
+    delete_dataset(spilled);
+    for (j = 0; j < 4; j++)
+        delete_dataset(stream[j]);
+    return NULL;
+}
+
+char *test_distinct_topk()
+{
+    // 100000 distinct values are counted within 3% by the HyperLogLog, also
+    // when split between merged datasets, and few distinct values exactly.
+    // Space-Saving finds values seen 1000 and 500 times among 6000 others
+    // seen once, with counts that bound their frequency.
+    size_t i, j, n = 100000;
+    double x, *values = malloc(n * sizeof(double));
+    dataset_options opts;
+    dataset *ds, *other;
+    TopK *t[2];
+    TopKItem items[2];
+
+    default_options(&opts);
+    opts.distinct = true;
+    opts.topk = 2;
+    ds = create_empty_dataset(&opts, 0);
+    other = create_empty_dataset(&opts, 0);
+    for (i = 0; i < n; i++)
+        values[i] = i * 0.5;
+    push_batch(ds, values, n / 2);
+    for (i = n / 4; i < n; i++)
+        push(other, values[i]);
+    mu_assert(fabs(distinct_count(other) - 0.75 * n) < 0.03 * n,
+              "Inaccurate distinct count");
+    mu_assert(merge_datasets(ds, other), "Could not merge datasets");
+    mu_assert(fabs(distinct_count(ds) - n) < 0.03 * n,
+              "Inaccurate distinct count of merged datasets");
+    delete_dataset(ds);
+    delete_dataset(other);
+
+    ds = create_empty_dataset(&opts, 0);
+    for (i = 0; i < 1000; i++)
+        push(ds, i % 10 == 0 ? -0.0 : (double)(i % 10));
+    mu_assert(fabs(distinct_count(ds) - 10) < 0.5, "Incorrect distinct count");
+    mu_assert(top_values(ds, items, 2) == 2 && items[0].count == 100 &&
+              items[0].error == 0, "Incorrect top values");
+    delete_dataset(ds);
+
+    for (j = 0; j < 2; j++) {
+        t[j] = TopK_create(16);
+        for (i = 0; i < 7500; i++) {
+            if (i % 5 == 0)
+                x = 1;
+            else if (i % 5 == 1 && i < 5000)
+                x = 2;
+            else
+                x = n * (j + 1) + i;
+            TopK_add(t[j], x, hash_double(x), 1);
+        }
+        mu_assert(TopK_top(t[j], items, 2) == 2, "Could not get top values");
+        mu_assert(items[0].value == 1 && items[1].value == 2,
+                  "Heavy hitters not found");
+        mu_assert(items[0].count - items[0].error <= 1500 &&
+                  items[0].count >= 1500 && items[1].count >= 1000 &&
+                  items[1].count - items[1].error <= 1000,
+                  "Incorrect heavy hitter bounds");
+    }
+    mu_assert(TopK_merge(t[0], t[1]), "Could not merge top values");
+    mu_assert(TopK_top(t[0], items, 2) == 2 && items[0].value == 1 &&
+              items[1].value == 2, "Heavy hitters lost in merge");
+    mu_assert(items[0].count - items[0].error <= 3000 &&
+              items[0].count >= 3000 && items[1].count >= 2000 &&
+              items[1].count - items[1].error <= 2000,
+              "Incorrect merged heavy hitter bounds");
+
+    TopK_destroy(t[0]);
+    TopK_destroy(t[1]);
+    free(values);
+    return NULL;
+}
+
+char *test_moments_only()
+{
+    // Without an engine, a dataset keeps no values but has the same count,
+    // extremes and moments as an exact one, also after a merge, and no
+    // quantiles.
+    size_t i;
+    double edges[3], counts[2];
+    dataset_options opts;
+    dataset *ds, *other, *exact;
+
+    default_options(&opts);
+    exact = create_empty_dataset(&opts, 0);
+    opts.streaming = true;
+    opts.sketch = SKETCH_NONE;
+    ds = create_empty_dataset(&opts, 0);
+    other = create_empty_dataset(&opts, 0);
+    mu_assert(ds->data == NULL && ds->digest == NULL,
+              "Values kept without an engine");
+    for (i = 0; i < 1000; i++) {
+        push(i < 600 ? ds : other, sqrt(i));
+        push(exact, sqrt(i));
+    }
+    mu_assert(merge_datasets(ds, other), "Could not merge datasets");
+    mu_assert(ds->n == 1000 && min(ds) == 0 && max(ds) == sqrt(999),
+              "Incorrect count or extremes");
+    mu_assert(fabs(mean(ds) - mean(exact)) < EPSILON &&
+              fabs(var(ds) - var(exact)) < EPSILON &&
+              fabs(kurtosis(ds) - kurtosis(exact)) < EPSILON,
+              "Incorrect moments");
+    mu_assert(isnan(median(ds)) && isnan(percentile(ds, 90)),
+              "Quantiles without the values");
+    mu_assert(!histogram(ds, 2, false, edges, counts),
+              "Histogram without the values");
+
+    delete_dataset(ds);
+    delete_dataset(other);
+    delete_dataset(exact);
+    return NULL;
+}
+
+char *test_weighted()
+{
+    // Values with weights have the statistics of the values repeated by
+    // their weights: the same percentiles and bins in exact mode, also when
+    // split between merged datasets, and moments within rounding. Zero
+    // weights are ignored.
+    size_t i, j, w;
+    double q, x, edges[7], counts[6], expected[6];
+    dataset_options opts;
+    dataset *ds, *other, *expanded, *stream;
+
+    default_options(&opts);
+    expanded = create_empty_dataset(&opts, 0);
+    opts.weighted = true;
+    ds = create_empty_dataset(&opts, 0);
+    other = create_empty_dataset(&opts, 0);
+    opts.streaming = true;
+    stream = create_empty_dataset(&opts, 0);
+    mu_assert(ds->weighted && ds->data == NULL, "No weighted values");
+    for (i = 0; i < 2000; i++) {
+        x = (i * 37 % 2000) / 8.0;
+        w = i * 7 % 13;
+        mu_assert(push_weighted(i % 3 ? ds : other, x, w) &&
+                  push_weighted(stream, x, w), "Could not add weighted value");
+        for (j = 0; j < w; j++)
+            push(expanded, x);
+    }
+    mu_assert(merge_datasets(ds, other), "Could not merge weighted datasets");
+    mu_assert(ds->n == expanded->n && stream->n == expanded->n,
+              "Incorrect weighted count");
+    mu_assert(min(ds) == min(expanded) && max(ds) == max(expanded),
+              "Incorrect weighted extremes");
+    mu_assert(fabs(mean(ds) - mean(expanded)) < EPSILON &&
+              fabs(var(ds) - var(expanded)) < 1e-6 &&
+              fabs(skewness(ds) - skewness(expanded)) < EPSILON &&
+              fabs(kurtosis(ds) - kurtosis(expanded)) < EPSILON,
+              "Incorrect weighted moments");
+    mu_assert(median(ds) == median(expanded), "Incorrect weighted median");
+    for (q = 0; q <= 100; q += 2.5) {
+        mu_assert(percentile(ds, q) == percentile(expanded, q),
+                  "Incorrect weighted percentile");
+        mu_assert(fabs(percentile(stream, q) - percentile(ds, q)) < 5,
+                  "Inaccurate weighted sketch percentile");
+    }
+    mu_assert(histogram(ds, 6, false, edges, counts) &&
+              histogram(expanded, 6, false, edges, expected),
+              "Could not bin weighted values");
+    for (i = 0; i < 6; i++)
+        mu_assert(counts[i] == expected[i], "Incorrect weighted bin count");
+    mu_assert(!merge_datasets(ds, expanded),
+              "Merged weighted and unweighted datasets");
+    delete_dataset(stream);
+
+    // A heavy value at an extreme doesn't take the sketch past it.
+    stream = create_empty_dataset(&opts, 0);
+    mu_assert(push_weighted(stream, 1, 2) && push_weighted(stream, 3, 1),
+              "Could not add weighted value");
+    for (q = 0; q <= 100; q += 12.5)
+        mu_assert(percentile(stream, q) >= 1 && percentile(stream, q) <= 3,
+                  "Weighted sketch percentile outside of the data");
+
+    delete_dataset(ds);
+    delete_dataset(other);
+    delete_dataset(stream);
+    delete_dataset(expanded);
+    return NULL;
+}
+
+char *test_format()
+{
+    // Numbers are written with the fewest digits that read back as the same
+    // double, like %g for the notation, and so are random bit patterns,
+    // including those the fast path gives up on.
+    double values[] = {0.1, 720640, 1e17, 1.0 / 3, 0.0001, 1e-5, -0.0, 5e-324,
+                        1.7976931348623157e308, 1e23, NAN, -INFINITY};
+    const char *expected[] = {"0.1", "720640", "1e+17", "0.3333333333333333",
+                              "0.0001", "1e-05", "-0", "5e-324",
+                              "1.7976931348623157e+308", "1e+23", "nan",
+                              "-inf"};
+    char buf[FORMAT_DOUBLE_MAX], shortest[FORMAT_DOUBLE_MAX];
+    uint64_t bits = 88172645463325252ULL;
+    size_t i, ndigits;
+    int precision;
+    double x;
+    char *s;
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        mu_assert(format_double(values[i], buf) == strlen(expected[i]) &&
+                  strcmp(buf, expected[i]) == 0, "Incorrect number format");
+    }
+    for (i = 0; i < 100000; i++) {
+        bits ^= bits << 13;
+        bits ^= bits >> 7;
+        bits ^= bits << 17;
+        memcpy(&x, &bits, sizeof(x));
+        format_double(x, buf);
+        if (isnan(x) || isinf(x))
+            continue;
+        mu_assert(strtod(buf, NULL) == x, "Number doesn't read back");
+        // No more significant digits than the shortest %e that reads back.
+        for (precision = 0; precision < 17; precision++) {
+            snprintf(shortest, sizeof(shortest), "%.*e", precision, x);
+            if (strtod(shortest, NULL) == x)
+                break;
+        }
+        ndigits = 0;
+        for (s = buf + (*buf == '-'); *s && *s != 'e'; s++) {
+            if (*s >= '1' && *s <= '9')
+                ndigits = ndigits ? ndigits + 1 : 1;
+            else if (*s == '0' && ndigits)
+                ndigits++;
+        }
+        for (s--; s > buf && (*s == '0' || *s == '.'); s--) {
+            if (*s == '0' && ndigits > 1)
+                ndigits--;
+        }
+        mu_assert(ndigits <= (size_t)precision + 1, "Number not the shortest");
+    }
+    mu_assert(format_size(0, buf) == 1 && strcmp(buf, "0") == 0 &&
+              format_size(18446744073709551615ULL, buf) == 20,
+              "Incorrect size format");
+    return NULL;
+}
+
+char *test_large()
+{
+    // A data array large enough to be grown with mremap keeps its values
+    // when it grows from a small array and grows again.
+    size_t i, n = 300000;
+    double *data = malloc(n * sizeof(double));
+    dataset *ds, *other;
+
+    for (i = 0; i < n; i++)
+        data[i] = (double)(n - i);
+    ds = create_dataset(data, 1);
+    other = create_dataset(data + 1, n - 1);
+    mu_assert(merge_datasets(ds, other) == 1, "Could not merge datasets");
+    delete_dataset(other);
+    other = create_dataset(data, n);
+    mu_assert(merge_datasets(ds, other) == 1, "Could not merge datasets");
+    delete_dataset(other);
+    free(data);
+
+    mu_assert(ds->n == 2 * n, "Incorrect count after merge");
+    mu_assert(check_answer(median(ds), n / 2.0 + 0.5, EPSILON),
+              "Incorrect median of large dataset");
+    mu_assert(min(ds) == 1 && max(ds) == n, "Incorrect extrema of large dataset");
+    delete_dataset(ds);
+    return NULL;
+}
+
+char *test_merge_streaming()
+{
+    double answer[9] = {0.50056922106177648,
+                        0.50006327290531249, 0.08331229878740451,
+                        0.28863869939321113, 0.25445019760600, 0.74980086801600,
+                        0.49535067041, 0.00007428522194, 0.99986769224100};
+    char *filenames[2] = {"data/even.dat", "data/odd.dat"};
+    dataset *datasets[2];
+    dataset_options opts;
+
+    default_options(&opts);
+    opts.streaming = true;
+    mu_assert(read_data_files(filenames, 2, &opts, 2, datasets) == 1,
+              "Could not read files");
+    dataset *ds = datasets[0];
+    mu_assert(merge_datasets(ds, datasets[1]) == 1, "Could not merge datasets");
+    mu_assert(ds->n == 10001, "Incorrect count after merge");
+    mu_assert(TDigest_get_count(ds->digest) == 10001, "Incorrect digest count");
+    delete_dataset(datasets[1]);
+    // Both files are samples of the same uniform distribution.
+    test_dataset(2e-2);
+}
+
 char *test_small_streaming()
 {
     double answer[9] = {49.080551821884,  // median
@@ -240,7 +878,10 @@ char *test_small_streaming()
 char *test_empty()
 {
     double data[0] = {};
-    size_t n = 0;
+    size_t j, n = 0;
+    dataset_options opts;
+    sketch_type sketches[] = {SKETCH_TDIGEST, SKETCH_KLL, SKETCH_DDSKETCH,
+                              SKETCH_HDR};
 
     dataset *ds = create_dataset(data, n);
     mu_assert(ds != NULL, "Could not create empty dataset");
@@ -253,9 +894,24 @@ char *test_empty()
     interquartile_range(ds);
     min(ds);
     max(ds);
+    mu_assert(isnan(mean(ds)) && isnan(var(ds)) && isnan(min(ds)) &&
+              isnan(max(ds)), "Statistics of empty dataset should be NAN");
 
     delete_dataset(ds);
 
+    // The streaming engines have no centroid or bucket to interpolate.
+    default_options(&opts);
+    opts.streaming = true;
+    for (j = 0; j < 4; j++) {
+        opts.sketch = sketches[j];
+        ds = create_empty_dataset(&opts, 0);
+        mu_assert(ds != NULL, "Could not create empty streaming dataset");
+        mu_assert(isnan(median(ds)) && isnan(percentile(ds, 99)) &&
+                  isnan(min(ds)) && isnan(var(ds)),
+                  "Statistics of empty sketch should be NAN");
+        delete_dataset(ds);
+    }
+
     return NULL;
 }
 
@@ -294,6 +950,430 @@ char *test_tdigest_add()
     return NULL;
 }
 
+char *test_tdigest_memory()
+{
+    // A t-digest built for a memory budget or a number of centroids must
+    // stay within it.
+    size_t i, n = 100000, max_centroids, budget = 16 * 1024;
+    double delta;
+    TDigest *digest;
+
+    TDigest_params_for_memory(budget, &delta, &max_centroids);
+    digest = TDigest_create(delta, DEFAULT_K);
+    TDigest_set_max_centroids(digest, max_centroids);
+    for (i = 0; i < n; i++) {
+        TDigest_add(&digest, (double)((i * 7919) % n), 1);
+        mu_assert(TDigest_get_memory(digest) <= budget,
+                  "t-digest exceeds its memory budget");
+    }
+    mu_assert(fabs(TDigest_percentile(digest, 0.5) - n / 2.0) < 0.02 * n,
+              "Incorrect median with memory budget");
+    TDigest_destroy(digest);
+
+    // A limit too small for delta raises delta instead of the limit.
+    digest = TDigest_create(DEFAULT_DELTA, DEFAULT_K);
+    TDigest_set_max_centroids(digest, TDIGEST_MIN_CENTROIDS);
+    for (i = 0; i < n; i++) {
+        TDigest_add(&digest, (double)((i * 7919) % n), 1);
+        mu_assert(TDigest_get_ncentroids(digest) <= TDIGEST_MIN_CENTROIDS,
+                  "t-digest exceeds its number of centroids");
+    }
+    TDigest_destroy(digest);
+    return NULL;
+}
+
+char *test_kll()
+{
+    // The rank error must stay within the KLL guarantee, including when
+    // the values are added in sorted order and with weights.
+    size_t i, n = 100000;
+    double q, eps = KLL_epsilon(KLL_DEFAULT_K);
+    KLL *kll = KLL_create(KLL_DEFAULT_K);
+
+    for (i = 0; i < n; i++)
+        KLL_add(kll, (double)i, 1);
+    KLL_add(kll, -1.0, 1000);
+    mu_assert(KLL_get_count(kll) == n + 1000, "Incorrect KLL count");
+    mu_assert(KLL_get_nretained(kll) < 2000, "KLL sketch is too large");
+    for (q = 0.05; q < 1; q += 0.05) {
+        double rank = (KLL_percentile(kll, q) + 1000) / (n + 1000);
+        mu_assert(fabs(rank - q) < eps, "KLL rank error too large");
+    }
+    KLL_destroy(kll);
+    return NULL;
+}
+
+char *test_ddsketch()
+{
+    // Quantiles must be within the relative accuracy of the sketch, and
+    // merging two sketches must be the same as adding all the values to one.
+    size_t i, n = 10000;
+    double q, exact, alpha = DDSKETCH_DEFAULT_ALPHA;
+    DDSketch *a = DDSketch_create(alpha);
+    DDSketch *b = DDSketch_create(alpha);
+    DDSketch *all = DDSketch_create(alpha);
+
+    for (i = 1; i <= n; i++) {
+        double x = exp(i / 500.0) - 100;
+        DDSketch_add(i % 2 ? a : b, x, 1);
+        DDSketch_add(all, x, 1);
+    }
+    mu_assert(DDSketch_merge(a, b) == 1, "Could not merge DDSketches");
+    mu_assert(DDSketch_get_count(a) == n, "Incorrect DDSketch count");
+    for (q = 0.0; q <= 1.0; q += 0.01) {
+        exact = exp((1 + (size_t)(q * (n - 1))) / 500.0) - 100;
+        mu_assert(fabs(DDSketch_percentile(a, q) - exact) <= alpha * fabs(exact) * 1.0001,
+                  "DDSketch relative error too large");
+        mu_assert(DDSketch_percentile(a, q) == DDSketch_percentile(all, q),
+                  "Merged DDSketch differs");
+    }
+    DDSketch_destroy(a);
+    DDSketch_destroy(b);
+    DDSketch_destroy(all);
+    return NULL;
+}
+
+char *test_hdr()
+{
+    // Values below 2 * 10^digits are counted exactly, larger ones within the
+    // requested number of significant digits.
+    size_t i;
+    int64_t x;
+    double q;
+    HdrHistogram *h = HdrHistogram_create(3);
+    HdrHistogram *other = HdrHistogram_create(3);
+    dataset_options opts;
+    dataset *ds;
+
+    for (i = 0; i < 1000; i++)
+        HdrHistogram_add(h, i, 1);
+    mu_assert(HdrHistogram_percentile(h, 0.5) == 499, "Incorrect HDR median");
+    mu_assert(HdrHistogram_add(h, -1, 1) == 0, "Recorded a negative value");
+
+    for (i = 0; i < 1000; i++) {
+        x = 1000000 + 1000 * i;
+        HdrHistogram_add(other, x, 2);
+    }
+    mu_assert(HdrHistogram_merge(h, other) == 1, "Could not merge HDR histograms");
+    mu_assert(HdrHistogram_get_count(h) == 3000, "Incorrect HDR count");
+    for (q = 0.4; q <= 1.0; q += 0.05) {
+        x = 1000000 + 1000 * (int64_t)((q * 2999 - 1000) / 2);
+        mu_assert(fabs(HdrHistogram_percentile(h, q) - x) <= x * 1e-3,
+                  "HDR relative error too large");
+    }
+    HdrHistogram_destroy(h);
+    HdrHistogram_destroy(other);
+
+    // Quantiles of rounded values stay within the extremes of the data.
+    default_options(&opts);
+    opts.streaming = true;
+    opts.sketch = SKETCH_HDR;
+    ds = read_data_file_opts("data/odd.dat", &opts);
+    mu_assert(ds, "Could not read data/odd.dat");
+    mu_assert(first_quartile(ds) >= min(ds) && third_quartile(ds) <= max(ds),
+              "HDR quartiles outside of the data");
+    delete_dataset(ds);
+    return NULL;
+}
+
+char *test_summarizer()
+{
+    // Summaries of every mode survive a serialization round trip and can be
+    // merged after it. Truncated buffers are rejected.
+    double values[1000];
+    summarizer_mode mode;
+    Summarizer *s, *copy;
+    size_t i, size;
+    char *buf;
+
+    for (i = 0; i < 1000; i++)
+        values[i] = i + 1;
+    for (mode = SUMMARIZER_EXACT; mode <= SUMMARIZER_HDR; mode++) {
+        s = Summarizer_create(mode);
+        mu_assert(s, "Could not create summarizer");
+        mu_assert(Summarizer_add_batch(s, values, 1000) == 1000,
+                  "Could not add values to summarizer");
+        buf = Summarizer_serialize(s, &size);
+        mu_assert(buf, "Could not serialize summarizer");
+        copy = Summarizer_deserialize(buf, size);
+        mu_assert(copy, "Could not deserialize summarizer");
+        mu_assert(!Summarizer_deserialize(buf, size - 1),
+                  "Truncated summarizer was accepted");
+        free(buf);
+
+        mu_assert(Summarizer_count(copy) == 1000 &&
+                  Summarizer_mean(copy) == Summarizer_mean(s) &&
+                  Summarizer_kurtosis(copy) == Summarizer_kurtosis(s) &&
+                  Summarizer_max(copy) == 1000,
+                  "Incorrect moments after round trip");
+        mu_assert(Summarizer_percentile(copy, 50) == Summarizer_percentile(s, 50),
+                  "Incorrect median after round trip");
+        mu_assert(fabs(Summarizer_percentile(copy, 50) - 500.5) < 20,
+                  "Incorrect median of summarizer");
+        mu_assert(Summarizer_merge(copy, s) && Summarizer_count(copy) == 2000,
+                  "Could not merge summarizers");
+        Summarizer_destroy(copy);
+        Summarizer_destroy(s);
+    }
+    return NULL;
+}
+
+#define NRECORDERS 4
+#define NRECORDED 100000
+
+void *record(void *arg)
+{
+    ShardedSummarizer *ss = (ShardedSummarizer*)arg;
+    size_t i;
+
+    for (i = 1; i <= NRECORDED; i++)
+        ShardedSummarizer_add(ss, (double)i);
+    return NULL;
+}
+
+char *test_sharded()
+{
+    // Values recorded concurrently by several threads, some of which have
+    // exited, all end up in the snapshots.
+    ShardedSummarizer *ss = ShardedSummarizer_create(SUMMARIZER_EXACT);
+    pthread_t threads[NRECORDERS];
+    Summarizer *snapshot;
+    size_t i, last = 0;
+
+    mu_assert(ss, "Could not create sharded summarizer");
+    for (i = 0; i < NRECORDERS; i++)
+        pthread_create(&threads[i], NULL, record, ss);
+    for (i = 0; i < 10; i++) {
+        snapshot = ShardedSummarizer_snapshot(ss);
+        mu_assert(snapshot && Summarizer_count(snapshot) >= last,
+                  "Snapshot lost values");
+        last = Summarizer_count(snapshot);
+        Summarizer_destroy(snapshot);
+    }
+    for (i = 0; i < NRECORDERS; i++)
+        pthread_join(threads[i], NULL);
+    for (i = 0; i < 1000; i++)
+        ShardedSummarizer_add(ss, 0);
+
+    snapshot = ShardedSummarizer_snapshot(ss);
+    mu_assert(Summarizer_count(snapshot) == NRECORDERS * NRECORDED + 1000,
+              "Incorrect count of sharded summarizer");
+    mu_assert(Summarizer_max(snapshot) == NRECORDED && Summarizer_min(snapshot) == 0,
+              "Incorrect extrema of sharded summarizer");
+    mu_assert(fabs(Summarizer_percentile(snapshot, 100) - NRECORDED) < EPSILON,
+              "Incorrect percentile of sharded summarizer");
+    Summarizer_destroy(snapshot);
+    ShardedSummarizer_destroy(ss);
+    return NULL;
+}
+
+void *collect(void *arg)
+{
+    Collector *c = (Collector*)arg;
+    size_t i;
+
+    for (i = 1; i <= NRECORDED; i++)
+        Collector_add(c, (double)i);
+    return NULL;
+}
+
+char *test_collector()
+{
+    // With the blocking policy, every value makes it to the summary. With
+    // the other policies, every value is either aggregated or counted as
+    // dropped or sampled out.
+    collector_policy policies[3] = {COLLECTOR_BLOCK, COLLECTOR_DROP, COLLECTOR_SAMPLE};
+    pthread_t threads[NRECORDERS];
+    collector_stats stats;
+    Summarizer *snapshot;
+    Collector *c;
+    size_t i, p;
+
+    for (p = 0; p < 3; p++) {
+        c = Collector_create(SUMMARIZER_EXACT, 64, policies[p]);
+        mu_assert(c, "Could not create collector");
+        for (i = 0; i < NRECORDERS; i++)
+            pthread_create(&threads[i], NULL, collect, c);
+        for (i = 0; i < NRECORDERS; i++)
+            pthread_join(threads[i], NULL);
+        Collector_flush(c);
+        Collector_get_stats(c, &stats);
+        snapshot = Collector_snapshot(c);
+        mu_assert(stats.aggregated == stats.enqueued &&
+                  Summarizer_count(snapshot) == stats.enqueued,
+                  "Collector lost values");
+        mu_assert(stats.enqueued + stats.dropped + stats.sampled_out ==
+                  NRECORDERS * NRECORDED, "Collector miscounted values");
+        if (policies[p] == COLLECTOR_BLOCK)
+            mu_assert(stats.enqueued == NRECORDERS * NRECORDED,
+                      "Blocking collector dropped values");
+        Summarizer_destroy(snapshot);
+        Collector_destroy(c);
+    }
+
+    // A ring of two slots only samples once it holds both of them.
+    c = Collector_create(SUMMARIZER_EXACT, 2, COLLECTOR_SAMPLE);
+    mu_assert(c, "Could not create collector");
+    mu_assert(Collector_add(c, 1) && Collector_add(c, 2),
+              "Collector sampled out a value from a ring with room");
+    Collector_flush(c);
+    Collector_get_stats(c, &stats);
+    mu_assert(stats.sampled_out == 0 && stats.aggregated == 2,
+              "Collector sampled out a value from a ring with room");
+    Collector_destroy(c);
+    return NULL;
+}
+
+char *test_window()
+{
+    // Values 1 to 100 in the first second, 101 to 200 in the next, and so on,
+    // in a window of 5 one-second buckets.
+    dataset_options opts;
+    Window *w;
+    dataset *ds;
+    TDigest *digest;
+    int i, t;
+
+    default_options(&opts);
+    opts.streaming = true;
+    w = Window_create(&opts, 1, 5, 0);
+    mu_assert(w, "Could not create window");
+    for (t = 0; t < 8; t++) {
+        for (i = 1; i <= 100; i++)
+            mu_assert(Window_add(w, t * 100 + i, t + 0.5), "Could not add to window");
+    }
+
+    ds = Window_query(w, 0, 7.5);
+    mu_assert(ds->n == 100 && min(ds) == 701 && max(ds) == 800,
+              "Incorrect current bucket");
+    delete_dataset(ds);
+    ds = Window_query(w, 2, 7.5);
+    mu_assert(ds->n == 300 && min(ds) == 501 && check_answer(mean(ds), 650.5, EPSILON),
+              "Incorrect window");
+    delete_dataset(ds);
+    ds = Window_query(w, 100, 7.5);
+    mu_assert(ds->n == 500 && min(ds) == 301, "Expired values in window");
+    delete_dataset(ds);
+
+    // With a short half-life, the decayed median is close to the median of
+    // the current bucket, with a long one to the median of the window.
+    digest = Window_decayed(w, 0.1, 7.5);
+    mu_assert(fabs(TDigest_percentile(digest, 0.5) - 750) < 5, "Incorrect decay");
+    TDigest_destroy(digest);
+    digest = Window_decayed(w, 1000, 7.5);
+    mu_assert(fabs(TDigest_percentile(digest, 0.5) - 550) < 10, "Incorrect decay");
+    TDigest_destroy(digest);
+
+    ds = Window_query(w, 100, 20);
+    mu_assert(ds->n == 0, "Window not emptied");
+    delete_dataset(ds);
+    Window_destroy(w);
+    return NULL;
+}
+
+#define SERVER_SOCKET "test_server.sock"
+#define SERVER_SNAPSHOT "test_server.snap"
+
+void *serve(void *arg)
+{
+    if (!Server_run(SERVER_SOCKET, SUMMARIZER_EXACT, 0))
+        log_err("Could not run server.");
+    return arg;
+}
+
+int server_request(int fd, const char *request, char *reply, size_t size)
+{
+    // Send a request and read the reply up to its final OK or ERR line.
+    ssize_t got;
+    size_t len = 0;
+
+    if (write(fd, request, strlen(request)) != (ssize_t)strlen(request))
+        return 0;
+    while (len < size - 1) {
+        got = read(fd, reply + len, size - 1 - len);
+        if (got <= 0)
+            return 0;
+        len += got;
+        reply[len] = '\0';
+        if (strstr(reply, "ERR") || (len >= 3 && strcmp(reply + len - 3, "OK\n") == 0))
+            return 1;
+    }
+    return 0;
+}
+
+char *test_server()
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX, .sun_path = SERVER_SOCKET };
+    char reply[1024], *values = "1\n2\n3\nx:4\nx:5\nx:bad\n"
+                                "-inf\ninf\nnan\nx:inf\n";
+    double binary[3] = {10, 20, 30};
+    pthread_t thread;
+    Summarizer *snapshot;
+    FILE *f;
+    size_t size;
+    int i, fd;
+
+    pthread_create(&thread, NULL, serve, NULL);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    for (i = 0; i < 100 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0; i++)
+        usleep(10000);
+    mu_assert(i < 100, "Could not connect to server");
+
+    mu_assert(write(fd, values, strlen(values)) == (ssize_t)strlen(values),
+              "Could not send values");
+    mu_assert(server_request(fd, "PERCENTILE default 50 100\n", reply, sizeof(reply)) &&
+              strcmp(reply, "50 2\n100 3\nOK\n") == 0, "Incorrect server percentiles");
+    mu_assert(server_request(fd, "PERCENTILE default 50 101\n", reply, sizeof(reply)) &&
+              strcmp(reply, "ERR invalid percentile 101\n") == 0,
+              "Invalid percentile not rejected before replying");
+    mu_assert(server_request(fd, "STATS x\n", reply, sizeof(reply)) &&
+              strstr(reply, "count     2\nrejected  2\n"), "Incorrect server stats");
+    mu_assert(server_request(fd, "STATS default\n", reply, sizeof(reply)) &&
+              strstr(reply, "count     3\nrejected  3\n"),
+              "Infinite values not rejected");
+    mu_assert(server_request(fd, "STATS y\n", reply, sizeof(reply)) &&
+              strncmp(reply, "ERR", 3) == 0, "Queried unknown summary");
+    mu_assert(server_request(fd, "SNAPSHOT x " SERVER_SNAPSHOT "\n", reply, sizeof(reply)) &&
+              strcmp(reply, "OK\n") == 0, "Could not snapshot summary");
+    f = fopen(SERVER_SNAPSHOT, "rb");
+    mu_assert(f, "Snapshot not written");
+    size = fread(reply, 1, sizeof(reply), f);
+    fclose(f);
+    unlink(SERVER_SNAPSHOT);
+    snapshot = Summarizer_deserialize(reply, size);
+    mu_assert(snapshot && Summarizer_count(snapshot) == 2 &&
+              Summarizer_max(snapshot) == 5, "Incorrect snapshot");
+    Summarizer_destroy(snapshot);
+    mu_assert(server_request(fd, "RESET x\n", reply, sizeof(reply)) &&
+              server_request(fd, "LIST\n", reply, sizeof(reply)) &&
+              strstr(reply, "x 0\n"), "Could not reset summary");
+
+    mu_assert(server_request(fd, "BINARY y\n", reply, sizeof(reply)),
+              "Could not switch to binary input");
+    mu_assert(write(fd, binary, sizeof(binary)) == sizeof(binary),
+              "Could not send binary values");
+    close(fd);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mu_assert(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0,
+              "Could not reconnect to server");
+    // The server reads clients in turn, the binary values may not be in yet.
+    for (i = 0; i < 100; i++) {
+        mu_assert(server_request(fd, "LIST\n", reply, sizeof(reply)),
+                  "Could not list summaries");
+        if (strstr(reply, "y 3\n"))
+            break;
+        usleep(10000);
+    }
+    mu_assert(i < 100, "Binary values not recorded");
+    mu_assert(server_request(fd, "SHUTDOWN\n", reply, sizeof(reply)),
+              "Could not shut down server");
+    close(fd);
+    pthread_join(thread, NULL);
+    mu_assert(access(SERVER_SOCKET, F_OK) != 0, "Socket not removed");
+    return NULL;
+}
+
 char *test_nofile()
 {
     dataset *ds = read_data_file("imnotthere.dat", false);
@@ -309,19 +1389,42 @@ char *all_tests()
     mu_run_test(test_odd2);
     mu_run_test(test_odd3);
     mu_run_test(test_odd3_streaming);
+    mu_run_test(test_odd3_gzip);
     mu_run_test(test_odd4);
     mu_run_test(test_odd5);
     mu_run_test(test_even1);
     mu_run_test(test_even2);
     mu_run_test(test_even3);
     mu_run_test(test_even3_streaming);
+    mu_run_test(test_even3_kll);
     mu_run_test(test_even4);
     mu_run_test(test_empty);
     mu_run_test(test_nofile);
     mu_run_test(test_small_streaming);
+    mu_run_test(test_merge);
+    mu_run_test(test_merge_streaming);
+    mu_run_test(test_large);
+    mu_run_test(test_moments);
+    mu_run_test(test_accurate);
+    mu_run_test(test_spill);
+    mu_run_test(test_sort);
+    mu_run_test(test_histogram);
+    mu_run_test(test_distinct_topk);
+    mu_run_test(test_moments_only);
+    mu_run_test(test_weighted);
+    mu_run_test(test_format);
     mu_run_test(test_centroid);
     mu_run_test(test_create_destroy_tdigest);
     mu_run_test(test_tdigest_add);
+    mu_run_test(test_tdigest_memory);
+    mu_run_test(test_kll);
+    mu_run_test(test_ddsketch);
+    mu_run_test(test_hdr);
+    mu_run_test(test_summarizer);
+    mu_run_test(test_sharded);
+    mu_run_test(test_collector);
+    mu_run_test(test_window);
+    mu_run_test(test_server);
 
     return NULL;
 }
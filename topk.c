@@ -0,0 +1,270 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbg.h"
+#include "topk.h"
+
+typedef struct TopKCounter {
+    double value;
+    uint64_t hash;
+    size_t count;
+    size_t error;
+    // Position of the counter in the hash table.
+    size_t slot;
+} TopKCounter;
+
+struct TopK {
+    size_t capacity;
+    size_t size;
+    // Min-heap of the counters on their count.
+    TopKCounter *heap;
+    // Hash table of 1 + the position of the counters in the heap, 0 for an
+    // empty slot, with linear probing. It has at least twice as many slots
+    // as counters.
+    size_t *slots;
+    size_t mask;
+};
+
+TopK *TopK_create(size_t capacity)
+{
+    // Create a sketch with capacity counters.
+    TopK *t = NULL;
+    size_t nslots = 16;
+
+    check(capacity > 0, "Top-k capacity must be positive.");
+    t = calloc(1, sizeof(TopK));
+    check_mem(t);
+    t->capacity = capacity;
+    t->heap = calloc(capacity, sizeof(TopKCounter));
+    check_mem(t->heap);
+    while (nslots < 2 * capacity)
+        nslots *= 2;
+    t->slots = calloc(nslots, sizeof(size_t));
+    check_mem(t->slots);
+    t->mask = nslots - 1;
+    return t;
+
+error:
+    TopK_destroy(t);
+    return NULL;
+}
+
+void TopK_destroy(TopK *t)
+{
+    if (!t)
+        return;
+    free(t->heap);
+    free(t->slots);
+    free(t);
+}
+
+static inline void TopK_place(TopK *t, size_t i, TopKCounter *c)
+{
+    t->heap[i] = *c;
+    t->slots[c->slot] = i + 1;
+}
+
+static void TopK_sift_up(TopK *t, size_t i)
+{
+    // Move the counter at i up to its place, shifting its ancestors down
+    // rather than swapping at every level.
+    TopKCounter c = t->heap[i];
+
+    while (i > 0 && c.count < t->heap[(i - 1) / 2].count) {
+        TopK_place(t, i, &t->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    TopK_place(t, i, &c);
+}
+
+static void TopK_sift_down(TopK *t, size_t i)
+{
+    TopKCounter c = t->heap[i];
+    size_t child;
+
+    while ((child = 2 * i + 1) < t->size) {
+        if (child + 1 < t->size &&
+            t->heap[child + 1].count < t->heap[child].count)
+            child++;
+        if (c.count <= t->heap[child].count)
+            break;
+        TopK_place(t, i, &t->heap[child]);
+        i = child;
+    }
+    TopK_place(t, i, &c);
+}
+
+static size_t TopK_find(TopK *t, double x, uint64_t hash)
+{
+    // Position of the counter of x in the heap, or t->size if x has none.
+    size_t i = hash & t->mask;
+
+    while (t->slots[i]) {
+        if (t->heap[t->slots[i] - 1].value == x)
+            return t->slots[i] - 1;
+        i = (i + 1) & t->mask;
+    }
+    return t->size;
+}
+
+static void TopK_insert_slot(TopK *t, size_t h)
+{
+    // Index the counter at position h of the heap.
+    size_t i = t->heap[h].hash & t->mask;
+
+    while (t->slots[i])
+        i = (i + 1) & t->mask;
+    t->slots[i] = h + 1;
+    t->heap[h].slot = i;
+}
+
+static void TopK_remove_slot(TopK *t, size_t i)
+{
+    // Empty slot i, moving back the following entries of the same cluster
+    // that can't be found anymore, so that no tombstone is needed.
+    size_t j = i, home;
+
+    t->slots[i] = 0;
+    while (true) {
+        j = (j + 1) & t->mask;
+        if (!t->slots[j])
+            return;
+        home = t->heap[t->slots[j] - 1].hash & t->mask;
+        // The entry at j stays if its home is cyclically in (i, j].
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        t->slots[i] = t->slots[j];
+        t->heap[t->slots[i] - 1].slot = i;
+        t->slots[j] = 0;
+        i = j;
+    }
+}
+
+void TopK_add(TopK *t, double x, uint64_t hash, size_t w)
+{
+    // Add x with weight w. hash must be hash_double(x). NaNs are not
+    // counted, since they are all different.
+    size_t h;
+
+    if (isnan(x))
+        return;
+    h = TopK_find(t, x, hash);
+    if (h < t->size) {
+        t->heap[h].count += w;
+        TopK_sift_down(t, h);
+    } else if (t->size < t->capacity) {
+        h = t->size++;
+        t->heap[h].value = x;
+        t->heap[h].hash = hash;
+        t->heap[h].count = w;
+        t->heap[h].error = 0;
+        TopK_insert_slot(t, h);
+        TopK_sift_up(t, h);
+    } else {
+        // Take over the counter of the least frequent value.
+        TopK_remove_slot(t, t->heap[0].slot);
+        t->heap[0].value = x;
+        t->heap[0].hash = hash;
+        t->heap[0].error = t->heap[0].count;
+        t->heap[0].count += w;
+        TopK_insert_slot(t, 0);
+        TopK_sift_down(t, 0);
+    }
+}
+
+static int countcmp(const void *a, const void *b)
+{
+    // Decreasing counts.
+    size_t x = ((const TopKCounter*)a)->count, y = ((const TopKCounter*)b)->count;
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+int TopK_merge(TopK *t, TopK *other)
+{
+    // Add the values of other to t. A value missing from a full sketch may
+    // have been counted as often as its smallest count, which is added to
+    // both its count and its error. The capacity most frequent values of
+    // the union are kept.
+    TopKCounter *all = NULL;
+    size_t i, h, n = 0;
+    size_t tmin = t->size == t->capacity ? t->heap[0].count : 0;
+    size_t omin = other->size == other->capacity ? other->heap[0].count : 0;
+
+    if (other->size == 0)
+        return 1;
+    all = malloc((t->size + other->size) * sizeof(TopKCounter));
+    check_mem(all);
+    for (i = 0; i < t->size; i++) {
+        all[n] = t->heap[i];
+        h = TopK_find(other, all[n].value, all[n].hash);
+        if (h < other->size) {
+            all[n].count += other->heap[h].count;
+            all[n].error += other->heap[h].error;
+        } else {
+            all[n].count += omin;
+            all[n].error += omin;
+        }
+        n++;
+    }
+    for (i = 0; i < other->size; i++) {
+        if (TopK_find(t, other->heap[i].value, other->heap[i].hash) < t->size)
+            continue;
+        all[n] = other->heap[i];
+        all[n].count += tmin;
+        all[n].error += tmin;
+        n++;
+    }
+
+    qsort(all, n, sizeof(TopKCounter), countcmp);
+    memset(t->slots, 0, (t->mask + 1) * sizeof(size_t));
+    t->size = n < t->capacity ? n : t->capacity;
+    // In decreasing order, the heap property holds the other way around.
+    for (i = 0; i < t->size; i++) {
+        t->heap[i] = all[t->size - 1 - i];
+        TopK_insert_slot(t, i);
+    }
+    free(all);
+    return 1;
+
+error:
+    return 0;
+}
+
+size_t TopK_top(TopK *t, TopKItem *items, size_t k)
+{
+    // Store the k most frequent values, or as many as there are, in items
+    // by decreasing count and return their number.
+    TopKCounter *sorted = NULL;
+    size_t i;
+
+    sorted = malloc((t->size > 0 ? t->size : 1) * sizeof(TopKCounter));
+    check_mem(sorted);
+    memcpy(sorted, t->heap, t->size * sizeof(TopKCounter));
+    qsort(sorted, t->size, sizeof(TopKCounter), countcmp);
+    if (k > t->size)
+        k = t->size;
+    for (i = 0; i < k; i++) {
+        items[i].value = sorted[i].value;
+        items[i].count = sorted[i].count;
+        items[i].error = sorted[i].error;
+    }
+    free(sorted);
+    return k;
+
+error:
+    return 0;
+}
+
+size_t TopK_get_capacity(TopK *t)
+{
+    return t->capacity;
+}
+
+size_t TopK_get_memory(TopK *t)
+{
+    // Number of bytes used by the sketch, its counters and its hash table.
+    return sizeof(TopK) + t->capacity * sizeof(TopKCounter) +
+           (t->mask + 1) * sizeof(size_t);
+}
@@ -0,0 +1,48 @@
+/*
+ * This is an implementation of the Space-Saving algorithm by Ahmed Metwally,
+ * Divyakant Agrawal and Amr El Abbadi, Efficient Computation of Frequent and
+ * Top-k Elements in Data Streams, ICDT 2005, which finds the most frequent
+ * values of a stream in fixed memory.
+ *
+ * The sketch keeps a counter for each of at most capacity values. A value
+ * without a counter takes over the counter of the least frequent one, whose
+ * count becomes the error of the new value, so a count overestimates the
+ * frequency of its value by at most its error, and at most n / capacity.
+ * Every value more frequent than n / capacity is guaranteed to have a
+ * counter. The counters are a min-heap on the count, indexed by an open
+ * addressing hash table, so a value is added in O(log capacity). Sketches
+ * merge as described by Agarwal et al., Mergeable Summaries, PODS 2012.
+ */
+
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Counters kept for each of the k values asked for, so that the counts of the
+// top k are tighter than n / k, and fewest counters kept for any k, which
+// makes the counts exact for data with few distinct values.
+#define TOPK_SLACK 8
+#define TOPK_MIN_CAPACITY 4096
+// Largest k accepted by desc --top.
+#define TOPK_MAX (1 << 20)
+
+typedef struct TopKItem {
+    double value;
+    size_t count;
+    // The frequency of value is between count - error and count.
+    size_t error;
+} TopKItem;
+
+typedef struct TopK TopK;
+
+TopK *TopK_create(size_t capacity);
+void TopK_destroy(TopK *t);
+void TopK_add(TopK *t, double x, uint64_t hash, size_t w);
+int TopK_merge(TopK *t, TopK *other);
+size_t TopK_top(TopK *t, TopKItem *items, size_t k);
+size_t TopK_get_capacity(TopK *t);
+size_t TopK_get_memory(TopK *t);
+
+#endif
@@ -0,0 +1,172 @@
+#include <math.h>
+#include <stdlib.h>
+#include "dbg.h"
+#include "window.h"
+
+static int Window_clear(Window *w, size_t i)
+{
+    // Replace bucket i with an empty one.
+    dataset *ds = create_empty_dataset(&(w->opts), 0);
+
+    check(ds, "Could not create window bucket.");
+    if (w->buckets[i])
+        delete_dataset(w->buckets[i]);
+    w->buckets[i] = ds;
+    return 1;
+
+error:
+    return 0;
+}
+
+Window *Window_create(dataset_options *opts, double interval, size_t nbuckets,
+                      double now)
+{
+    // Create a window of nbuckets intervals of interval seconds, starting at
+    // now. The buckets are datasets configured by opts.
+    Window *w = NULL;
+    size_t i;
+
+    check(interval > 0 && nbuckets > 0, "Invalid window.");
+    w = calloc(1, sizeof(Window));
+    check_mem(w);
+    w->opts = *opts;
+    w->nbuckets = nbuckets;
+    w->interval = interval;
+    w->start = now;
+    w->buckets = calloc(nbuckets, sizeof(dataset*));
+    check_mem(w->buckets);
+    for (i = 0; i < nbuckets; i++)
+        check(Window_clear(w, i), "Could not create window.");
+    return w;
+
+error:
+    Window_destroy(w);
+    return NULL;
+}
+
+void Window_destroy(Window *w)
+{
+    size_t i;
+
+    if (!w)
+        return;
+    if (w->buckets) {
+        for (i = 0; i < w->nbuckets; i++) {
+            if (w->buckets[i])
+                delete_dataset(w->buckets[i]);
+        }
+        free(w->buckets);
+    }
+    free(w);
+}
+
+int Window_rotate(Window *w, double now)
+{
+    // Move on to the bucket of the interval containing now, emptying the
+    // buckets of the intervals that have expired on the way.
+    double steps = floor((now - w->start) / w->interval);
+    size_t i, n;
+
+    if (!(steps >= 1))
+        return 1;
+    n = steps < w->nbuckets ? (size_t)steps : w->nbuckets;
+    for (i = 0; i < n; i++) {
+        w->current = (w->current + 1) % w->nbuckets;
+        check(Window_clear(w, w->current), "Could not rotate window.");
+    }
+    w->start += steps * w->interval;
+    return 1;
+
+error:
+    return 0;
+}
+
+int Window_reset(Window *w, double now)
+{
+    // Forget every value and start a new interval at now.
+    size_t i;
+
+    for (i = 0; i < w->nbuckets; i++)
+        check(Window_clear(w, i), "Could not reset window.");
+    w->current = 0;
+    w->start = now;
+    return 1;
+
+error:
+    return 0;
+}
+
+int Window_add(Window *w, double x, double now)
+{
+    // Add x, seen at time now, to the window.
+    if (!Window_rotate(w, now))
+        return 0;
+    return push(w->buckets[w->current], x);
+}
+
+size_t Window_add_batch(Window *w, const double *values, size_t n, double now)
+{
+    // Add n values seen at time now. Returns the number of values recorded.
+    if (!Window_rotate(w, now))
+        return 0;
+    return push_batch(w->buckets[w->current], values, n);
+}
+
+dataset *Window_query(Window *w, double span, double now)
+{
+    // Merge of the current bucket and of the ceil(span / interval) buckets
+    // before it, which the caller must delete.
+    dataset *ds = NULL;
+    size_t i, k = 1;
+
+    check(Window_rotate(w, now), "Could not query window.");
+    if (span > 0)
+        k += span / w->interval >= w->nbuckets - 1 ?
+             w->nbuckets - 1 : (size_t)ceil(span / w->interval);
+    ds = create_empty_dataset(&(w->opts), 0);
+    check(ds, "Could not query window.");
+    for (i = 0; i < k; i++) {
+        check(merge_datasets(ds, w->buckets[(w->current + w->nbuckets - i) %
+                                            w->nbuckets]),
+              "Could not merge window buckets.");
+    }
+    return ds;
+
+error:
+    if (ds) delete_dataset(ds);
+    return NULL;
+}
+
+TDigest *Window_decayed(Window *w, double half_life, double now)
+{
+    // t-digest of the whole window where each bucket is weighed by
+    // 2^(-age/half_life), age being the time since the end of its interval,
+    // 0 for the current bucket. The caller must destroy it. Only available
+    // in t-digest mode.
+    TDigest *digest = NULL;
+    dataset *bucket;
+    double age, weight;
+    size_t i;
+
+    check(w->opts.streaming && w->opts.sketch == SKETCH_TDIGEST,
+          "Decay is only available in t-digest mode.");
+    check(half_life > 0, "Invalid half-life.");
+    check(Window_rotate(w, now), "Could not query window.");
+    digest = TDigest_create(DEFAULT_DELTA, DEFAULT_K);
+    check_mem(digest);
+
+    for (i = 0; i < w->nbuckets; i++) {
+        bucket = w->buckets[(w->current + w->nbuckets - i) % w->nbuckets];
+        if (bucket->n == 0)
+            continue;
+        age = i == 0 ? 0 : now - (w->start - (i - 1) * w->interval);
+        weight = WINDOW_DECAY_SCALE * exp2(-age / half_life);
+        check(TDigest_merge_weighted(&digest, bucket->digest, weight),
+              "Could not merge window buckets.");
+    }
+    return digest;
+
+error:
+    if (digest) TDigest_destroy(digest);
+    return NULL;
+}
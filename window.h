@@ -0,0 +1,52 @@
+/*
+ * Statistics over the recent past of a stream, such as the 99th percentile
+ * of the last 5 minutes.
+ *
+ * A Window is a ring of nbuckets datasets, each holding the moments and the
+ * sketch of the values added during one interval. When an interval is over,
+ * the oldest bucket is emptied and receives the values of the next one, so
+ * the window spans the last nbuckets intervals, the current one included. A
+ * query over the last span seconds merges the current bucket with enough
+ * full buckets to cover span, so it counts the values of the last span
+ * seconds and at most one interval more.
+ *
+ * In t-digest mode, Window_decayed weighs every bucket by 2^(-age/half_life)
+ * instead, so that recent values count more than old ones without any sharp
+ * cut-off.
+ *
+ * Times are given by the caller in seconds, from any monotonic clock.
+ * Buckets are rotated by every call that takes the time, and should also be
+ * rotated with Window_rotate on a timer so that expired values are freed
+ * even when nothing is added.
+ */
+
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include "stats.h"
+
+// The counts of the decayed digest are scaled by this factor before
+// rounding, so that the weights of old buckets keep some precision.
+#define WINDOW_DECAY_SCALE 1024
+
+typedef struct Window {
+    dataset_options opts;
+    dataset **buckets;
+    size_t nbuckets;
+    // Bucket that receives new values, and the time its interval started.
+    size_t current;
+    double start;
+    double interval;
+} Window;
+
+Window *Window_create(dataset_options *opts, double interval, size_t nbuckets,
+                     double now);
+void Window_destroy(Window *w);
+int Window_rotate(Window *w, double now);
+int Window_reset(Window *w, double now);
+int Window_add(Window *w, double x, double now);
+size_t Window_add_batch(Window *w, const double *values, size_t n, double now);
+dataset *Window_query(Window *w, double span, double now);
+TDigest *Window_decayed(Window *w, double half_life, double now);
+
+#endif